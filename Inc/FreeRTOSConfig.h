@@ -67,8 +67,9 @@
 #define configCHECK_FOR_STACK_OVERFLOW           1
 #define configENABLE_BACKWARD_COMPATIBILITY      0
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION  1
-// FIXME: configUSE_TICKLESS_IDLE must be 0 or changing modem type locks up.
-#define configUSE_TICKLESS_IDLE                  0
+#define configUSE_TRACE_FACILITY                 1
+#define configGENERATE_RUN_TIME_STATS            1
+#define configUSE_TICKLESS_IDLE                  1
 
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES                    0
@@ -135,6 +136,17 @@ standard names. */
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
 /* USER CODE END Defines */ 
 
+/* USER CODE BEGIN 2 */
+/* Definitions needed when configGENERATE_RUN_TIME_STATS is on.  The run time
+counter is in microseconds, derived from the HAL time base (TIM2). */
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+void configureTimerForRunTimeStats(void);
+unsigned long getRunTimeCounterValue(void);
+#endif
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS configureTimerForRunTimeStats
+#define portGET_RUN_TIME_COUNTER_VALUE getRunTimeCounterValue
+/* USER CODE END 2 */
+
 #if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
 void PreSleepProcessing(uint32_t *ulExpectedIdleTime);
 void PostSleepProcessing(uint32_t *ulExpectedIdleTime);
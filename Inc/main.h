@@ -156,6 +156,14 @@
 #define CMD_USB_SUSPEND 25
 #define CMD_USB_RESUME 26
 
+#define CMD_PUSH_COUNTERS 27    // Send the runtime counters record.
+
+#define CMD_EVENT_LOG 28        // Send the next event log entry.
+
+#define CMD_SETTINGS_COMMITTED 29   // Settings written to EEPROM.
+
+#define CMD_DIGI_PENDING 30     // Send the held digipeater frames that are due.
+
 extern int reset_requested;
 extern char serial_number_64[17];
 extern uint8_t mac_address[6];
@@ -172,6 +180,7 @@ extern osMutexId hardwareInitMutexHandle;
  extern "C" {
 #endif
 
+// Set the nominal clock for the modem, or go idle.  See ClockGovernor.hpp.
 void SysClock48(void);
 void SysClock80(void);
 void SysClock4(void);
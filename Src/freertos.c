@@ -54,7 +54,8 @@
 #include "main.h"
 
 /* Private includes ----------------------------------------------------------*/
-/* USER CODE BEGIN Includes */     
+/* USER CODE BEGIN Includes */
+#include "stm32l4xx_hal.h"
 
 /* USER CODE END Includes */
 
@@ -94,8 +95,40 @@ void vApplicationGetIdleTaskMemory( StaticTask_t **ppxIdleTaskTCBBuffer, StackTy
 void vApplicationGetTimerTaskMemory( StaticTask_t **ppxTimerTaskTCBBuffer, StackType_t **ppxTimerTaskStackBuffer, uint32_t *pulTimerTaskStackSize );
 
 /* Hook prototypes */
+void configureTimerForRunTimeStats(void);
+unsigned long getRunTimeCounterValue(void);
 void vApplicationStackOverflowHook(TaskHandle_t xTask, signed char *pcTaskName);
 
+/* USER CODE BEGIN 1 */
+/* Functions needed when configGENERATE_RUN_TIME_STATS is on */
+void configureTimerForRunTimeStats(void)
+{
+  /* TIM2 is already running at 1MHz as the HAL time base. */
+}
+
+/*
+ * Return the time since boot in microseconds: the HAL tick (ms) plus the
+ * TIM2 counter.  This costs a few register reads per context switch and
+ * needs no extra timer.  It wraps every 71 minutes, which only matters if
+ * the statistics are sampled less often than that.
+ */
+unsigned long getRunTimeCounterValue(void)
+{
+  uint32_t tick;
+  uint32_t count;
+  uint32_t pending;
+
+  do {
+    tick = uwTick;
+    count = TIM2->CNT;
+    /* The counter has wrapped but the tick interrupt has not yet run. */
+    pending = (TIM2->SR & TIM_SR_UIF) && (count < 500);
+  } while (tick != uwTick);
+
+  return (tick + pending) * 1000 + count;
+}
+/* USER CODE END 1 */
+
 /* USER CODE BEGIN 4 */
 __weak void vApplicationStackOverflowHook(TaskHandle_t xTask, signed char *pcTaskName)
 {
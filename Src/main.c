@@ -58,6 +58,7 @@
 #include "PortInterface.h"
 #include "LEDIndicator.h"
 #include "bm78.h"
+#include "Trace.h"
 #include "base64.h"
 #include "KissHardware.h"
 #include "Log.h"
@@ -129,9 +130,6 @@ osStaticMessageQDef_t hdlcOutputQueueControlBlock;
 osMessageQId dacOutputQueueHandle;
 uint8_t dacOutputQueueBuffer[ 128 * sizeof( uint8_t ) ];
 osStaticMessageQDef_t dacOutputQueueControlBlock;
-osMessageQId adcInputQueueHandle;
-uint8_t adcInputQueueBuffer[ 3 * sizeof( uint32_t ) ];
-osStaticMessageQDef_t adcInputQueueControlBlock;
 osTimerId beaconTimer1Handle;
 osStaticTimerDef_t beaconTimer1ControlBlock;
 osTimerId beaconTimer2Handle;
@@ -159,6 +157,14 @@ int stop_now __attribute__((section(".bss3")));
 int charging_enabled __attribute__((section(".bss3")));
 int usb_wake_state __attribute__((section(".bss3")));
 int reset_button = 0;
+osTimerId countersTimerHandle;
+osStaticTimerDef_t countersTimerControlBlock;
+osTimerId digipeaterTimerHandle;
+osStaticTimerDef_t digipeaterTimerControlBlock;
+osStaticMutexDef_t hardwareInitMutexControlBlock;
+osThreadId settingsWriterTaskHandle;
+uint32_t settingsWriterTaskBuffer[ 256 ];
+osStaticThreadDef_t settingsWriterTaskControlBlock;
 
 /* USER CODE END PV */
 
@@ -200,6 +206,8 @@ void configure_wakeup_gpio(void);
 void enable_debug_gpio(void);
 void init_rtc_date_time(void);
 void init_rtc_alarm(void);
+extern void pushCounters(void const * argument);
+extern void digipeaterPending(void const * argument);
 
 /* USER CODE END PFP */
 
@@ -511,7 +519,7 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_MUTEX */
   /* add mutexes, ... */
-  osMutexDef(hardwareInitMutex);
+  osMutexStaticDef(hardwareInitMutex, &hardwareInitMutexControlBlock);
   hardwareInitMutexHandle = osMutexCreate(osMutex(hardwareInitMutex));
   osMutexWait(hardwareInitMutexHandle, osWaitForever);
 
@@ -544,6 +552,10 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_TIMERS */
   /* start timers, add new ones, ... */
+  osTimerStaticDef(countersTimer, pushCounters, &countersTimerControlBlock);
+  countersTimerHandle = osTimerCreate(osTimer(countersTimer), osTimerPeriodic, NULL);
+  osTimerStaticDef(digipeaterTimer, digipeaterPending, &digipeaterTimerControlBlock);
+  digipeaterTimerHandle = osTimerCreate(osTimer(digipeaterTimer), osTimerOnce, NULL);
   /* USER CODE END RTOS_TIMERS */
 
   /* Create the thread(s) */
@@ -569,6 +581,11 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_THREADS */
   /* add threads, ... */
+  osThreadStaticDef(settingsWriterTask, startSettingsWriterTask, osPriorityIdle, 0, 256, settingsWriterTaskBuffer, &settingsWriterTaskControlBlock);
+  settingsWriterTaskHandle = osThreadCreate(osThread(settingsWriterTask), NULL);
+#ifdef KISS_LOG_TRACE
+  initTrace();
+#endif
   /* USER CODE END RTOS_THREADS */
 
   /* Create the queue(s) */
@@ -600,10 +617,6 @@ int main(void)
   osMessageQStaticDef(dacOutputQueue, 128, uint8_t, dacOutputQueueBuffer, &dacOutputQueueControlBlock);
   dacOutputQueueHandle = osMessageCreate(osMessageQ(dacOutputQueue), NULL);
 
-  /* definition and creation of adcInputQueue */
-  osMessageQStaticDef(adcInputQueue, 3, uint32_t, adcInputQueueBuffer, &adcInputQueueControlBlock);
-  adcInputQueueHandle = osMessageCreate(osMessageQ(adcInputQueue), NULL);
-
   /* USER CODE BEGIN RTOS_QUEUES */
   /* add queues, ... */
   /* USER CODE BEGIN RTOS_QUEUES */
@@ -625,7 +638,10 @@ int main(void)
       } else if (reset_button) {
           bm78_initialize_mac_address();
       }
-      else bm78_wait_until_ready();
+      else {
+          bm78_configure_uart();
+          bm78_wait_until_ready();
+      }
   }
 
   init_ioport();
@@ -1452,118 +1468,6 @@ void init_rtc_alarm()
 
 }
 
-void SysClock48()
-{
-    RCC_OscInitTypeDef RCC_OscInitStruct;
-    RCC_ClkInitTypeDef RCC_ClkInitStruct;
-
-    if (HAL_RCC_GetHCLKFreq() == 48000000) return;
-
-    INFO("Setting 48MHz SysClock.");
-
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    /**Configure the Systick interrupt time
-    */
-    HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
-
-    RCC_OscInitStruct.OscillatorType = 0;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_MSI;
-    RCC_OscInitStruct.PLL.PLLM = 1;
-    RCC_OscInitStruct.PLL.PLLN = 24;
-    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV7;
-    RCC_OscInitStruct.PLL.PLLQ = RCC_PLLQ_DIV2;
-    RCC_OscInitStruct.PLL.PLLR = RCC_PLLR_DIV2;
-    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    /**Configure the Systick interrupt time
-    */
-    HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
-}
-
-void SysClock80()
-{
-    RCC_OscInitTypeDef RCC_OscInitStruct;
-    RCC_ClkInitTypeDef RCC_ClkInitStruct;
-
-    if (HAL_RCC_GetHCLKFreq() == 80000000) return;
-
-    INFO("Setting 80MHz SysClock.");
-
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    RCC_OscInitStruct.OscillatorType = 0;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_MSI;
-    RCC_OscInitStruct.PLL.PLLM = 1;
-    RCC_OscInitStruct.PLL.PLLN = 40;
-    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV7;
-    RCC_OscInitStruct.PLL.PLLQ = RCC_PLLQ_DIV2;
-    RCC_OscInitStruct.PLL.PLLR = RCC_PLLR_DIV2;
-    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_4) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    /**Configure the Systick interrupt time
-    */
-    HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
-}
-
-void SysClock4()
-{
-    RCC_OscInitTypeDef RCC_OscInitStruct;
-    RCC_ClkInitTypeDef RCC_ClkInitStruct;
-
-    taskENTER_CRITICAL();
-
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_MSI;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
-    {
-      _Error_Handler(__FILE__, __LINE__);
-    }
-
-    /**Configure the Systick interrupt time
-    */
-    HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
-
-    taskEXIT_CRITICAL();
-}
-
 /* USER CODE END 4 */
 
 /* USER CODE BEGIN Header_StartDefaultTask */
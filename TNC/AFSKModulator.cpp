@@ -5,7 +5,7 @@
 
 namespace mobilinkd { namespace tnc {
 
-void AFSKModulator::init(const kiss::Hardware& hw)
+void AFSKModulator::configure(const kiss::Hardware& hw)
 {
     set_twist(hw.tx_twist);
 
@@ -18,6 +18,19 @@ void AFSKModulator::init(const kiss::Hardware& hw)
         ERROR("htim7 init failed");
         CxxErrorHandler();
     }
+}
+
+void AFSKModulator::activate(const kiss::Hardware& hw)
+{
+    configure(hw);
+
+    if (HAL_DAC_SetValue(&hdac1, DAC_CHANNEL_1, DAC_ALIGN_12B_R, 2048) != HAL_OK) CxxErrorHandler();
+    if (HAL_DAC_Start(&hdac1, DAC_CHANNEL_1) != HAL_OK) CxxErrorHandler();
+}
+
+void AFSKModulator::init(const kiss::Hardware& hw)
+{
+    configure(hw);
 
     DAC_ChannelConfTypeDef sConfig;
 
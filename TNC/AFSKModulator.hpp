@@ -85,11 +85,17 @@ struct AFSKModulator : Modulator
     }
 
    void init(const kiss::Hardware& hw);
+   void activate(const kiss::Hardware& hw) override;
 
    void deinit() override
    {
    }
 
+private:
+   void configure(const kiss::Hardware& hw);
+
+public:
+
    void set_gain(uint16_t v) override
     {
         v = std::max<uint16_t>(256, v);
@@ -164,11 +170,13 @@ struct AFSKModulator : Modulator
     void fill_first(bool bit) override
     {
         fill(buffer_.data(), bit);
+        loopback::loopback().write(buffer_.data(), BIT_LEN);
     }
 
     void fill_last(bool bit) override
     {
         fill(buffer_.data() + BIT_LEN, bit);
+        loopback::loopback().write(buffer_.data() + BIT_LEN, BIT_LEN);
     }
 
     void empty() override
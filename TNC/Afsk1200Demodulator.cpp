@@ -5,6 +5,7 @@
 #include "Goertzel.h"
 #include "AudioInput.hpp"
 #include "GPIO.hpp"
+#include "Statistics.hpp"
 
 namespace mobilinkd { namespace tnc {
 
@@ -28,6 +29,7 @@ hdlc::IoFrame* Afsk1200Demodulator::operator()(const q15_t* samples)
     auto frame1 = demod1(filtered, ADC_BLOCK_SIZE);
     if (frame1)
     {
+        stats::count(stats::counters().decoded[0]);
         if (frame1->fcs() != last_fcs or counter > last_counter + 2)
         {
             last_fcs = frame1->fcs();
@@ -45,6 +47,7 @@ hdlc::IoFrame* Afsk1200Demodulator::operator()(const q15_t* samples)
     auto frame2 = demod2(filtered, ADC_BLOCK_SIZE);
     if (frame2)
     {
+        stats::count(stats::counters().decoded[1]);
         if (frame2->fcs() != last_fcs or counter > last_counter + 2)
         {
             last_fcs = frame2->fcs();
@@ -62,6 +65,7 @@ hdlc::IoFrame* Afsk1200Demodulator::operator()(const q15_t* samples)
     auto frame3 = demod3(filtered, ADC_BLOCK_SIZE);
     if (frame3)
     {
+        stats::count(stats::counters().decoded[2]);
         if (frame3->fcs() != last_fcs or counter > last_counter + 2)
         {
             last_fcs = frame3->fcs();
@@ -97,36 +101,35 @@ float Afsk1200Demodulator::readTwist()
 
     startADC(1817, ADC_BLOCK_SIZE);
 
+    uint32_t received = 0;
     for (uint32_t i = 0; i != AVG_SAMPLES; ++i)
     {
-        uint32_t count = 0;
-        while (count < ADC_BLOCK_SIZE)
-        {
-            osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-            if (evt.status != osEventMessage)
-                continue;
-
-            auto block = (audio::adc_pool_type::chunk_type*) evt.value.p;
-            uint16_t* data = (uint16_t*) block->buffer;
-            gf1200(data, ADC_BLOCK_SIZE);
-            gf2200(data, ADC_BLOCK_SIZE);
+        auto block = audio::next_block(audio::MEASUREMENT_BLOCK_TIMEOUT, false);
+        if (!block) break;      // The ADC has stopped.
 
-            audio::adcPool.deallocate(block);
+        uint16_t* data = (uint16_t*) block->buffer;
+        gf1200(data, ADC_BLOCK_SIZE);
+        gf2200(data, ADC_BLOCK_SIZE);
 
-            count += ADC_BLOCK_SIZE;
-        }
+        audio::adcPool.deallocate(block);
 
-        g1200 += (gf1200 / count);
-        g2200 += (gf2200 / count);
+        g1200 += (gf1200 / ADC_BLOCK_SIZE);
+        g2200 += (gf2200 / ADC_BLOCK_SIZE);
 
         gf1200.reset();
         gf2200.reset();
+        ++received;
     }
 
     IDemodulator::stopADC();
 
-    g1200 = 10.0f * log10f(g1200 / AVG_SAMPLES);
-    g2200 = 10.0f * log10f(g2200 / AVG_SAMPLES);
+    if (received == 0) {
+        WARN("readTwist: no ADC blocks");
+        return 0.0f;
+    }
+
+    g1200 = 10.0f * log10f(g1200 / received);
+    g2200 = 10.0f * log10f(g2200 / received);
 
     auto result = g1200 - g2200;
 
@@ -79,22 +79,7 @@ struct Afsk1200Demodulator : IDemodulator
         demod_filter.init(bpf_coeffs);
         passall(kiss::settings().options & KISS_OPTION_PASSALL);
 
-        hadc1.Init.OversamplingMode = ENABLE;
-        if (HAL_ADC_Init(&hadc1) != HAL_OK)
-        {
-            CxxErrorHandler();
-        }
-
-        ADC_ChannelConfTypeDef sConfig;
-
-        sConfig.Channel = AUDIO_IN;
-        sConfig.Rank = ADC_REGULAR_RANK_1;
-        sConfig.SingleDiff = ADC_SINGLE_ENDED;
-        sConfig.SamplingTime = ADC_SAMPLETIME_12CYCLES_5;
-        sConfig.OffsetNumber = ADC_OFFSET_NONE;
-        sConfig.Offset = 0;
-        if (HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK)
-            CxxErrorHandler();
+        configureADC(true, ADC_SAMPLETIME_12CYCLES_5);
 
         startADC(1817, ADC_BLOCK_SIZE);
     }
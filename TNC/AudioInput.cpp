@@ -13,6 +13,12 @@
 #include "Goertzel.h"
 #include "DCD.h"
 #include "ModulatorTask.hpp"
+#include "Loopback.hpp"
+#include "Statistics.hpp"
+#include "ClockGovernor.hpp"
+#include "InputMonitor.hpp"
+#include "BatteryMonitor.hpp"
+#include "InputAgc.hpp"
 
 #include "arm_math.h"
 #include "stm32l4xx_hal.h"
@@ -30,23 +36,45 @@ extern "C" void SystemClock_Config(void);
 // DMA Conversion first half complete.
 extern "C" void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef*) {
     using namespace mobilinkd::tnc::audio;
+    using namespace mobilinkd::tnc::stats;
 
     auto block = adcPool.allocate();
-    if (!block) return;
-    memmove(block->buffer, adc_buffer, dma_transfer_size);
-    auto status = osMessagePut(adcInputQueueHandle, (uint32_t) block, 0);
-    if (status != osOK) adcPool.deallocate(block);
+    if (!block) {
+        count(counters().adc_drops);
+        return;
+    }
+    auto& loop = mobilinkd::tnc::loopback::loopback();
+    if (loop.enabled()) {
+        loop.read((uint16_t*) block->buffer, adc_block_size, virtual_ground);
+    } else {
+        memmove(block->buffer, adc_buffer, dma_transfer_size);
+    }
+    if (!adcBlocks.put_from_isr(block)) {
+        count(counters().adc_drops);
+        adcPool.deallocate(block);
+    }
 }
 
 // DMA Conversion second half complete.
 extern "C" void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef*) {
     using namespace mobilinkd::tnc::audio;
+    using namespace mobilinkd::tnc::stats;
 
     auto block = adcPool.allocate();
-    if (!block) return;
-    memmove(block->buffer, adc_buffer + half_buffer_size, dma_transfer_size);
-    auto status = osMessagePut(adcInputQueueHandle, (uint32_t) block, 0);
-    if (status != osOK) adcPool.deallocate(block);
+    if (!block) {
+        count(counters().adc_drops);
+        return;
+    }
+    auto& loop = mobilinkd::tnc::loopback::loopback();
+    if (loop.enabled()) {
+        loop.read((uint16_t*) block->buffer, adc_block_size, virtual_ground);
+    } else {
+        memmove(block->buffer, adc_buffer + half_buffer_size, dma_transfer_size);
+    }
+    if (!adcBlocks.put_from_isr(block)) {
+        count(counters().adc_drops);
+        adcPool.deallocate(block);
+    }
 }
 
 extern "C" void HAL_ADC_ErrorCallback(ADC_HandleTypeDef* /* hadc */) {
@@ -62,6 +90,7 @@ extern "C" void startAudioInputTask(void const*) {
     DEBUG("startAudioInputTask");
 
     adcPool.init();
+    adcBlocks.attach();
 
     uint8_t adcState = mobilinkd::tnc::audio::IDLE;
 
@@ -70,6 +99,19 @@ extern "C" void startAudioInputTask(void const*) {
         if (event.status != osEventMessage) continue;
         adcState = event.value.v;
 
+        // Consume the mode change.  Re-arm it if another state is waiting.
+        mobilinkd::tnc::clear_notification(MODE_CHANGE);
+        if (osMessageWaiting(audioInputQueueHandle)) {
+            xTaskNotify(xTaskGetCurrentTaskHandle(), MODE_CHANGE, eSetBits);
+        }
+
+        // Only the demodulator lowers the clock, and only while it runs.
+        if (adcState == IDLE) {
+            mobilinkd::tnc::clock::governor().idle();
+        } else {
+            mobilinkd::tnc::clock::governor().resume();
+        }
+
         switch (adcState) {
         case STOPPED:
             DEBUG("STOPPED");
@@ -110,12 +152,17 @@ extern "C" void startAudioInputTask(void const*) {
         case CONFIGURE_INPUT_LEVELS:
             DEBUG("CONFIGURE_INPUT_LEVELS");
             setAudioInputLevels();
+            inputLevelsConfigured();
             break;
         case UPDATE_SETTINGS:
             DEBUG("UPDATE_SETTINGS");
             setAudioInputLevels();
             updateModulator();
             break;
+        case SWITCH_MODEM:
+            DEBUG("SWITCH_MODEM");
+            switchModem();
+            break;
         case IDLE:
             DEBUG("IDLE");
             break;
@@ -132,6 +179,75 @@ volatile uint32_t adc_block_size = ADC_BUFFER_SIZE;          // Based on demodul
 volatile uint32_t dma_transfer_size = adc_block_size * 2;    // Transfer size in bytes.
 volatile uint32_t half_buffer_size = adc_block_size / 2;     // Transfer size in words / 2.
 adc_pool_type adcPool;
+adc_queue_type adcBlocks(ADC_BLOCK_READY);
+
+osStatus post(uint32_t state, uint32_t timeout)
+{
+    auto status = osMessagePut(audioInputQueueHandle, state, timeout);
+    if (status != osOK or !audioInputTaskHandle) return status;
+
+    if (__get_IPSR() != 0) {
+        BaseType_t woken = pdFALSE;
+        xTaskNotifyFromISR(audioInputTaskHandle, MODE_CHANGE, eSetBits, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotify(audioInputTaskHandle, MODE_CHANGE, eSetBits);
+    }
+    return status;
+}
+
+namespace {
+
+// Notification bit for the task waiting in configureInputLevels().
+constexpr uint32_t INPUT_LEVELS_CONFIGURED = 1;
+
+std::atomic<osThreadId> input_levels_waiter{0};
+
+} // namespace
+
+bool configureInputLevels(uint32_t timeout)
+{
+    auto self = xTaskGetCurrentTaskHandle();
+    if (self == audioInputTaskHandle) CxxErrorHandler();
+
+    clear_notification(INPUT_LEVELS_CONFIGURED);
+    input_levels_waiter = self;
+    if (post(CONFIGURE_INPUT_LEVELS, timeout) != osOK) {
+        input_levels_waiter = 0;
+        return false;
+    }
+
+    uint32_t events = 0;
+    bool done = xTaskNotifyWait(0, INPUT_LEVELS_CONFIGURED, &events, timeout)
+        == pdTRUE and (events & INPUT_LEVELS_CONFIGURED);
+    input_levels_waiter = 0;
+
+    if (!done) WARN("configureInputLevels timed out");
+    return done;
+}
+
+void inputLevelsConfigured()
+{
+    auto waiter = input_levels_waiter.exchange(0);
+    if (waiter) xTaskNotify(waiter, INPUT_LEVELS_CONFIGURED, eSetBits);
+}
+
+adc_pool_type::chunk_type* next_block(uint32_t timeout, bool interruptible)
+{
+    // Any other task would wait on its own notification, forever.
+    if (!adcBlocks.is_consumer()) CxxErrorHandler();
+
+    adc_pool_type::chunk_type* block;
+    while (!adcBlocks.get(block))
+    {
+        auto events = adcBlocks.wait(timeout);
+        if (events == 0) return nullptr;
+        if (interruptible and (events & MODE_CHANGE)) return nullptr;
+    }
+    stats::high_water(stats::counters().adc_input_hwm,
+        uint32_t(adcBlocks.size() + 1));
+    return block;
+}
 
 void set_adc_block_size(uint32_t block_size)
 {
@@ -160,7 +276,162 @@ IDemodulator* getDemodulator()
     }
 }
 
-void demodulatorTask() {
+namespace {
+
+uint32_t switch_start{0};
+bool switch_pending{false};
+
+/**
+ * Start the input monitor for the demodulator.  The twist tones and the
+ * blocks measured match the demodulator's readTwist().
+ */
+void start_monitor()
+{
+    switch (kiss::settings().modem_type)
+    {
+    case kiss::Hardware::ModemType::FSK9600:
+        monitor().start(120.0f, 4800.0f, Fsk9600Demodulator::SAMPLE_RATE,
+            Fsk9600Demodulator::ADC_BLOCK_SIZE, 8);
+        break;
+    default:
+        monitor().start(1200.0f, 2200.0f, Afsk1200Demodulator::SAMPLE_RATE,
+            Afsk1200Demodulator::ADC_BLOCK_SIZE, 1);
+        break;
+    }
+}
+
+/// Send Vpp, Vavg, Vmin, Vmax as four 16-bit values, left justified.
+void send_levels(uint8_t cmd, const levels_type& levels)
+{
+    uint16_t Vpp, Vavg, Vmin, Vmax;
+    std::tie(Vpp, Vavg, Vmin, Vmax) = levels;
+
+    Vpp <<= 4;
+    Vavg <<= 4;
+    Vmin <<= 4;
+    Vmax <<= 4;
+
+    uint8_t data[9];
+    data[0] = cmd;
+    data[1] = (Vpp >> 8) & 0xFF;   // Vpp
+    data[2] = (Vpp & 0xFF);
+    data[3] = (Vavg >> 8) & 0xFF;  // Vavg (DC level)
+    data[4] = (Vavg & 0xFF);
+    data[5] = (Vmin >> 8) & 0xFF;  // Vmin
+    data[6] = (Vmin & 0xFF);
+    data[7] = (Vmax >> 8) & 0xFF;  // Vmax
+    data[8] = (Vmax & 0xFF);
+
+    ioport->write(data, 9, 6, 10);
+}
+
+void send_twist(int16_t mark, int16_t space)
+{
+    uint8_t buffer[5];
+    buffer[0] = kiss::hardware::POLL_INPUT_TWIST;
+    buffer[1] = (mark >> 8) & 0xFF;
+    buffer[2] = mark & 0xFF;
+    buffer[3] = (space >> 8) & 0xFF;
+    buffer[4] = space & 0xFF;
+
+    ioport->write(buffer, 5, 6, 10);
+}
+
+void send_battery_level(uint16_t vbat)
+{
+    uint8_t data[3];
+    data[0] = kiss::hardware::GET_BATTERY_LEVEL;
+    data[1] = (vbat >> 8) & 0xFF;
+    data[2] = (vbat & 0xFF);
+
+    ioport->write(data, 3, 6, 10);
+}
+
+constexpr q15_t SQUELCH_LEVEL = 256;            // Peak level, in ADC counts.
+constexpr uint32_t SQUELCH_TIMEOUT = 10000;     // ms of silence before sleeping.
+constexpr uint32_t SQUELCH_PROBE_INTERVAL = 20; // ms between probes.
+
+q15_t peak_level(const q15_t* samples, uint32_t len)
+{
+    q15_t max_value, min_value;
+    uint32_t index;
+    arm_max_q15(samples, len, &max_value, &index);
+    arm_min_q15(samples, len, &min_value, &index);
+    return std::max<q15_t>(max_value, -min_value);
+}
+
+void drain_blocks()
+{
+    adc_pool_type::chunk_type* block;
+    while (adcBlocks.get(block)) adcPool.deallocate(block);
+}
+
+/**
+ * The channel has been silent (a closed squelch gives a flat input) for
+ * SQUELCH_TIMEOUT.  Stop the ADC and, every SQUELCH_PROBE_INTERVAL, run
+ * it for a single block to check for audio.  When the level is at or
+ * above SQUELCH_LEVEL, leave the ADC running at full rate and return.
+ *
+ * Audio that starts just after a probe is detected at the end of the next
+ * one, so the worst-case wake latency is the probe interval plus one
+ * block, about 24ms for 1200 baud and 22ms for 9600 baud.  The measured
+ * worst case is reported in the counters (wake_latency_max, us).  That is
+ * well inside any usable TXDELAY, so only part of the preamble is missed.
+ *
+ * @return false on a mode change, with the ADC stopped.
+ */
+bool squelchWait(IDemodulator* demodulator)
+{
+    DEBUG("squelch closed");
+
+    IDemodulator::stopADC();
+    drain_blocks();
+
+    uint32_t last_probe = getRunTimeCounterValue();
+
+    while (true)
+    {
+        if (adcBlocks.wait(SQUELCH_PROBE_INTERVAL) & MODE_CHANGE) return false;
+
+        IDemodulator::restartADC();
+        battery().step();
+        auto block = next_block();
+        if (!block) {
+            IDemodulator::stopADC();
+            return false;
+        }
+
+        arm_offset_q15((int16_t*) block->buffer, 0 - virtual_ground,
+            normalized, demodulator->size());
+        monitor()((uint16_t*) block->buffer, demodulator->size());
+        adcPool.deallocate(block);
+
+        if (peak_level(normalized, demodulator->size()) >= SQUELCH_LEVEL)
+        {
+            uint32_t latency = getRunTimeCounterValue() - last_probe;
+            stats::count(stats::counters().squelch_wakes);
+            stats::high_water(stats::counters().wake_latency_max, latency);
+            DEBUG("squelch open after %luus", latency);
+            return true;
+        }
+
+        IDemodulator::stopADC();
+        drain_blocks();
+
+        last_probe = getRunTimeCounterValue();
+    }
+}
+
+} // namespace
+
+void switchModem()
+{
+    switch_start = getRunTimeCounterValue();
+    switch_pending = true;
+    switchModulator();
+}
+
+void demodulatorTask(bool stream_levels) {
 
     DEBUG("enter demodulatorTask");
 
@@ -168,25 +439,40 @@ void demodulatorTask() {
     auto demodulator = getDemodulator();
 
     demodulator->start();
+    match_virtual_ground(adc_full_scale());
+    start_monitor();
+    agc().reset();
+    uint32_t silent_since = osKernelSysTick();
 
     while (true) {
-        osEvent peek = osMessagePeek(audioInputQueueHandle, 0);
-        if (peek.status == osEventMessage) break;
-
-        osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-        if (evt.status != osEventMessage) {
-            continue;
+        auto block = next_block();
+        if (!block) break;          // Mode change.
+
+        if (switch_pending) {
+            switch_pending = false;
+            uint32_t latency = getRunTimeCounterValue() - switch_start;
+            stats::counters().modem_switch_latency = latency;
+            INFO("Modem switch took %luus", latency);
         }
 
-        auto block = (adc_pool_type::chunk_type*) evt.value.p;
+        uint32_t start = getRunTimeCounterValue();
         auto samples = (int16_t*) block->buffer;
 
         arm_offset_q15(samples, 0 - virtual_ground, normalized, demodulator->size());
+        bool levels_done = monitor()((uint16_t*) samples, demodulator->size());
         adcPool.deallocate(block);
 
         auto frame = (*demodulator)(normalized);
         if (frame)
         {
+            if (loopback::loopback().enabled()) {
+                loopback::loopback().received(frame->fcs(), osKernelSysTick());
+            }
+            stats::count(stats::counters().rx_frames);
+            if (!stats::counters().first_decode) {
+                stats::counters().first_decode = HAL_GetTick();
+                INFO("First frame decoded %lums after boot", HAL_GetTick());
+            }
             frame->source(hdlc::IoFrame::RF_DATA);
             if (osMessagePut(ioEventQueueHandle, (uint32_t) frame, 1) != osOK)
             {
@@ -202,73 +488,39 @@ void demodulatorTask() {
                 dcd_off();
             }
         }
-    }
-
-    demodulator->stop();
-
-    dcd_off();
-    DEBUG("exit demodulatorTask");
-}
-
 
-void streamLevels(uint8_t cmd) {
+        clock::governor().block(getRunTimeCounterValue() - start,
+            demodulator->size(), adcBlocks.size());
 
-    // Stream out Vpp, Vavg, Vmin, Vmax as four 16-bit values, left justified.
-
-    uint8_t data[9];
-    INFO("streamLevels: start");
-
-    auto demodulator = getDemodulator();
-    demodulator->start();
-
-    while (true) {
-        osEvent peek = osMessagePeek(audioInputQueueHandle, 0);
-        if (peek.status == osEventMessage) break;
-
-        uint16_t count = 0;
-        uint32_t accum = 0;
-        uint16_t vmin = std::numeric_limits<uint16_t>::max();
-        uint16_t vmax = std::numeric_limits<uint16_t>::min();
-
-        while (count < demodulator->size() * 30) {
-            osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-            if (evt.status != osEventMessage) continue;
-
-            count += demodulator->size();
-
-            auto block = (adc_pool_type::chunk_type*) evt.value.p;
-            auto start =  (uint16_t*) block->buffer;
-            auto end = start + demodulator->size();
-
-            vmin = std::min(vmin, *std::min_element(start, end));
-            vmax = std::max(vmax, *std::max_element(start, end));
-            accum = std::accumulate(start, end, accum);
+        if (levels_done) {
+            auto levels = monitor().levels();
+            if (stream_levels) send_levels(kiss::hardware::POLL_INPUT_LEVEL, levels);
+            agc()(levels, dcd_status);
+        }
 
-            adcPool.deallocate(block);
+        // Streaming levels needs the ADC running.
+        if (dcd_status or stream_levels or loopback::loopback().enabled()
+            or peak_level(normalized, demodulator->size()) >= SQUELCH_LEVEL)
+        {
+            silent_since = osKernelSysTick();
+        }
+        else if (osKernelSysTick() - silent_since > SQUELCH_TIMEOUT)
+        {
+            if (!squelchWait(demodulator)) break;   // Mode change.
+            silent_since = osKernelSysTick();
         }
 
-        uint16_t pp = (vmax - vmin) << 4;
-        uint16_t avg = (accum / count) << 4;
-        vmin <<= 4;
-        vmax <<= 4;
-
-        data[0] = cmd;
-        data[1] = (pp >> 8) & 0xFF;   // Vpp
-        data[2] = (pp & 0xFF);
-        data[3] = (avg >> 8) & 0xFF;  // Vavg (DC level)
-        data[4] = (avg & 0xFF);
-        data[5] = (vmin >> 8) & 0xFF;  // Vmin
-        data[6] = (vmin & 0xFF);
-        data[7] = (vmax >> 8) & 0xFF;  // Vmax
-        data[8] = (vmax & 0xFF);
-
-        ioport->write(data, 9, 6, 10);
+        battery().step();
     }
 
+    monitor().stop();
     demodulator->stop();
-    DEBUG("exit streamLevels");
+
+    dcd_off();
+    DEBUG("exit demodulatorTask");
 }
 
+
 levels_type readLevels(uint32_t)
 {
 
@@ -277,6 +529,7 @@ levels_type readLevels(uint32_t)
     // Return Vpp, Vavg, Vmin, Vmax as four 16-bit values, right justified.
 
     uint32_t BLOCKS = 30;
+    uint32_t received = 0;
     uint32_t accum = 0;
     uint32_t iaccum = 0;
     uint16_t vmin = std::numeric_limits<uint16_t>::max();
@@ -288,10 +541,9 @@ levels_type readLevels(uint32_t)
 
     for (uint32_t count = 0; count != BLOCKS; ++count)
     {
-        osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-        if (evt.status != osEventMessage) continue;
+        auto block = next_block(MEASUREMENT_BLOCK_TIMEOUT, false);
+        if (!block) break;      // The ADC has stopped.
 
-        auto block = (adc_pool_type::chunk_type*) evt.value.p;
         auto start =  (uint16_t*) block->buffer;
         auto end = start + demodulator->size();
 
@@ -304,17 +556,193 @@ levels_type readLevels(uint32_t)
         adcPool.deallocate(block);
 
         accum = 0;
+        ++received;
     }
 
     demodulator->stop();
 
+    if (received == 0) {
+        WARN("readLevels: no ADC blocks");
+        return levels_type(0, 0, 0, 0);
+    }
+
     uint16_t pp = vmax - vmin;
-    uint16_t avg = iaccum / BLOCKS;
+    uint16_t avg = iaccum / received;
     INFO("exit readLevels");
 
     return levels_type(pp, avg, vmin, vmax);
 }
 
+uint16_t adc_full_scale()
+{
+    auto cfgr2 = hadc1.Instance->CFGR2;
+    if (!(cfgr2 & ADC_CFGR2_ROVSE)) return 4095;
+    uint32_t ratio = 2 << ((cfgr2 & ADC_CFGR2_OVSR) >> ADC_CFGR2_OVSR_Pos);
+    uint32_t shift = (cfgr2 & ADC_CFGR2_OVSS) >> ADC_CFGR2_OVSS_Pos;
+    return ((4096 * ratio) >> shift) - 1;
+}
+
+namespace {
+
+constexpr uint32_t CALIBRATION_SETTLE_TIMEOUT = 200;   // ms.
+constexpr uint32_t CALIBRATION_MIN_BLOCKS = 20;
+constexpr uint32_t CALIBRATION_TIMEOUT = 500;          // ms.
+constexpr int MAX_INPUT_GAIN = 4;
+
+/**
+ * Tracks the DC level (virtual ground) with an exponential average of
+ * the block means.  It has settled when the mean has stayed within
+ * tolerance for SETTLED_BLOCKS blocks.
+ */
+struct DcTracker
+{
+    static constexpr uint32_t SETTLED_BLOCKS = 4;
+
+    float level;
+    float tolerance;
+    uint32_t stable{0};
+
+    DcTracker(uint16_t full_scale)
+    : level(full_scale / 2), tolerance(full_scale / 512.0f)
+    {}
+
+    bool operator()(const uint16_t* samples, uint32_t len)
+    {
+        float mean = float(std::accumulate(samples, samples + len, 0ul)) / len;
+        float diff = mean - level;
+        level += diff / 4;
+        stable = std::abs(diff) < tolerance ? stable + 1 : 0;
+        return stable >= SETTLED_BLOCKS;
+    }
+};
+
+/**
+ * Counts, for each PGA step, the samples that would clip at that gain.
+ */
+struct GainHistogram
+{
+    std::array<uint32_t, MAX_INPUT_GAIN + 1> clipped{};
+    uint32_t total{0};
+
+    void operator()(const uint16_t* samples, uint32_t len, uint16_t vgnd,
+        uint16_t full_scale)
+    {
+        int32_t headroom = std::min<int32_t>(vgnd, full_scale - vgnd);
+        for (uint32_t i = 0; i != len; ++i)
+        {
+            int32_t deviation = std::abs(int32_t(samples[i]) - vgnd);
+            for (int gain = 0; gain <= MAX_INPUT_GAIN; ++gain) {
+                if ((deviation << gain) >= headroom) ++clipped[gain];
+            }
+        }
+        total += len;
+    }
+
+    /// The highest gain that clips no more than 0.1% of samples.
+    int gain() const
+    {
+        int result = 0;
+        for (int gain = 0; gain <= MAX_INPUT_GAIN; ++gain) {
+            if (clipped[gain] * 1000 <= total) result = gain;
+        }
+        return result;
+    }
+};
+
+/**
+ * Feed blocks to the tracker until the DC level settles or the timeout
+ * expires, then set the virtual ground.
+ *
+ * @return false on a mode change.
+ */
+bool settle_dc(IDemodulator* demodulator, DcTracker& dc)
+{
+    uint32_t start = osKernelSysTick();
+    bool settled = false;
+    while (!settled and osKernelSysTick() - start < CALIBRATION_SETTLE_TIMEOUT)
+    {
+        auto block = next_block();
+        if (!block) return false;
+        settled = dc((uint16_t*) block->buffer, demodulator->size());
+        adcPool.deallocate(block);
+    }
+
+    if (!settled) WARN("DC level not settled");
+
+    set_virtual_ground(dc.level + 0.5f);
+    return true;
+}
+
+} // namespace
+
+InputCalibration calibrateInput()
+{
+    DEBUG("enter calibrateInput");
+
+    uint32_t start_time = osKernelSysTick();
+    // Keep the current settings if interrupted.
+    InputCalibration result{kiss::settings().input_gain,
+        float(kiss::settings().rx_twist)};
+    bool ok = false;
+
+    auto demodulator = getDemodulator();
+
+    set_input_gain(0);
+    demodulator->start();
+
+    auto full_scale = adc_full_scale();
+    DcTracker dc(full_scale);
+
+    if (settle_dc(demodulator, dc))
+    {
+        // One capture gives both the gain and the twist.
+        GainHistogram histogram;
+        start_monitor();
+
+        uint32_t start = osKernelSysTick();
+        uint32_t count = 0;
+        ok = true;
+        while (count < CALIBRATION_MIN_BLOCKS or !monitor().twist_ready())
+        {
+            if (osKernelSysTick() - start > CALIBRATION_TIMEOUT) break;
+            auto block = next_block();
+            if (!block) {
+                ok = false;     // Mode change.
+                break;
+            }
+            auto samples = (uint16_t*) block->buffer;
+            histogram(samples, demodulator->size(), virtual_ground, full_scale);
+            monitor()(samples, demodulator->size());
+            adcPool.deallocate(block);
+            ++count;
+        }
+
+        if (ok)
+        {
+            result.gain = histogram.gain();
+            if (monitor().twist_ready()) {
+                auto twist = monitor().twist();
+                result.twist = (twist.mark - twist.space) / 256.0f;
+            }
+
+            INFO("calibrateInput: %lu blocks, gain = %d, twist = %d / 100",
+                count, result.gain, int(result.twist * 100));
+
+            // The DC level shifts with the gain.
+            set_input_gain(result.gain);
+            DcTracker dc2(full_scale);
+            ok = settle_dc(demodulator, dc2);
+        }
+    }
+
+    if (!ok) set_input_gain(result.gain);
+
+    monitor().stop();
+    demodulator->stop();
+
+    DEBUG("exit calibrateInput (%lums)", osKernelSysTick() - start_time);
+    return result;
+}
 
 /**
  * This provides 100Hz resolution to the Goerztel filter.
@@ -366,17 +794,20 @@ void pollInputTwist()
 
     IDemodulator::startADC(3029, TWIST_SAMPLE_SIZE);
 
-    for (uint32_t i = 0; i != AVG_SAMPLES; ++i) {
+    bool ok = true;
+    for (uint32_t i = 0; ok and i != AVG_SAMPLES; ++i) {
 
       uint32_t count = 0;
       while (count < TWIST_SAMPLE_SIZE) {
 
-          osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-          if (evt.status != osEventMessage) continue;
+          auto block = next_block(MEASUREMENT_BLOCK_TIMEOUT, false);
+          if (!block) {
+              ok = false;     // The ADC has stopped.
+              break;
+          }
 
           count += ADC_BUFFER_SIZE;
 
-          auto block = (adc_pool_type::chunk_type*) evt.value.p;
           uint16_t* data =  (uint16_t*) block->buffer;
           gf1200(data, ADC_BUFFER_SIZE);
           gf2200(data, ADC_BUFFER_SIZE);
@@ -393,66 +824,64 @@ void pollInputTwist()
 
     IDemodulator::stopADC();
 
+    if (!ok) {
+        WARN("pollInputTwist: no ADC blocks");
+        return;
+    }
+
     DEBUG("pollInputTwist: MARK=%d, SPACE=%d (x100)",
       int(g1200 * 100.0 / AVG_SAMPLES), int(g2200 * 100.0 / AVG_SAMPLES));
 
-    int16_t g1200i = int16_t(g1200 * 256 / AVG_SAMPLES);
-    int16_t g2200i = int16_t(g2200 * 256 / AVG_SAMPLES);
-
-    uint8_t buffer[5];
-    buffer[0] = kiss::hardware::POLL_INPUT_TWIST;
-    buffer[1] = (g1200i >> 8) & 0xFF;
-    buffer[2] = g1200i & 0xFF;
-    buffer[3] = (g2200i >> 8) & 0xFF;
-    buffer[4] = g2200i & 0xFF;
-
-    ioport->write(buffer, 5, 6, 10);
+    send_twist(int16_t(g1200 * 256 / AVG_SAMPLES),
+        int16_t(g2200 * 256 / AVG_SAMPLES));
 
     DEBUG("exit pollInputTwist");
 }
 
 void streamAmplifiedInputLevels() {
     DEBUG("enter streamAmplifiedInputLevels");
-    streamLevels(kiss::hardware::POLL_INPUT_LEVEL);
+    demodulatorTask(true);
     DEBUG("exit streamAmplifiedInputLevels");
 }
 
 void pollAmplifiedInputLevel() {
     DEBUG("enter pollAmplifiedInputLevel");
+    send_levels(kiss::hardware::POLL_INPUT_LEVEL, readLevels(AUDIO_IN));
+    DEBUG("exit pollAmplifiedInputLevel");
+}
 
-    uint16_t Vpp, Vavg, Vmin, Vmax;
-    std::tie(Vpp, Vavg, Vmin, Vmax) = readLevels(AUDIO_IN);
+bool sendInputLevels()
+{
+    if (!monitor().levels_ready()) return false;
+    send_levels(kiss::hardware::POLL_INPUT_LEVEL, monitor().levels());
+    return true;
+}
 
-    Vpp <<= 4;
-    Vavg <<= 4;
-    Vmin <<= 4;
-    Vmax <<= 4;
+bool sendInputTwist()
+{
+    if (!monitor().twist_ready()) return false;
+    auto twist = monitor().twist();
+    send_twist(twist.mark, twist.space);
+    return true;
+}
 
-    uint8_t data[9];
-    data[0] = kiss::hardware::POLL_INPUT_LEVEL;
-    data[1] = (Vpp >> 8) & 0xFF;   // Vpp
-    data[2] = (Vpp & 0xFF);
-    data[3] = (Vavg >> 8) & 0xFF;  // Vavg (DC level)
-    data[4] = (Vavg & 0xFF);
-    data[5] = (Vmin >> 8) & 0xFF;  // Vmin
-    data[6] = (Vmin & 0xFF);
-    data[7] = (Vmax >> 8) & 0xFF;  // Vmax
-    data[8] = (Vmax & 0xFF);
+bool sendBatteryLevel()
+{
+    if (!battery().level()) return false;
+    send_battery_level(battery().level());
+    return true;
+}
 
-    ioport->write(data, 9, 6, 10);
-    DEBUG("exit pollAmplifiedInputLevel");
+uint16_t battery_level()
+{
+    return battery().level();
 }
 
 void pollBatteryLevel()
 {
     auto vbat = getDemodulator()->readBatteryLevel();
-
-    uint8_t data[3];
-    data[0] = kiss::hardware::GET_BATTERY_LEVEL;
-    data[1] = (vbat >> 8) & 0xFF;
-    data[2] = (vbat & 0xFF);
-
-    ioport->write(data, 3, 6, 10);
+    battery().update(vbat);
+    send_battery_level(vbat);
 }
 
 #if 0
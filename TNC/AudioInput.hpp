@@ -5,6 +5,8 @@
 #define MOBILINKD__TNC__AUDIO__INPUT_HPP_
 
 #include "memory.hpp"
+#include "HdlcFrame.hpp"
+#include "NotifyQueue.hpp"
 
 #include "main.h"
 #include "stm32l4xx_hal.h"
@@ -19,7 +21,7 @@ extern "C" {
 
 extern osMessageQId hdlcInputQueueHandle;
 extern osMessageQId audioInputQueueHandle;
-extern osMessageQId adcInputQueueHandle;
+extern osThreadId audioInputTaskHandle;
 extern TIM_HandleTypeDef htim6;
 extern ADC_HandleTypeDef hadc1;
 
@@ -82,7 +84,8 @@ enum AdcState {
     IDLE,                           // No DMA; sleep for 10ms
     POLL_TWIST_LEVEL,
     STREAM_AVERAGE_TWIST_LEVEL,
-    STREAM_INSTANT_TWIST_LEVEL
+    STREAM_INSTANT_TWIST_LEVEL,
+    SWITCH_MODEM                    // Change modem, keeping the input levels
 };
 
 const size_t ADC_BUFFER_SIZE = 384;
@@ -91,10 +94,69 @@ extern volatile uint32_t adc_block_size;
 extern volatile uint32_t dma_transfer_size;
 extern volatile uint32_t half_buffer_size;
 
-// 1kB
-typedef memory::Pool<8, ADC_BUFFER_SIZE * 2> adc_pool_type;
+typedef memory::chunk<ADC_BUFFER_SIZE * 2> adc_block_type;
+
+#ifdef KISS_NO_HEAP
+// The part of configTOTAL_HEAP_SIZE not used by the extra HDLC frames.
+constexpr uint16_t EXTRA_ADC_BLOCKS = (configTOTAL_HEAP_SIZE
+    - hdlc::EXTRA_IO_FRAMES * sizeof(hdlc::IoFrame)
+    - hdlc::EXTRA_FRAME_SEGMENTS * sizeof(hdlc::FrameSegmentPool::chunk_type))
+    / sizeof(adc_block_type);
+#else
+constexpr uint16_t EXTRA_ADC_BLOCKS = 0;
+#endif
+
+// 768 bytes per block.
+typedef memory::Pool<8 + EXTRA_ADC_BLOCKS, ADC_BUFFER_SIZE * 2> adc_pool_type;
 extern adc_pool_type adcPool;
 
+// Notification bits for the audio input task.
+constexpr uint32_t ADC_BLOCK_READY = 1;
+constexpr uint32_t MODE_CHANGE = 2;
+
+// ADC blocks passed from the DMA callbacks to the audio input task.
+typedef NotifyQueue<adc_pool_type::chunk_type*, 8> adc_queue_type;
+extern adc_queue_type adcBlocks;
+
+/**
+ * Change the audio input task state.  This posts the new state to the
+ * audioInputQueue and sets the MODE_CHANGE notification bit so that the
+ * current state's loop exits.  This must be used rather than posting to
+ * the queue directly.
+ */
+osStatus post(uint32_t state, uint32_t timeout);
+
+/**
+ * Measure the input levels and set the virtual ground.  The ADC blocks
+ * go to the audio input task, so this posts CONFIGURE_INPUT_LEVELS and
+ * waits for that task to finish.  It must not be called by the audio
+ * input task, which calls setAudioInputLevels() directly.
+ *
+ * @return false if the measurement did not finish within timeout ms.
+ */
+bool configureInputLevels(uint32_t timeout = 10000);
+
+/// Called by the audio input task when CONFIGURE_INPUT_LEVELS is done.
+void inputLevelsConfigured();
+
+/// The longest wait for a block in a fixed-length measurement, in ms.
+constexpr uint32_t MEASUREMENT_BLOCK_TIMEOUT = 100;
+
+/**
+ * Return the next ADC block, waiting for one if necessary.  The caller
+ * must return the block to the adcPool.  Only the audio input task may
+ * call this; it is the only task the ADC interrupt wakes.
+ *
+ * Fixed-length measurements, which average a set number of blocks, pass
+ * interruptible = false and a timeout.  A mode change then does not cut
+ * them short; it is handled by the task loop once they finish.
+ *
+ * @return the block, or nullptr on timeout or, if interruptible, when a
+ *  mode change is pending.
+ */
+adc_pool_type::chunk_type* next_block(uint32_t timeout = osWaitForever,
+    bool interruptible = true);
+
 void set_adc_block_size(uint32_t block_size);
 
 #if 0
@@ -136,11 +198,68 @@ typedef std::tuple<uint16_t, uint16_t, uint16_t, uint16_t> levels_type;
 levels_type readLevels(uint32_t channel);
 float readTwist();
 
-void demodulatorTask();
+/// Largest ADC sample value, allowing for the demodulator's oversampling.
+uint16_t adc_full_scale();
+
+struct InputCalibration
+{
+    int gain;           ///< PGA step, 0-4.
+    float twist;        ///< Mark - space, dB.
+};
+
+/**
+ * Measure the input for auto input level adjustment in one capture,
+ * while the demodulator's ADC is running.  The DC level is tracked until
+ * it settles, at gain 0 and again at the new gain.  The PGA step is taken
+ * from a histogram of the captured samples (the highest gain at which no
+ * more than 0.1% of samples clip) and the twist from the same samples.
+ *
+ * The new gain is left set and the virtual ground updated.  This takes a
+ * few hundred ms.  On a mode change, the current settings are returned.
+ */
+InputCalibration calibrateInput();
+
+/**
+ * Switch to the modulator for the current modem type, keeping the input
+ * gain, virtual ground and twist, and time the switch.  The demodulator
+ * is started by the DEMODULATOR state that follows.  The time from here
+ * to its first block is the switch latency, reported in the counters
+ * (modem_switch_latency, us).
+ */
+void switchModem();
+
+/**
+ * Run the demodulator until the state changes.  Input levels and twist
+ * are measured on the way (see InputMonitor).  If stream_levels is set,
+ * the levels are sent to the host as POLL_INPUT_LEVEL after each window
+ * and the ADC is not stopped on a silent channel.
+ */
+void demodulatorTask(bool stream_levels = false);
 void streamRawInputLevels();
 void streamAmplifiedInputLevels();
 void pollAmplifiedInputLevel();
 void pollBatteryLevel();
+
+/**
+ * Answer POLL_INPUT_LEVEL, POLL_INPUT_TWIST or GET_BATTERY_LEVEL from the
+ * measurements taken while the demodulator runs.  These may be called
+ * from any task.
+ *
+ * @return false, having sent nothing, if there is no measurement yet, or
+ *  for levels and twist, if the demodulator is not running.  The caller
+ *  must then use the corresponding audio input state, which stops the
+ *  demodulator.
+ */
+bool sendInputLevels();
+bool sendInputTwist();
+bool sendBatteryLevel();
+
+/**
+ * Return the filtered battery voltage in mV, or 0 if it has not been
+ * read.  It is measured while the ADC runs (see BatteryMonitor).
+ */
+uint16_t battery_level();
+
 void streamOutputLevels();
 void stop();
 void pollInputTwist();
@@ -16,6 +16,7 @@
 #include <algorithm>
 #include <tuple>
 #include <array>
+#include <cmath>
 #include <cstdlib>
 #include <cstdint>
 
@@ -24,16 +25,98 @@
 
 extern OPAMP_HandleTypeDef hopamp1;
 extern DAC_HandleTypeDef hdac1;
+extern RTC_HandleTypeDef hrtc;
 
 namespace mobilinkd { namespace tnc { namespace audio {
 
 uint16_t virtual_ground{0};
 float i_vgnd{0.0f};
 
-void set_input_gain(int level)
+namespace {
+
+struct GainStep
+{
+    uint32_t mode;
+    uint32_t pga_gain;
+    uint32_t dc_offset;     // DAC2.  It is different for each gain setting.
+};
+
+constexpr std::array<GainStep, 5> gain_steps = {{
+    {OPAMP_FOLLOWER_MODE, OPAMP_PGA_GAIN_2, 2048},  // 0dB
+    {OPAMP_PGA_MODE, OPAMP_PGA_GAIN_2, 1024},       // 6dB
+    {OPAMP_PGA_MODE, OPAMP_PGA_GAIN_4, 512},        // 12dB
+    {OPAMP_PGA_MODE, OPAMP_PGA_GAIN_8, 256},        // 18dB
+    {OPAMP_PGA_MODE, OPAMP_PGA_GAIN_16, 128}        // 24dB
+}};
+
+int input_gain_level{0};
+
+// The virtual ground last measured at each gain, or 0 if not measured.
+std::array<uint16_t, gain_steps.size()> gain_virtual_ground{};
+
+// The ADC full scale the virtual grounds were measured at.
+uint16_t vgnd_full_scale{0};
+
+/*
+ * The virtual grounds are cached in RTC backup registers, which survive
+ * resets and brown-outs, so that they need not be measured again at boot.
+ * RTC_BKP_DR1 is used by the BM78 initialization.  The last register is
+ * a check word; the backup registers are zero after a complete power loss.
+ */
+constexpr uint32_t CALIBRATION_TAG = 0xCA110000;
+constexpr std::array<uint32_t, 4> calibration_registers = {{
+    RTC_BKP_DR2, RTC_BKP_DR3, RTC_BKP_DR4, RTC_BKP_DR5
+}};
+constexpr uint32_t calibration_check_register = RTC_BKP_DR6;
+
+using calibration_type = std::array<uint32_t, calibration_registers.size()>;
+
+uint32_t calibration_check(const calibration_type& words)
+{
+    uint32_t sum = 0;
+    for (auto word : words) sum = ((sum << 5) | (sum >> 27)) + word;
+    return ~sum;
+}
+
+void save_calibration()
 {
-    uint32_t dc_offset{};
+    calibration_type words = {{
+        CALIBRATION_TAG | vgnd_full_scale,
+        gain_virtual_ground[0] | uint32_t(gain_virtual_ground[1]) << 16,
+        gain_virtual_ground[2] | uint32_t(gain_virtual_ground[3]) << 16,
+        gain_virtual_ground[4]
+    }};
+
+    HAL_PWR_EnableBkUpAccess();
+    for (size_t i = 0; i != words.size(); ++i) {
+        HAL_RTCEx_BKUPWrite(&hrtc, calibration_registers[i], words[i]);
+    }
+    HAL_RTCEx_BKUPWrite(&hrtc, calibration_check_register,
+        calibration_check(words));
+}
+
+bool load_calibration()
+{
+    calibration_type words;
+    for (size_t i = 0; i != words.size(); ++i) {
+        words[i] = HAL_RTCEx_BKUPRead(&hrtc, calibration_registers[i]);
+    }
 
+    if ((words[0] & 0xFFFF0000) != CALIBRATION_TAG) return false;
+    if (HAL_RTCEx_BKUPRead(&hrtc, calibration_check_register)
+        != calibration_check(words)) return false;
+
+    vgnd_full_scale = words[0] & 0xFFFF;
+    for (size_t i = 0; i != gain_virtual_ground.size(); ++i) {
+        gain_virtual_ground[i] = words[1 + i / 2] >> (16 * (i % 2));
+    }
+    return true;
+}
+
+}
+
+void set_input_gain(int level)
+{
     // Stop and de-init the op amp before changing its state.
     if (HAL_OPAMP_Stop(&hopamp1) != HAL_OK)
         CxxErrorHandler();
@@ -44,37 +127,11 @@ void set_input_gain(int level)
     level = std::min(4, level);
 
     // Adjust configuration and, if PGA, gain.
-    switch (level) {
-    case 0: // 0dB
-        hopamp1.Init.Mode = OPAMP_FOLLOWER_MODE;
-        dc_offset = 2048;
-        break;
-    case 1: // 6dB
-        hopamp1.Init.Mode = OPAMP_PGA_MODE;
-        hopamp1.Init.PgaGain = OPAMP_PGA_GAIN_2;
-        dc_offset = 1024;
-        break;
-    case 2: // 12dB
-        hopamp1.Init.Mode = OPAMP_PGA_MODE;
-        hopamp1.Init.PgaGain = OPAMP_PGA_GAIN_4;
-        dc_offset = 512;
-        break;
-    case 3: // 18dB
-        hopamp1.Init.Mode = OPAMP_PGA_MODE;
-        hopamp1.Init.PgaGain = OPAMP_PGA_GAIN_8;
-        dc_offset = 256;
-        break;
-    case 4: // 24dB
-        hopamp1.Init.Mode = OPAMP_PGA_MODE;
-        hopamp1.Init.PgaGain = OPAMP_PGA_GAIN_16;
-        dc_offset = 128;
-        break;
-    default:
-        CxxErrorHandler();
-    }
+    auto& step = gain_steps[level];
+    hopamp1.Init.Mode = step.mode;
+    hopamp1.Init.PgaGain = step.pga_gain;
 
-    // Adjust DC offset.  It is different for each gain setting.
-    if (HAL_DAC_SetValue(&hdac1, DAC_CHANNEL_2, DAC_ALIGN_12B_R, dc_offset) != HAL_OK)
+    if (HAL_DAC_SetValue(&hdac1, DAC_CHANNEL_2, DAC_ALIGN_12B_R, step.dc_offset) != HAL_OK)
         CxxErrorHandler();
 
     // Init and start the op amp after the change.
@@ -82,61 +139,79 @@ void set_input_gain(int level)
         CxxErrorHandler();
     if (HAL_OPAMP_Start(&hopamp1)!= HAL_OK)
         CxxErrorHandler();
-}
 
-int adjust_input_gain() __attribute__((noinline));
+    input_gain_level = level;
+}
 
-int adjust_input_gain() {
+void step_input_gain(int level)
+{
+    level = std::max(0, level);
+    level = std::min(4, level);
 
-    INFO("\nAdjusting input gain...\n");
+    // The mode and gain can be changed while the op amp is running.
+    auto& step = gain_steps[level];
+    MODIFY_REG(hopamp1.Instance->CSR, OPAMP_CSR_OPAMODE | OPAMP_CSR_PGGAIN,
+        step.mode | step.pga_gain);
+    hopamp1.Init.Mode = step.mode;
+    hopamp1.Init.PgaGain = step.pga_gain;
 
-    int gain{0};
-    uint16_t vpp, vavg, vmin, vmax;
+    if (HAL_DAC_SetValue(&hdac1, DAC_CHANNEL_2, DAC_ALIGN_12B_R, step.dc_offset) != HAL_OK)
+        CxxErrorHandler();
 
-    set_input_gain(gain);
-    osDelay(100);   // Need time for DC offset to settle.
+    input_gain_level = level;
 
-    std::tie(vpp, vavg, vmin, vmax) = readLevels(AUDIO_IN);
-    INFO("\nVpp = %" PRIu16 ", Vavg = %" PRIu16 "\n", vpp, vavg);
-    INFO("\nVmin = %" PRIu16 ", Vmax = %" PRIu16 ", setting = %d\n", vmin, vmax, gain);
+    // The DC offsets are chosen to keep the virtual ground the same.  Use
+    // the measured value for this gain if there is one.
+    if (gain_virtual_ground[level]) {
+        virtual_ground = gain_virtual_ground[level];
+        i_vgnd = 1.0 / virtual_ground;
+    }
+}
 
-    while (gain == 0 and (vmax == vref or vmin == 0))
-    {
-        std::tie(vpp, vavg, vmin, vmax) = readLevels(AUDIO_IN);
+int input_gain()
+{
+    return input_gain_level;
+}
 
-        INFO("\nVpp = %" PRIu16 ", Vavg = %" PRIu16 "\n", vpp, vavg);
-        INFO("\nVmin = %" PRIu16 ", Vmax = %" PRIu16 ", setting = %d\n", vmin, vmax, gain);
-    }
+void set_virtual_ground(uint16_t level)
+{
+    // Keep the values for the other gains at the same full scale.
+    auto full_scale = adc_full_scale();
+    match_virtual_ground(full_scale);
 
-    auto desired_gain = vref / vpp;
+    virtual_ground = level;
+    i_vgnd = 1.0 / virtual_ground;
+    gain_virtual_ground[input_gain_level] = level;
+    vgnd_full_scale = full_scale;
 
-    if (desired_gain >= 16) gain = 4;
-    else if (desired_gain >= 8) gain = 3;
-    else if (desired_gain >= 4) gain = 2;
-    else if (desired_gain >= 2) gain = 1;
-    else gain = 0;
+    save_calibration();
+}
 
-    set_input_gain(gain);
-    osDelay(100);   // Need time for DC offset to settle.
+void match_virtual_ground(uint16_t full_scale)
+{
+    if (vgnd_full_scale == 0 or vgnd_full_scale == full_scale) return;
 
-    std::tie(vpp, vavg, vmin, vmax) = readLevels(AUDIO_IN);
-    INFO("\nVpp = %" PRIu16 ", Vavg = %" PRIu16 "\n", vpp, vavg);
-    INFO("\nVmin = %" PRIu16 ", Vmax = %" PRIu16 ", setting = %d\n", vmin, vmax, gain);
+    auto rescale = [=](uint16_t level) -> uint16_t {
+        return (uint32_t(level) * (full_scale + 1u)) / (vgnd_full_scale + 1u);
+    };
 
-    virtual_ground = vavg;
-    i_vgnd = 1.0 / virtual_ground;
+    for (auto& level : gain_virtual_ground) level = rescale(level);
+    if (virtual_ground) {
+        virtual_ground = rescale(virtual_ground);
+        i_vgnd = 1.0 / virtual_ground;
+    }
 
-    return gain;
+    vgnd_full_scale = full_scale;
 }
 
-
 void autoAudioInputLevel()
 {
     INFO("autoInputLevel");
 
-    mobilinkd::tnc::kiss::settings().input_gain = adjust_input_gain();
+    auto calibration = calibrateInput();
+    mobilinkd::tnc::kiss::settings().input_gain = calibration.gain;
 
-    int rx_twist = readTwist() + 0.5f;
+    int rx_twist = std::lround(calibration.twist);
     if (rx_twist < -3) rx_twist = -3;
     else if (rx_twist > 9) rx_twist = 9;
     INFO("TWIST = %ddB", rx_twist);
@@ -161,22 +236,46 @@ void setAudioInputLevels()
     std::tie(vpp, vavg, vmin, vmax) = readLevels(AUDIO_IN);
     INFO("Vpp = %" PRIu16 ", Vavg = %" PRIu16, vpp, vavg);
     INFO("Vmin = %" PRIu16 ", Vmax = %" PRIu16, vmin, vmax);
-    virtual_ground = vavg;
+
+    // Keep the current (or cached) value rather than saving a bad one.
+    if (vavg == 0) return;
+    set_virtual_ground(vavg);
+}
+
+bool restoreAudioInputLevels()
+{
+    auto gain = kiss::settings().input_gain;
+    if (gain > 4) return false;
+    if (!load_calibration() or !gain_virtual_ground[gain]) return false;
+
+    INFO("Setting input gain: %d (cached Vgnd = %" PRIu16 ")", gain,
+        gain_virtual_ground[gain]);
+    set_input_gain(gain);
+    virtual_ground = gain_virtual_ground[gain];
     i_vgnd = 1.0 / virtual_ground;
+    return true;
 }
 
-std::array<int16_t, 128> log_volume;
+namespace {
 
-void init_log_volume()
+// Output levels, 256 * 1.02207^n.  This is computed at compile time so
+// that it is ready at boot.
+constexpr std::array<int16_t, 128> make_log_volume()
 {
+    std::array<int16_t, 128> result{};
     int16_t level = 256;
     float gain = 1.0f;
     float factor = 1.02207f;
 
-    for (auto& i : log_volume) {
-        i = int16_t(roundf(level * gain));
+    for (auto& i : result) {
+        i = int16_t(level * gain + 0.5f);
         gain *= factor;
     }
+    return result;
+}
+
+constexpr std::array<int16_t, 128> log_volume = make_log_volume();
+
 }
 
 std::tuple<int16_t, int16_t> computeLogAudioLevel(int16_t level)
@@ -22,9 +22,38 @@ constexpr const uint32_t AUDIO_IN = ADC_CHANNEL_8;
 
 namespace mobilinkd { namespace tnc { namespace audio {
 
-void init_log_volume();
+void set_input_gain(int level);
+
+/**
+ * Change the PGA gain (0-4) in place, without the op amp de-init/init
+ * cycle of set_input_gain(), and compensate the virtual ground.
+ */
+void step_input_gain(int level);
+
+/// The PGA gain (0-4) in use.
+int input_gain();
+
+/// Set the virtual ground measured at the current gain.
+void set_virtual_ground(uint16_t level);
+
+/**
+ * Rescale the measured virtual grounds when the ADC full scale changes
+ * (the demodulators differ in oversampling), so that a modem switch does
+ * not need the input levels measured again.
+ */
+void match_virtual_ground(uint16_t full_scale);
 void autoAudioInputLevel();
+
+/// Measure the input and set the virtual ground.  Audio input task only;
+/// other tasks use configureInputLevels().
 void setAudioInputLevels();
+
+/**
+ * Set the input gain from the settings and the virtual ground from the
+ * values cached in the RTC backup registers, without measuring the
+ * input.  Returns false if there is no cached value for the gain.
+ */
+bool restoreAudioInputLevels();
 void setAudioOutputLevel();
 
 extern bool streamInputDCOffset;
@@ -0,0 +1,72 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "Ax25View.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace mobilinkd { namespace tnc { namespace ax25 {
+
+Ax25View::Ax25View(hdlc::IoFrame* frame, uint16_t trailer)
+: frame_(frame)
+{
+    if (frame->size() < 2 * ADDRESS_LEN + 2 + trailer) return;
+
+    data_ = frame->data();
+    size_ = frame->size() - trailer;
+
+    uint8_t count = 0;
+    bool last = false;
+    while (!last) {
+        if (count == MAX_ADDRESSES) return;
+        if ((count + 1) * ADDRESS_LEN + 2 > size_) return;
+        last = address(count++)[6] & EXTENSION_BIT;
+    }
+    if (count < 2) return;
+
+    addresses_ = count;
+}
+
+hdlc::IoFrame::iterator Ax25View::info() const
+{
+    auto it = frame_->begin();
+    std::advance(it, header_size());
+    return it;
+}
+
+void Ax25View::set_ssid(uint8_t index, uint8_t ssid)
+{
+    auto a = address(index);
+    a[6] = (a[6] & ~SSID_MASK) | ((ssid << 1) & SSID_MASK);
+}
+
+void Ax25View::replace(uint8_t index, const Callsign& call, uint8_t ssid, bool repeated)
+{
+    auto a = address(index);
+    std::copy(call.begin(), call.end(), a);
+    a[6] = RESERVED_BITS | ((ssid << 1) & SSID_MASK) | (a[6] & EXTENSION_BIT)
+        | (repeated ? H_BIT : 0);
+}
+
+bool Ax25View::insert(uint8_t index)
+{
+    if (addresses_ == MAX_ADDRESSES) return false;
+    if (!frame_->insert(index * ADDRESS_LEN, ADDRESS_LEN)) return false;
+
+    ++addresses_;
+    size_ += ADDRESS_LEN;
+    address(index)[6] &= ~EXTENSION_BIT;
+    return true;
+}
+
+void Ax25View::wide_hop(uint8_t index, const Callsign* call, uint8_t ssid)
+{
+    if (call and insert(index)) replace(index++, *call, ssid, true);
+
+    uint8_t n = this->ssid(index) - 1;
+    set_ssid(index, n);
+    if (n == 0) set_repeated(index);
+}
+
+}}} // mobilinkd::tnc::ax25
@@ -0,0 +1,102 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "HdlcFrame.hpp"
+
+#include <array>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace ax25 {
+
+constexpr uint8_t ADDRESS_LEN = 7;
+constexpr uint8_t MAX_ADDRESSES = 10;       ///< dest, source, 8 vias.
+
+constexpr uint8_t SSID_MASK = 0x1E;
+constexpr uint8_t H_BIT = 0x80;             ///< Has been repeated.
+constexpr uint8_t EXTENSION_BIT = 0x01;     ///< Last address.
+constexpr uint8_t RESERVED_BITS = 0x60;
+
+constexpr uint8_t UI = 0x03;
+constexpr uint8_t POLL_FINAL = 0x10;
+
+/// An encoded (shifted) callsign, padded with shifted spaces.
+using Callsign = std::array<uint8_t, 6>;
+
+/**
+ * The AX.25 header of a frame, read and rewritten in place.
+ *
+ * The address field is at most 70 bytes, so the whole header is in the
+ * first segment of the frame.  The view parses it once, on construction,
+ * and then reads and writes it through a pointer into that segment.  All
+ * accessors are constant time; nothing is copied.  The information field
+ * is reached through info().
+ *
+ * Only insert() changes the size of the frame.  Segments are fixed size,
+ * so it moves the rest of the frame up by ADDRESS_LEN bytes, allocating a
+ * new segment only when the last one is full.
+ *
+ * The view is invalid if the frame is not a well-formed AX.25 frame with
+ * a control and PID byte, such as a frame with a truncated address field.
+ */
+class Ax25View
+{
+public:
+    /**
+     * @param frame the frame.
+     * @param trailer the number of bytes at the end of the frame which
+     *  are not part of the AX.25 data, 2 for received frames with an FCS.
+     */
+    Ax25View(hdlc::IoFrame* frame, uint16_t trailer = 0);
+
+    bool valid() const { return addresses_ != 0; }
+
+    uint8_t addresses() const { return addresses_; }
+    uint8_t* address(uint8_t index) const { return data_ + index * ADDRESS_LEN; }
+    uint8_t* destination() const { return address(0); }
+    uint8_t* source() const { return address(1); }
+
+    uint8_t ssid(uint8_t index) const {
+        return (address(index)[6] & SSID_MASK) >> 1;
+    }
+    bool repeated(uint8_t index) const { return address(index)[6] & H_BIT; }
+
+    uint8_t control() const { return data_[addresses_ * ADDRESS_LEN]; }
+    uint8_t pid() const { return data_[addresses_ * ADDRESS_LEN + 1]; }
+
+    uint16_t header_size() const { return addresses_ * ADDRESS_LEN + 2; }
+    uint16_t info_size() const { return size_ - header_size(); }
+    hdlc::IoFrame::iterator info() const;
+
+    /// Mark the address as repeated.
+    void set_repeated(uint8_t index) { address(index)[6] |= H_BIT; }
+    void set_ssid(uint8_t index, uint8_t ssid);
+
+    /// Overwrite the callsign and SSID, keeping the extension bit.
+    void replace(uint8_t index, const Callsign& call, uint8_t ssid, bool repeated);
+
+    /**
+     * Insert an address ahead of index.  The new address is a copy of
+     * the one at index, without the extension bit.
+     *
+     * @return false if the address field is full or the frame could not
+     *  be extended.  The frame is unchanged.
+     */
+    bool insert(uint8_t index);
+
+    /**
+     * Count a WIDEn-N hop at index: N is decremented, and the address is
+     * marked as repeated when N reaches 0.  If call is given, it is first
+     * inserted ahead of the address, marked as repeated, if there is room.
+     */
+    void wide_hop(uint8_t index, const Callsign* call, uint8_t ssid);
+
+private:
+    hdlc::IoFrame* frame_;
+    uint8_t* data_{nullptr};
+    uint16_t size_{0};
+    uint8_t addresses_{0};
+};
+
+}}} // mobilinkd::tnc::ax25
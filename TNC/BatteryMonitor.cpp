@@ -0,0 +1,164 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "BatteryMonitor.hpp"
+#include "AudioLevel.hpp"
+#include "ClockGovernor.hpp"
+#include "GPIO.hpp"
+#include "Log.h"
+
+#include "stm32l4xx_hal.h"
+#include "cmsis_os.h"
+
+extern ADC_HandleTypeDef hadc1;
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+BatteryMonitor& battery()
+{
+    static BatteryMonitor instance;
+    return instance;
+}
+
+void BatteryMonitor::configure()
+{
+    auto adc = hadc1.Instance;
+
+    LL_ADC_INJ_SetQueueMode(adc, LL_ADC_INJ_QUEUE_DISABLE);
+    LL_ADC_INJ_SetTriggerSource(adc, LL_ADC_INJ_TRIG_SOFTWARE);
+    LL_ADC_INJ_SetSequencerLength(adc, LL_ADC_INJ_SEQ_SCAN_DISABLE);
+
+    auto common = __LL_ADC_COMMON_INSTANCE(adc);
+    LL_ADC_SetCommonPathInternalCh(common,
+        LL_ADC_GetCommonPathInternalCh(common) | LL_ADC_PATH_INTERNAL_VREFINT);
+}
+
+/**
+ * Return the longest sampling time at which one injected conversion and
+ * one (oversampled) regular conversion fit in an ADC trigger period at
+ * the current clock, or NO_SAMPLING_TIME.  A trigger that arrives while
+ * either is still converting is lost, and with it a demodulator sample.
+ * TIM6 and the ADC are both clocked from SYSCLK, so this only changes
+ * when the modem does.
+ */
+uint32_t BatteryMonitor::sampling_time()
+{
+    // Half ADC clock cycles for each LL_ADC_SAMPLINGTIME_* value.
+    static constexpr uint16_t SAMPLING[] = {5, 13, 25, 49, 95, 185, 495, 1281};
+    static constexpr uint32_t CONVERSION = 25;     // 12 bits.
+
+    auto adc = hadc1.Instance;
+
+    uint32_t period = 2 * (TIM6->ARR + 1) * (TIM6->PSC + 1);
+    uint32_t ratio = 1;
+    if (READ_BIT(adc->CFGR2, ADC_CFGR2_ROVSE)) {
+        ratio = 2 << (READ_BIT(adc->CFGR2, ADC_CFGR2_OVSR) >> ADC_CFGR2_OVSR_Pos);
+    }
+    uint32_t regular = ratio *
+        (SAMPLING[LL_ADC_GetChannelSamplingTime(adc, AUDIO_IN)] + CONVERSION);
+
+    if (regular + SAMPLING[0] + CONVERSION > period) return NO_SAMPLING_TIME;
+
+    uint32_t available = period - regular - CONVERSION;
+    uint32_t result = LL_ADC_SAMPLINGTIME_640CYCLES_5;
+    while (SAMPLING[result] > available) --result;
+    return result;
+}
+
+void BatteryMonitor::start_conversion(uint32_t channel)
+{
+    auto adc = hadc1.Instance;
+
+    LL_ADC_ClearFlag_JEOS(adc);
+    LL_ADC_INJ_SetSequencerRanks(adc, LL_ADC_INJ_RANK_1, channel);
+    LL_ADC_INJ_StartConversion(adc);
+}
+
+void BatteryMonitor::restore()
+{
+    gpio::BAT_DIVIDER::on();
+    if (!usb_ce_) gpio::USB_CE::off();
+    clock::governor().hold(false);
+}
+
+void BatteryMonitor::step()
+{
+    auto adc = hadc1.Instance;
+    uint32_t now = osKernelSysTick();
+
+    switch (state_)
+    {
+    case State::IDLE:
+        if (level_ != 0 and now - time_ < INTERVAL) return;
+        // The sampling time is chosen for the nominal clock speed.
+        clock::governor().hold(true);
+        // Disable battery charging while measuring battery voltage.
+        usb_ce_ = gpio::USB_CE::get();
+        gpio::USB_CE::on();
+        gpio::BAT_DIVIDER::off();
+        time_ = now;
+        state_ = State::SETTLE;
+        break;
+    case State::SETTLE: {
+        if (now - time_ < SETTLE) return;
+        auto sampling = sampling_time();
+        if (sampling == NO_SAMPLING_TIME) {
+            WARN("No time for battery conversions");
+            restore();
+            time_ = now;
+            state_ = State::IDLE;
+            break;
+        }
+        LL_ADC_SetChannelSamplingTime(adc, LL_ADC_CHANNEL_VREFINT, sampling);
+        LL_ADC_SetChannelSamplingTime(adc, LL_ADC_CHANNEL_15, sampling);
+        start_conversion(LL_ADC_CHANNEL_VREFINT);
+        state_ = State::VREFINT;
+        break;
+    }
+    case State::VREFINT:
+        if (!LL_ADC_IsActiveFlag_JEOS(adc)) return;
+        vdda_ = __LL_ADC_CALC_VREFANALOG_VOLTAGE(
+            LL_ADC_INJ_ReadConversionData12(adc, LL_ADC_INJ_RANK_1),
+            LL_ADC_RESOLUTION_12B);
+        vbat_ = 0;
+        count_ = 0;
+        start_conversion(LL_ADC_CHANNEL_15);
+        state_ = State::VBAT;
+        break;
+    case State::VBAT:
+        if (!LL_ADC_IsActiveFlag_JEOS(adc)) return;
+        vbat_ += LL_ADC_INJ_ReadConversionData12(adc, LL_ADC_INJ_RANK_1);
+        if (++count_ != SAMPLES) {
+            start_conversion(LL_ADC_CHANNEL_15);
+            return;
+        }
+        restore();
+        // The divider halves the battery voltage.
+        update(__LL_ADC_CALC_DATA_TO_VOLTAGE(vdda_, vbat_ / SAMPLES,
+            LL_ADC_RESOLUTION_12B) * 2);
+        DEBUG("Vdda = %lumV, Vbat = %umV", vdda_, unsigned(level_));
+        time_ = now;
+        state_ = State::IDLE;
+        break;
+    }
+}
+
+void BatteryMonitor::abort()
+{
+    if (state_ == State::IDLE) return;
+
+    // The ADC cannot be disabled during a conversion.  It takes a few us.
+    while (LL_ADC_INJ_IsConversionOngoing(hadc1.Instance)) {}
+    LL_ADC_ClearFlag_JEOS(hadc1.Instance);
+
+    restore();
+    state_ = State::IDLE;
+}
+
+void BatteryMonitor::update(uint16_t mv)
+{
+    uint16_t level = level_;
+    level_ = level ? (3 * level + mv + 2) / 4 : mv;
+}
+
+}}} // mobilinkd::tnc::audio
@@ -0,0 +1,76 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+/**
+ * Measures the battery voltage with ADC injected conversions while the
+ * regular group keeps sampling audio by DMA, so reading the battery
+ * costs no demodulator downtime.
+ *
+ * Each measurement converts VREFINT, to find VDDA, then SAMPLES
+ * conversions of the battery divider (ADC1_IN15).  The divider is
+ * enabled and charging suspended only for the few ms the measurement
+ * takes.  The steps are driven from the audio input task, one per ADC
+ * block, by step().  Injected conversions pre-empt the regular group,
+ * whose oversampling continues where it left off.  The clock is held at
+ * the nominal speed during a measurement and the sampling time is the
+ * longest that still lets both finish within one ADC trigger period.
+ *
+ * The result is low-pass filtered and always available from level().
+ */
+class BatteryMonitor
+{
+public:
+    static constexpr uint32_t INTERVAL = 10000;     // ms between measurements.
+    static constexpr uint32_t SETTLE = 2;           // ms for the divider.
+    static constexpr uint32_t SAMPLES = 8;
+
+    /**
+     * Set the sampling times and the injected trigger.  This must be called
+     * while no conversion is running.
+     */
+    void configure();
+
+    /// Advance the measurement.  The regular conversions must be running.
+    void step();
+
+    /**
+     * Stop any measurement in progress and restore the divider and
+     * charger.  This must be called before the ADC is stopped.
+     */
+    void abort();
+
+    /// Record a measurement taken with the regular group.
+    void update(uint16_t mv);
+
+    /// Battery voltage in mV, or 0 before the first measurement.
+    uint16_t level() const { return level_; }
+
+private:
+
+    enum class State { IDLE, SETTLE, VREFINT, VBAT };
+
+    static constexpr uint32_t NO_SAMPLING_TIME = 0xFFFFFFFF;
+
+    static uint32_t sampling_time();
+    void start_conversion(uint32_t channel);
+    void restore();
+
+    State state_{State::IDLE};
+    uint32_t time_{0};
+    uint32_t vdda_{0};
+    uint32_t vbat_{0};
+    uint32_t count_{0};
+    bool usb_ce_{false};
+    std::atomic<uint16_t> level_{0};
+};
+
+BatteryMonitor& battery();
+
+}}} // mobilinkd::tnc::audio
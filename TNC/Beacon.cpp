@@ -0,0 +1,263 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "Beacon.hpp"
+#include "Ax25View.hpp"
+#include "Log.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+extern osMessageQId hdlcOutputQueueHandle;
+
+extern "C" void beacon(void const* argument)
+{
+    // Runs in the timer task.  FreeRTOS passes the timer handle.
+    mobilinkd::tnc::beacons().fire((osTimerId) argument);
+}
+
+namespace mobilinkd { namespace tnc {
+
+namespace {
+
+constexpr uint8_t NO_LAYER_3 = 0xF0;    // PID
+constexpr size_t MAX_VIAS = ax25::MAX_ADDRESSES - 2;
+
+osTimerId timer(size_t index)
+{
+    const std::array<osTimerId*, kiss::NUMBER_OF_BEACONS> timers = {
+        &beaconTimer1Handle, &beaconTimer2Handle,
+        &beaconTimer3Handle, &beaconTimer4Handle
+    };
+    return *timers[index];
+}
+
+/**
+ * Encode the "CALL-SSID" at text, which ends at a NUL, a comma or last.
+ *
+ * @return the end of the callsign, or nullptr if it is not valid.
+ */
+const uint8_t* encode_address(const uint8_t* text, const uint8_t* last, uint8_t* address)
+{
+    std::fill_n(address, 6, ' ' << 1);
+
+    size_t len = 0;
+    for (; text != last and *text and *text != ',' and *text != '-'; ++text) {
+        if (len == 6 or !isalnum(*text)) return nullptr;
+        address[len++] = toupper(*text) << 1;
+    }
+    if (len == 0) return nullptr;
+
+    int ssid = 0;
+    if (text != last and *text == '-') {
+        for (++text; text != last and isdigit(*text); ++text) {
+            ssid = ssid * 10 + *text - '0';
+            if (ssid > 15) return nullptr;
+        }
+    }
+    if (text != last and *text and *text != ',') return nullptr;
+
+    address[6] = ax25::RESERVED_BITS | (ssid << 1);
+    return text;
+}
+
+} // namespace
+
+Beacons& beacons()
+{
+    static Beacons instance;
+    return instance;
+}
+
+Beacons::Beacons()
+: random_(HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2() ^ HAL_GetTick())
+{
+    if (random_ == 0) random_ = 1;
+}
+
+/// A random number from 0 to limit (xorshift32).
+uint32_t Beacons::jitter(uint32_t limit)
+{
+    uint32_t x = random_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_ = x;
+    return x % (limit + 1);
+}
+
+/// Build the stuffed bitstream for the beacon, or return nullptr.
+hdlc::IoFrame* Beacons::build(const kiss::Hardware& hw, const kiss::Beacon& beacon)
+{
+    auto frame = hdlc::ioFramePool().acquire();
+    if (!frame) return nullptr;
+
+    std::array<uint8_t, ax25::MAX_ADDRESSES * ax25::ADDRESS_LEN> header;
+    size_t addresses = 2;
+
+    bool ok = encode_address(beacon.dest, beacon.dest + kiss::CALLSIGN_LEN,
+        header.data()) != nullptr;
+    ok = ok and encode_address(hw.mycall, hw.mycall + kiss::CALLSIGN_LEN,
+        header.data() + ax25::ADDRESS_LEN) != nullptr;
+
+    auto path = beacon.path;
+    auto path_end = beacon.path + kiss::BEACON_PATH_LEN;
+    while (ok and path != path_end and *path) {
+        if (addresses == 2 + MAX_VIAS) ok = false;
+        else path = encode_address(path, path_end,
+            header.data() + addresses++ * ax25::ADDRESS_LEN);
+        ok = ok and path != nullptr;
+        if (ok and path != path_end and *path == ',') ++path;
+    }
+    header[addresses * ax25::ADDRESS_LEN - 1] |= ax25::EXTENSION_BIT;
+
+    for (size_t i = 0; ok and i != addresses * ax25::ADDRESS_LEN; ++i) {
+        ok = frame->push_back(header[i]);
+    }
+    ok = ok and frame->push_back(ax25::UI) and frame->push_back(NO_LAYER_3);
+    for (size_t i = 0; ok and i != kiss::BEACON_TEXT_LEN and beacon.text[i]; ++i) {
+        ok = frame->push_back(beacon.text[i]);
+    }
+
+    auto result = ok ? hdlc::ioFramePool().acquire() : nullptr;
+    if (!result) {
+        hdlc::release(frame);
+        return nullptr;
+    }
+
+    frame->add_fcs();
+
+    // The header is filled in once the bits are counted.
+    for (size_t i = 0; ok and i != HEADER_SIZE; ++i) ok = result->push_back(0);
+
+    uint16_t bits = 0;
+    uint8_t byte = 0;
+    int ones = 0;
+    auto put = [&](uint8_t bit) {
+        byte |= bit << (bits & 7);
+        if ((++bits & 7) == 0) {
+            ok = ok and result->push_back(byte);
+            byte = 0;
+        }
+    };
+
+    for (auto c : *frame) {
+        for (size_t i = 0; i != 8; ++i) {
+            uint8_t bit = c & 1;
+            put(bit);
+            if (!bit) {
+                ones = 0;
+            } else if (++ones == 5) {
+                put(0);
+                ones = 0;
+            }
+            c >>= 1;
+        }
+    }
+    if (bits & 7) ok = ok and result->push_back(byte);
+
+    uint16_t fcs = frame->fcs();
+    hdlc::release(frame);
+
+    if (!ok) {
+        hdlc::release(result);
+        return nullptr;
+    }
+
+    auto data = result->data();
+    data[0] = bits & 0xFF;
+    data[1] = bits >> 8;
+    data[2] = fcs & 0xFF;
+    data[3] = fcs >> 8;
+
+    result->source(hdlc::IoFrame::BEACON_DATA);
+    return result;
+}
+
+void Beacons::configure(const kiss::Hardware& hw)
+{
+    bool have_call = hw.mycall[0] != 0
+        and strncmp((const char*) hw.mycall, "NOCALL", kiss::CALLSIGN_LEN) != 0;
+
+    enabled_ = false;
+
+    for (size_t i = 0; i != slots_.size(); ++i) {
+        auto& beacon = hw.beacons[i];
+        osTimerStop(timer(i));
+
+        hdlc::IoFrame* frame = nullptr;
+        if (beacon.seconds != 0 and beacon.dest[0] != 0 and have_call) {
+            frame = build(hw, beacon);
+            if (!frame) WARN("Beacon %u not built", unsigned(i));
+        }
+
+        auto& slot = slots_[i];
+        taskENTER_CRITICAL();
+        auto old = slot.frame;
+        bool queued = slot.queued;
+        slot.frame = frame;
+        slot.queued = false;
+        slot.interval = std::max<uint32_t>(beacon.seconds, MIN_INTERVAL) * 1000;
+        taskEXIT_CRITICAL();
+
+        // A queued frame is released by sent().
+        if (old and !queued) hdlc::release(old);
+
+        if (frame) {
+            enabled_ = true;
+            uint32_t limit = std::min(slot.interval / 8, MAX_JITTER);
+            osTimerStart(timer(i), FIRST_DELAY + jitter(limit));
+        }
+    }
+
+    INFO("Beacons %s", enabled_ ? "enabled" : "disabled");
+}
+
+void Beacons::fire(osTimerId id)
+{
+    size_t index = 0;
+    while (index != slots_.size() and timer(index) != id) ++index;
+    if (index == slots_.size()) return;
+
+    auto& slot = slots_[index];
+    taskENTER_CRITICAL();
+    bool active = slot.frame != nullptr;
+    auto frame = slot.queued ? nullptr : slot.frame;
+    if (frame) slot.queued = true;
+    uint32_t interval = slot.interval;
+    taskEXIT_CRITICAL();
+
+    if (!active) return;
+
+    // Restarting the timer gives each interval its own jitter.
+    uint32_t limit = std::min(interval / 8, MAX_JITTER);
+    osTimerStart(id, interval - limit + jitter(2 * limit));
+
+    if (!frame) return;     // The last one has not been sent yet.
+
+    if (osMessagePut(hdlcOutputQueueHandle, reinterpret_cast<uint32_t>(frame),
+        0) != osOK)
+    {
+        sent(frame);
+    }
+}
+
+void Beacons::sent(hdlc::IoFrame* frame)
+{
+    bool current = false;
+
+    taskENTER_CRITICAL();
+    for (auto& slot : slots_) {
+        if (slot.frame != frame) continue;
+        slot.queued = false;
+        current = true;
+    }
+    taskEXIT_CRITICAL();
+
+    if (!current) hdlc::release(frame);
+}
+
+}} // mobilinkd::tnc
@@ -0,0 +1,92 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "KissHardware.hpp"
+#include "HdlcFrame.hpp"
+
+#include "cmsis_os.h"
+
+#include <array>
+#include <cstdint>
+
+extern "C" void beacon(void const* argument);
+
+extern osTimerId beaconTimer1Handle;
+extern osTimerId beaconTimer2Handle;
+extern osTimerId beaconTimer3Handle;
+extern osTimerId beaconTimer4Handle;
+
+namespace mobilinkd { namespace tnc {
+
+/**
+ * Beacons from kiss::Hardware::beacons, sent by beaconTimer1..4.
+ *
+ * Each beacon is built once, when the settings change, into a frame
+ * holding the bit-stuffed HDLC bitstream: a HEADER_SIZE byte header with
+ * the bit count and the FCS (both little-endian), then the bits, LSB
+ * first.  When a timer fires, that frame is put on the TX queue as is.
+ * The encoder sends the bits without stuffing them again and hands the
+ * frame back with sent() rather than releasing it.
+ *
+ * A beacon is enabled when its interval is non-zero and it has a
+ * destination.  MYCALL must be set.  The interval is at least
+ * MIN_INTERVAL.  Each interval is changed by a random amount, up to 1/8
+ * of it or MAX_JITTER, so that stations which started together do not
+ * stay in step.  The first beacon is sent FIRST_DELAY ms (plus jitter)
+ * after the settings change.
+ */
+class Beacons
+{
+public:
+    static constexpr uint16_t HEADER_SIZE = 4;
+    static constexpr uint32_t MIN_INTERVAL = 60;    // seconds.
+    static constexpr uint32_t MAX_JITTER = 30000;   // ms.
+    static constexpr uint32_t FIRST_DELAY = 10000;  // ms.
+
+    Beacons();
+
+    /// Rebuild the beacons and restart their timers.
+    void configure(const kiss::Hardware& hw);
+
+    bool enabled() const { return enabled_; }
+
+    /// Queue the beacon for the timer.  Called in the timer task.
+    void fire(osTimerId timer);
+
+    /**
+     * Called by the encoder when a beacon frame has been sent or dropped.
+     * Frames left over from an earlier configuration are released.
+     */
+    void sent(hdlc::IoFrame* frame);
+
+    static uint16_t bits(hdlc::IoFrame* frame) {
+        auto data = frame->data();
+        return data[0] | (data[1] << 8);
+    }
+
+    static uint16_t fcs(hdlc::IoFrame* frame) {
+        auto data = frame->data();
+        return data[2] | (data[3] << 8);
+    }
+
+private:
+    struct Slot
+    {
+        hdlc::IoFrame* frame{nullptr};
+        uint32_t interval{0};           ///< ms.
+        bool queued{false};             ///< On the TX queue.
+    };
+
+    hdlc::IoFrame* build(const kiss::Hardware& hw, const kiss::Beacon& beacon);
+    uint32_t jitter(uint32_t interval);
+
+    std::array<Slot, kiss::NUMBER_OF_BEACONS> slots_;
+    uint32_t random_;
+    bool enabled_{false};
+};
+
+Beacons& beacons();
+
+}} // mobilinkd::tnc
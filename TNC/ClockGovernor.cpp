@@ -0,0 +1,248 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "ClockGovernor.hpp"
+#include "GPIO.hpp"
+#include "Log.h"
+#include "NullPort.hpp"
+#include "PortInterface.hpp"
+#include "PowerMode.h"
+#include "main.h"
+
+#include "stm32l4xx_hal.h"
+#include "cmsis_os.h"
+
+// The modems ask for their clock speed through these.
+extern "C" void SysClock48()
+{
+    mobilinkd::tnc::clock::governor().set_nominal(
+        mobilinkd::tnc::clock::Speed::MHZ48);
+}
+
+extern "C" void SysClock80()
+{
+    mobilinkd::tnc::clock::governor().set_nominal(
+        mobilinkd::tnc::clock::Speed::MHZ80);
+}
+
+extern "C" void SysClock4()
+{
+    mobilinkd::tnc::clock::governor().idle();
+}
+
+namespace mobilinkd { namespace tnc { namespace clock {
+
+namespace {
+
+void capture(Governor::Scaled& scaled, uint32_t hz)
+{
+    // Someone else (the modem) has written the register since the last
+    // clock change.  Their value, at this clock, is the new reference.
+    uint32_t ticks = *scaled.reg + 1;
+    if (ticks != scaled.written) {
+        scaled.ticks = ticks;
+        scaled.hz = hz;
+        scaled.written = ticks;
+    }
+}
+
+void rescale(Governor::Scaled& scaled, uint32_t hz)
+{
+    uint32_t ticks = scaled_ticks(scaled.ticks, scaled.hz, hz);
+
+    if (scaled.cr1) *scaled.cr1 |= TIM_CR1_ARPE;
+    *scaled.reg = ticks - 1;
+    scaled.written = ticks;
+}
+
+void start_pll(Speed speed)
+{
+    RCC_OscInitTypeDef RCC_OscInitStruct;
+
+    RCC_OscInitStruct.OscillatorType = 0;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_MSI;
+    RCC_OscInitStruct.PLL.PLLM = 1;
+    RCC_OscInitStruct.PLL.PLLN = speed == Speed::MHZ80 ? 40 : 24;
+    RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV7;
+    RCC_OscInitStruct.PLL.PLLQ = RCC_PLLQ_DIV2;
+    RCC_OscInitStruct.PLL.PLLR = RCC_PLLR_DIV2;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+    {
+        CxxErrorHandler();
+    }
+}
+
+void stop_pll()
+{
+    if (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY)) return;
+
+    RCC_OscInitTypeDef RCC_OscInitStruct;
+
+    RCC_OscInitStruct.OscillatorType = 0;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_OFF;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+    {
+        CxxErrorHandler();
+    }
+}
+
+} // namespace
+
+Governor& governor()
+{
+    static Governor instance;
+    return instance;
+}
+
+void Governor::init()
+{
+    uint32_t hz = HAL_RCC_GetHCLKFreq();
+
+    scaled_[0] = Scaled{&TIM6->ARR, &TIM6->CR1, 0, 0, 0};   // ADC sample rate.
+    scaled_[1] = Scaled{&TIM7->ARR, &TIM7->CR1, 0, 0, 0};   // DAC sample rate.
+    scaled_[2] = Scaled{&TIM1->PSC, nullptr, 0, 0, 0};      // LED PWM.
+    for (auto& scaled : scaled_) capture(scaled, hz);
+
+    switch (hz) {
+    case 4000000: current_ = Speed::MHZ4; break;
+    case 16000000: current_ = Speed::MHZ16; break;
+    case 80000000: current_ = Speed::MHZ80; break;
+    default: current_ = Speed::MHZ48; break;
+    }
+
+    policy_.reset(current_, current_);
+    initialized_ = true;
+}
+
+void Governor::set_nominal(Speed nominal)
+{
+    if (!initialized_) init();
+    policy_.reset(nominal, nominal);
+    apply(nominal);
+    power_mode = PowerMode::RUN;
+}
+
+void Governor::resume()
+{
+    if (!initialized_) init();
+    policy_.reset(policy_.nominal_, policy_.nominal_);
+    apply(policy_.nominal_);
+    power_mode = PowerMode::RUN;
+}
+
+void Governor::hold(bool on)
+{
+    held_ = on;
+    if (on) resume();
+}
+
+void Governor::idle()
+{
+    if (!initialized_) init();
+
+    // The audio input is also idle while transmitting half-duplex and
+    // while sending test tones.  Only slow down when nothing is connected.
+    if (ioport != getNullPort() or (TIM7->CR1 & TIM_CR1_CEN)) {
+        resume();
+        return;
+    }
+
+    // USB needs HCLK above 14.2MHz.  Otherwise, allow STOP2 when idle.
+    if (gpio::USB_POWER::get()) {
+        apply(Speed::MHZ16);
+        power_mode = PowerMode::RUN;
+    } else {
+        apply(Speed::MHZ4);
+        power_mode = PowerMode::LPRUN;
+    }
+}
+
+void Governor::block(uint32_t busy_us, uint32_t samples, size_t backlog)
+{
+    uint32_t mhz = frequency(current_) / 1000000;
+    uint32_t period_us = samples * (TIM6->ARR + 1) / mhz;
+
+    // The DAC deadlines are not measured; run at full speed to transmit.
+    bool hold = held_ or (TIM7->CR1 & TIM_CR1_CEN);
+
+    auto target = policy_.block(busy_us, period_us, backlog, hold);
+    if (target != current_) apply(target);
+}
+
+void Governor::apply(Speed target)
+{
+    if (target == current_) return;
+
+    DEBUG("SysClock %luMHz", frequency(target) / 1000000);
+
+    vTaskSuspendAll();
+
+    if (target >= Speed::MHZ48)
+    {
+        // The PLL cannot be reconfigured while it is the system clock.
+        if (current_ >= Speed::MHZ48) switch_to(Speed::MHZ16);
+        start_pll(target);
+        switch_to(target);
+    }
+    else
+    {
+        switch_to(target);
+        stop_pll();
+    }
+
+    xTaskResumeAll();
+}
+
+/**
+ * Switch SYSCLK to HSI16, MSI (4MHz) or the running PLL and re-derive the
+ * timers in the same critical section.  The DMA and UART interrupts are
+ * masked; only the HAL time base (TIM2) can run.
+ */
+void Governor::switch_to(Speed target)
+{
+    RCC_ClkInitTypeDef RCC_ClkInitStruct;
+    uint32_t latency;
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK;
+    switch (target) {
+    case Speed::MHZ4:
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_MSI;
+        latency = FLASH_LATENCY_0;
+        break;
+    case Speed::MHZ16:
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+        latency = FLASH_LATENCY_0;
+        break;
+    case Speed::MHZ48:
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+        latency = FLASH_LATENCY_2;
+        break;
+    default:
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+        latency = FLASH_LATENCY_4;
+        break;
+    }
+
+    uint32_t hz = HAL_RCC_GetHCLKFreq();
+    for (auto& scaled : scaled_) capture(scaled, hz);
+
+    taskENTER_CRITICAL();
+
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, latency) != HAL_OK)
+    {
+        CxxErrorHandler();
+    }
+
+    hz = HAL_RCC_GetHCLKFreq();
+    for (auto& scaled : scaled_) rescale(scaled, hz);
+
+    // vPortSuppressTicksAndSleep() reloads SysTick from SystemCoreClock.
+    HAL_SYSTICK_Config(hz / 1000);
+
+    taskEXIT_CRITICAL();
+
+    current_ = target;
+}
+
+}}} // mobilinkd::tnc::clock
@@ -0,0 +1,172 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace clock {
+
+enum class Speed : uint8_t { MHZ4, MHZ16, MHZ48, MHZ80 };
+
+constexpr uint32_t frequency(Speed speed)
+{
+    switch (speed) {
+    case Speed::MHZ4: return 4000000;
+    case Speed::MHZ16: return 16000000;
+    case Speed::MHZ48: return 48000000;
+    default: return 80000000;
+    }
+}
+
+constexpr Speed slower(Speed speed)
+{
+    return speed == Speed::MHZ4 ? speed : Speed(uint8_t(speed) - 1);
+}
+
+/**
+ * Return the timer count that gives the same period at to_hz as ticks
+ * does at from_hz, rounded to nearest and limited to the 16-bit range.
+ */
+constexpr uint32_t scaled_ticks(uint32_t ticks, uint32_t from_hz, uint32_t to_hz)
+{
+    uint64_t result = (uint64_t(ticks) * to_hz + from_hz / 2) / from_hz;
+    return uint32_t(std::clamp<uint64_t>(result, 1, 0x10000));
+}
+
+/**
+ * The clock governor policy.  The modem sets the nominal (maximum) speed
+ * it needs.  After each ADC block the demodulator reports how long it was
+ * busy.  The clock is raised to the nominal speed at once when any block
+ * uses more than UP of its period, when blocks are queued behind it, or
+ * when a hold is requested (while transmitting or measuring the battery).
+ * It is lowered one step at a time when the busiest block of a WINDOW,
+ * scaled to the slower clock, would use less than DOWN of its period.
+ * Scaling by frequency is conservative as there are fewer flash wait
+ * states at lower speeds.
+ *
+ * The floor is 16MHz while the ADC is running.  The ADC kernel clock is
+ * SYSCLK and 16x oversampling at 26.4ksps needs more than 10.5MHz.
+ *
+ * This has no HAL dependencies so that it can be built on a host and
+ * driven from a model of the demodulator load.
+ */
+struct Policy
+{
+    static constexpr uint32_t UP = 700;         // Per mille of the block period.
+    static constexpr uint32_t DOWN = 600;       // Per mille of the block period.
+    static constexpr uint32_t WINDOW = 64;      // Blocks.
+
+    Speed nominal_{Speed::MHZ48};
+    Speed floor_{Speed::MHZ16};
+    Speed current_{Speed::MHZ48};
+    uint32_t peak_{0};
+    uint32_t count_{0};
+
+    void reset(Speed nominal, Speed current)
+    {
+        nominal_ = nominal;
+        floor_ = std::min(Speed::MHZ16, nominal);
+        current_ = current;
+        peak_ = 0;
+        count_ = 0;
+    }
+
+    /**
+     * Account for one block and return the speed the clock should run at.
+     *
+     * @param busy_us is the time spent processing the block.
+     * @param period_us is the time between blocks.
+     * @param backlog is the number of blocks waiting to be processed.
+     * @param hold is true when the clock must run at the nominal speed.
+     */
+    Speed block(uint32_t busy_us, uint32_t period_us, size_t backlog, bool hold)
+    {
+        uint32_t load = period_us ? uint64_t(busy_us) * 1000 / period_us : 1000;
+
+        if (hold or backlog or load > UP)
+        {
+            peak_ = 0;
+            count_ = 0;
+            current_ = nominal_;
+            return current_;
+        }
+
+        peak_ = std::max(peak_, load);
+        if (++count_ < WINDOW) return current_;
+
+        if (current_ > floor_)
+        {
+            auto lower = slower(current_);
+            uint64_t scaled = uint64_t(peak_) * frequency(current_) / frequency(lower);
+            if (scaled < DOWN) current_ = lower;
+        }
+
+        peak_ = 0;
+        count_ = 0;
+        return current_;
+    }
+};
+
+/**
+ * Changes the system clock and keeps the peripherals that are clocked from
+ * it running at the same rate.  The TIM6 (ADC) and TIM7 (DAC) reload values
+ * and the TIM1 (LED PWM) prescaler are re-derived from the value last set
+ * by the modem, not from the previous scaled value, so no error builds up.
+ * They are written with preload enabled in the same critical section as
+ * the clock switch, so each takes effect at the next timer update.  No
+ * ADC sample is lost; at most one sample period is stretched or shortened.
+ *
+ * USART3 and I2C1 are clocked from HSI16 and USB/RNG from PLLSAI1, so
+ * they are not affected by the system clock.  The HAL time base (TIM2)
+ * is re-initialized by the HAL and the RTOS tick is reloaded.
+ */
+struct Governor
+{
+    struct Scaled
+    {
+        volatile uint32_t* reg;     // ARR or PSC; the count is reg + 1.
+        volatile uint32_t* cr1;     // Set ARPE before writing ARR.
+        uint32_t ticks;             // Reference count...
+        uint32_t hz;                // ...at this clock frequency.
+        uint32_t written;           // Last count written by the governor.
+    };
+
+    Policy policy_;
+    Speed current_{Speed::MHZ48};
+    Scaled scaled_[3];
+    bool initialized_{false};
+    bool held_{false};
+
+    Speed speed() const { return current_; }
+
+    /// Set the speed the modem needs and switch to it now.
+    void set_nominal(Speed nominal);
+
+    /// Return to the nominal speed.
+    void resume();
+
+    /// Run at the nominal speed until released, regardless of load.
+    void hold(bool on);
+
+    /**
+     * The audio input is idle.  If nothing is connected, run as slowly as
+     * possible and allow the idle task to enter STOP2 (PowerMode::LPRUN).
+     */
+    void idle();
+
+    /// Account for one demodulator block of the given number of samples.
+    void block(uint32_t busy_us, uint32_t samples, size_t backlog);
+
+private:
+
+    void init();
+    void apply(Speed target);
+    void switch_to(Speed target);
+};
+
+Governor& governor();
+
+}}} // mobilinkd::tnc::clock
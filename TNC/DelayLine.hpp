@@ -1,7 +1,6 @@
 #ifndef MOBILINKD_DELAY_LINE_H_
 #define MOBILINKD_DELAY_LINE_H_
 
-#include <vector>
 #include <cstdlib>
 #include <cstdint>
 #include <cassert>
@@ -9,25 +8,6 @@
 
 namespace mobilinkd { namespace libafsk {
 
-struct DelayLine {
-	
-	size_t length_;
-	std::vector<uint8_t> buffer_;
-	size_t pos_;
-
-	DelayLine(double sample_rate, double delay)
-	: length_((delay / (1.0 / sample_rate)) + .5), buffer_(length_), pos_(0)
-	{}
-	
-	bool operator()(bool value) {
-		bool r = buffer_[pos_];
-		buffer_[pos_++] = value;
-		if (pos_ == length_) pos_ = 0;
-		return r;
-	}
-};
-
-
 template <size_t N>
 struct FixedDelayLine {
 	
@@ -2,9 +2,23 @@
 // All rights reserved.
 
 #include "Demodulator.hpp"
+#include "AudioLevel.hpp"
+#include "BatteryMonitor.hpp"
 
 namespace mobilinkd { namespace tnc {
 
+void IDemodulator::configureADC(bool oversampling, uint32_t sampling_time)
+{
+    auto adc = hadc1.Instance;
+
+    hadc1.Init.OversamplingMode = oversampling ? ENABLE : DISABLE;
+    if (oversampling) SET_BIT(adc->CFGR2, ADC_CFGR2_ROVSE);
+    else CLEAR_BIT(adc->CFGR2, ADC_CFGR2_ROVSE);
+
+    LL_ADC_SetChannelSamplingTime(adc, AUDIO_IN, sampling_time);
+    LL_ADC_REG_SetSequencerRanks(adc, LL_ADC_REG_RANK_1, AUDIO_IN);
+}
+
 /**
  * Start the ADC DMA transfer.  The block size is equal to the number of
  * 32-bit elements in the buffer.  This is also equal to the number of
@@ -28,6 +42,9 @@ void IDemodulator::startADC(uint32_t period, uint32_t block_size)
         CxxErrorHandler();
     }
 
+    // Battery measurements are injected into the audio conversions.
+    audio::battery().configure();
+
     if (HAL_TIM_Base_Start(&htim6) != HAL_OK)
     {
         CxxErrorHandler();
@@ -42,11 +59,21 @@ void IDemodulator::startADC(uint32_t period, uint32_t block_size)
 
 void IDemodulator::stopADC()
 {
+    audio::battery().abort();
     if (HAL_ADC_Stop_DMA(&hadc1) != HAL_OK)
         CxxErrorHandler();
     if (HAL_TIM_Base_Stop(&htim6) != HAL_OK)
         CxxErrorHandler();
 }
 
+void IDemodulator::restartADC()
+{
+    if (HAL_TIM_Base_Start(&htim6) != HAL_OK)
+        CxxErrorHandler();
+    if (HAL_ADC_Start_DMA(&hadc1, audio::adc_buffer,
+        audio::dma_transfer_size) != HAL_OK)
+        CxxErrorHandler();
+}
+
 
 }} // mobilinkd::tnc
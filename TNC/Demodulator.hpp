@@ -41,9 +41,21 @@ struct IDemodulator
 
     virtual ~IDemodulator() {}
 
+    /**
+     * Select the audio input channel, its sampling time and whether the
+     * regular conversions are oversampled.  The oversampling ratio and
+     * shift set by MX_ADC1_Init() are kept.  This only writes the ADC
+     * registers, so a modem switch does not re-initialize the ADC.  It
+     * must be called while the ADC is stopped.
+     */
+    static void configureADC(bool oversampling, uint32_t sampling_time);
+
     static void startADC(uint32_t period, uint32_t block_size);
 
     static void stopADC();
+
+    /// Restart the ADC after stopADC() at the same rate and block size.
+    static void restartADC();
 };
 
 }} // mobilinkd::tnc
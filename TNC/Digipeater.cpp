@@ -2,8 +2,16 @@
 // All rights reserved.
 
 #include "Digipeater.hpp"
-#include "Digipeater.h"
 #include "IOEventTask.h"
+#include "Statistics.hpp"
+#include "Log.h"
+#include "main.h"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+
+extern osMessageQId hdlcOutputQueueHandle;
 
 /*
  * APRS Digipeater implementation.
@@ -20,42 +28,388 @@
  * 5.1. http://www.aprs.org/aprs12/preemptive-digipeating.txt
  * 6. Find first non-digipeated VIA entry.
  * 6.1. If it matches one of our set and used aliases, relay.
+ *
+ * The CRC32 is only computed, and the history only updated, for packets
+ * that would be relayed.  The dedupe time is kiss::Hardware::dedupe_seconds.
+ * The unused vias ahead of a preempted via are marked as repeated.  Our own
+ * packets, heard from another digipeater, are ignored.
+ *
+ * In viscous mode, any UI packet with a repeated via cancels a held frame
+ * with the same CRC32.  This check is skipped when nothing is held.
  */
 
-void startDigipeaterTask(void* arg)
+extern "C" void digipeaterPending(void const*)
 {
-  using mobilinkd::tnc::Digipeater;
-  using mobilinkd::tnc::hdlc::IoFrame;
+    // Runs in the timer task.  The IO event task owns the digipeater.
+    // If its queue is full, try again shortly so held frames are not lost.
+    if (osMessagePut(ioEventQueueHandle, CMD_DIGI_PENDING, 0) != osOK) {
+        osTimerStart(digipeaterTimerHandle,
+            mobilinkd::tnc::Digipeater::PENDING_RETRY);
+    }
+}
 
-  auto digi = static_cast<Digipeater*>(arg);
-  for(;;)
-  {
-    osEvent evt = osMessageGet(digipeaterQueueHandle, osWaitForever);
-    if (evt.status != osEventMessage) continue;
+namespace mobilinkd { namespace tnc {
 
-    uint32_t cmd = evt.value.v;
-    if (cmd < FLASH_BASE) // Assumes FLASH_BASE < SRAM_BASE.
-    {
-      // this is a command, not a packet.
-      return;
+namespace {
+
+constexpr std::array<uint32_t, 256> make_crc32_table()
+{
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i != table.size(); ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j != 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+        table[i] = crc;
     }
+    return table;
+}
 
-    digi->clean_history();
+constexpr std::array<uint32_t, 256> crc32_table = make_crc32_table();
 
-    auto frame = static_cast<IoFrame*>(evt.value.p);
+inline uint32_t crc32(uint32_t crc, uint8_t value)
+{
+    return crc32_table[(crc ^ value) & 0xFF] ^ (crc >> 8);
+}
 
-    if (!digi->can_repeat(frame)) continue;
+/// Parse a NUL padded "CALL-SSID" string.
+Digipeater::Call parse_call(const uint8_t* text)
+{
+    Digipeater::Call result;
+    result.call.fill(' ' << 1);
+    result.ssid = -1;
 
-    auto digi_frame = digi->rewrite_frame(frame);
+    size_t i = 0;
+    for (; i != kiss::CALLSIGN_LEN and text[i] != 0 and text[i] != '-'; ++i) {
+        if (i < result.call.size()) result.call[i] = toupper(text[i]) << 1;
+    }
 
-  }
+    if (i != kiss::CALLSIGN_LEN and text[i] == '-') {
+        int ssid = 0;
+        for (++i; i != kiss::CALLSIGN_LEN and isdigit(text[i]); ++i) {
+            ssid = ssid * 10 + text[i] - '0';
+        }
+        result.ssid = std::min(ssid, 15);
+    }
+
+    return result;
 }
 
-void beacon(void* arg)
+inline uint8_t ssid(const uint8_t* address)
 {
+    return (address[6] & ax25::SSID_MASK) >> 1;
+}
 
+inline bool same_call(const uint8_t* address, const Digipeater::Call& call)
+{
+    return std::equal(call.call.begin(), call.call.end(), address);
 }
 
-namespace mobilinkd { namespace tnc {
+} // namespace
+
+bool DigipeaterHistory::insert(uint32_t crc, uint32_t now, uint32_t window)
+{
+    if (crc == 0) crc = 1;
+
+    Entry* slot = nullptr;
+    uint32_t slot_age = 0;
+
+    for (size_t i = 0; i != PROBES; ++i) {
+        auto& entry = entries_[(crc + i) & (SIZE - 1)];
+        bool live = entry.crc != 0 and now - entry.time < window;
+        if (live and entry.crc == crc) return false;
+
+        uint32_t age = live ? now - entry.time : std::numeric_limits<uint32_t>::max();
+        if (slot == nullptr or age > slot_age) {
+            slot = &entry;
+            slot_age = age;
+        }
+    }
+
+    slot->crc = crc;
+    slot->time = now;
+    return true;
+}
+
+bool DigipeaterPending::insert(uint32_t crc, uint32_t due, hdlc::IoFrame* frame)
+{
+    for (size_t i = 0; i != PROBES; ++i) {
+        auto& entry = entries_[(crc + i) & (SIZE - 1)];
+        if (entry.frame != nullptr) continue;
+        entry.crc = crc;
+        entry.due = due;
+        entry.frame = frame;
+        ++count_;
+        return true;
+    }
+    return false;
+}
+
+bool DigipeaterPending::cancel(uint32_t crc)
+{
+    for (size_t i = 0; i != PROBES; ++i) {
+        auto& entry = entries_[(crc + i) & (SIZE - 1)];
+        if (entry.frame == nullptr or entry.crc != crc) continue;
+        hdlc::release(entry.frame);
+        entry.frame = nullptr;
+        --count_;
+        return true;
+    }
+    return false;
+}
+
+hdlc::IoFrame* DigipeaterPending::pop(uint32_t now)
+{
+    if (count_ == 0) return nullptr;
+
+    for (auto& entry : entries_) {
+        if (entry.frame == nullptr or int32_t(entry.due - now) > 0) continue;
+        auto result = entry.frame;
+        entry.frame = nullptr;
+        --count_;
+        return result;
+    }
+    return nullptr;
+}
+
+uint32_t DigipeaterPending::next(uint32_t now) const
+{
+    if (count_ == 0) return 0;
+
+    uint32_t result = std::numeric_limits<uint32_t>::max();
+    for (auto& entry : entries_) {
+        if (entry.frame == nullptr) continue;
+        result = std::min<uint32_t>(result, std::max<int32_t>(entry.due - now, 1));
+    }
+    return result;
+}
+
+Digipeater& digipeater()
+{
+    static Digipeater instance;
+    return instance;
+}
+
+void Digipeater::configure(const kiss::Hardware& hw)
+{
+    mycall_ = parse_call(hw.mycall);
+    window_ = hw.dedupe_seconds * 1000;
+    viscous_ = hw.options & KISS_OPTION_VISCOUS_DIGI;
+    enabled_ = false;
+
+    for (size_t i = 0; i != aliases_.size(); ++i) {
+        aliases_[i] = hw.aliases[i];
+        calls_[i] = parse_call(hw.aliases[i].call);
+        if (aliases_[i].set and aliases_[i].use) enabled_ = true;
+    }
+
+    INFO("Digipeater %s%s", enabled_ ? "enabled" : "disabled",
+        enabled_ and viscous_ ? " (viscous)" : "");
+}
+
+/**
+ * Find the alias matching the via.  If preempt is set, only MYCALL and
+ * aliases that allow preemption match.
+ *
+ * @return the alias index, MYCALL_MATCH or NO_MATCH.
+ */
+int Digipeater::match(const uint8_t* via, bool preempt) const
+{
+    if (same_call(via, mycall_) and ssid(via) == std::max<int>(mycall_.ssid, 0)) {
+        return MYCALL_MATCH;
+    }
+
+    for (size_t i = 0; i != aliases_.size(); ++i) {
+        auto& alias = aliases_[i];
+        if (!alias.set or !alias.use or (preempt and !alias.preempt)) continue;
+        if (!same_call(via, calls_[i])) continue;
+
+        auto n = ssid(via);
+        if (calls_[i].ssid >= 0) {
+            if (n == calls_[i].ssid) return i;
+        } else if (alias.hops) {
+            if (n != 0 and n <= alias.hops) return i;   // WIDEn-N
+        } else if (n == 0) {
+            return i;
+        }
+    }
+
+    return NO_MATCH;
+}
+
+/**
+ * Is the destination MYCALL (SSID 0 if none is set) or one of the set
+ * aliases?  An alias without an SSID matches any SSID.
+ */
+bool Digipeater::is_local(const uint8_t* dest) const
+{
+    if (same_call(dest, mycall_) and ssid(dest) == std::max<int>(mycall_.ssid, 0)) {
+        return true;
+    }
+
+    for (size_t i = 0; i != aliases_.size(); ++i) {
+        if (!aliases_[i].set or !same_call(dest, calls_[i])) continue;
+        if (calls_[i].ssid < 0 or ssid(dest) == calls_[i].ssid) return true;
+    }
+    return false;
+}
+
+/// CRC32 of the destination, source and information fields.
+uint32_t Digipeater::crc(const ax25::Ax25View& view) const
+{
+    uint32_t result = 0xFFFFFFFF;
+    for (uint8_t i = 0; i != 2 * ax25::ADDRESS_LEN; ++i) {
+        uint8_t c = view.address(0)[i];
+        result = crc32(result, i % ax25::ADDRESS_LEN == 6 ? c & ax25::SSID_MASK : c);
+    }
+
+    auto it = view.info();
+    for (uint16_t i = 0; i != view.info_size(); ++i) result = crc32(result, *it++);
+
+    return ~result;
+}
+
+/**
+ * Rewrite the address field.  The preempted vias from next up to the
+ * matched via are marked as repeated.
+ */
+void Digipeater::rewrite(ax25::Ax25View& view, uint8_t next, uint8_t via, int alias)
+{
+    for (uint8_t i = next; i != via; ++i) view.set_repeated(i);
+
+    uint8_t mycall_ssid = std::max<int>(mycall_.ssid, 0);
+
+    if (alias == MYCALL_MATCH) {
+        view.set_repeated(via);
+    } else if (calls_[alias].ssid < 0 and aliases_[alias].hops) {
+        // WIDEn-N.  MYCALL goes ahead of the via, if there is room.
+        view.wide_hop(via, aliases_[alias].insert_id ? &mycall_.call : nullptr,
+            mycall_ssid);
+    } else if (aliases_[alias].insert_id) {
+        view.replace(via, mycall_.call, mycall_ssid, true);
+    } else {
+        view.set_repeated(via);
+    }
+}
+
+/**
+ * Queue the frame for transmission.  This runs in the IO event task, so
+ * it only waits SEND_TIMEOUT ms for room.  The frame is dropped if the
+ * channel is that busy.
+ */
+void Digipeater::send(hdlc::IoFrame* frame)
+{
+    if (osMessagePut(hdlcOutputQueueHandle, reinterpret_cast<uint32_t>(frame),
+        SEND_TIMEOUT) != osOK)
+    {
+        WARN("Digipeater: TX queue full");
+        stats::count(stats::counters().digi_drops);
+        hdlc::release(frame);
+        return;
+    }
+    stats::count(stats::counters().digi_frames);
+}
+
+void Digipeater::hold(uint32_t crc, hdlc::IoFrame* frame)
+{
+    uint32_t now = osKernelSysTick();
+    if (!pending_.insert(crc, now + VISCOUS_DELAY, frame)) {
+        WARN("Digipeater: too many frames held");
+        hdlc::release(frame);
+        return;
+    }
+
+    // The timer is already set if an earlier frame is waiting.
+    if (!xTimerIsTimerActive(digipeaterTimerHandle)) {
+        osTimerStart(digipeaterTimerHandle, pending_.next(now));
+    }
+}
+
+void Digipeater::expire()
+{
+    uint32_t now = osKernelSysTick();
+    while (auto frame = pending_.pop(now)) send(frame);
+
+    auto wait = pending_.next(now);
+    if (wait) osTimerStart(digipeaterTimerHandle, wait);
+}
+
+bool Digipeater::operator()(hdlc::IoFrame* frame, bool copy)
+{
+    if (!enabled_ or !frame->ok()) return false;
+
+    // The received frame ends with the FCS.
+    ax25::Ax25View view(frame, 2);
+    if (!view.valid()) return false;
+
+    if ((view.control() & ~ax25::POLL_FINAL) != ax25::UI) return false; // Rule 0.
+
+    // Another digipeater has sent a frame we are holding.
+    if (!pending_.empty()) {
+        bool repeated = false;
+        for (uint8_t i = 2; i != view.addresses(); ++i) repeated |= view.repeated(i);
+        if (repeated and pending_.cancel(crc(view))) {
+            DEBUG("Digipeater: cancelled");
+            stats::count(stats::counters().digi_cancelled);
+            return false;
+        }
+    }
+
+    if (is_local(view.destination())) return false;                     // Rule 1.
+    if (match(view.source(), false) == MYCALL_MATCH) return false;      // Our own.
+
+    // Rule 4.  The vias up to the last one with the H bit are used.
+    uint8_t addresses = view.addresses();
+    uint8_t next = 2;
+    for (uint8_t i = 2; i != addresses; ++i) {
+        if (view.repeated(i)) next = i + 1;
+    }
+    if (next == addresses) return false;
+
+    // Rules 5 and 6.
+    uint8_t via = next;
+    int alias = match(view.address(via), false);
+    while (alias == NO_MATCH and ++via != addresses) {
+        alias = match(view.address(via), true);
+    }
+    if (alias == NO_MATCH) return false;
+
+    // Rules 2 and 3.
+    uint32_t frame_crc = crc(view);
+    if (!history_.insert(frame_crc, osKernelSysTick(), window_)) {
+        DEBUG("Digipeater: duplicate");
+        stats::count(stats::counters().digi_dupes);
+        return false;
+    }
+
+    uint16_t size = frame->size() - 2;
+    hdlc::IoFrame* result = frame;
+
+    if (copy) {
+        result = hdlc::ioFramePool().acquire();
+        if (!result) return false;
+
+        bool ok = true;
+        auto it = frame->begin();
+        for (uint16_t i = 0; ok and i != size; ++i) ok = result->push_back(*it++);
+        if (!ok) {
+            hdlc::release(result);
+            return false;
+        }
+        view = ax25::Ax25View(result);
+    } else {
+        frame->truncate(size);
+    }
+
+    rewrite(view, next, via, alias);
+    result->source(hdlc::IoFrame::DIGI_DATA);
+
+    if (viscous_ and alias != MYCALL_MATCH) {
+        hold(frame_crc, result);
+    } else {
+        send(result);
+    }
+    return !copy;
+}
 
 }}  // mobilinkd::tnc
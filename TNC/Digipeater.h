@@ -1,17 +0,0 @@
-// Copyright 2017 Rob Riggs <rob@mobilinkd.com>
-// All rights reserved.
-
-#ifndef MOBILINKD__TNC__DIGIPEATER_H_
-#define MOBILINKD__TNC__DIGIPEATER_H_
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-void beacon(void* arg);
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif /* MOBILINKD__TNC__DIGIPEATER_H_ */
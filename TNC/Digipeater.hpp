@@ -5,85 +5,168 @@
 #ifndef MOBILINKD__TNC__DIGIPEATER_HPP_
 #define MOBILINKD__TNC__DIGIPEATER_HPP_
 
-#include <cmsis_os.h>
+#include "KissHardware.hpp"
+#include "HdlcFrame.hpp"
+#include "Ax25View.hpp"
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include "cmsis_os.h"
 
-extern osThreadId digipeaterTaskHandle;
-extern osMessageQId digipeaterQueueHandle;
+#include <array>
+#include <cstdint>
 
-void startDigipeaterTask(void* arg);
-void beacon(void* arg);
+extern "C" void digipeaterPending(void const* argument);
 
-#ifdef __cplusplus
-} // extern "C"
-
-#include "KissHardware.hpp"
-#include "HdlcFrame.hpp"
+extern osTimerId digipeaterTimerHandle;
 
 namespace mobilinkd { namespace tnc {
 
 /**
- * We only process ALL, BEACON, CQ, QST, GPSxxx and APxxxx TOCALLs,
- * and exact matches to our TOCALL and any of our aliases.
+ * Recently digipeated frames, by CRC32, for duplicate suppression.
  *
- * The following constants are used:
- * - kiss::NUMBER_OF_ALIASES
- * - kiss::NUMBER_OF_BEACONS
- * - kiss::BEACON_PATH_LEN
- * - kiss::BEACON_TEXT_LEN
- * - kiss::CALLSIGN_LEN
- * - kiss::TOCALL
+ * This is an open-addressed hash table with a fixed number of probes.
+ * Entries expire by age, so nothing is ever removed or scanned for: a
+ * lookup checks PROBES slots, and an insert takes the first expired slot
+ * among them or, if all are live, the oldest.  Lookup, insertion and
+ * expiry are constant time.
  */
-struct Digipeater
+class DigipeaterHistory
 {
-  const kiss::Alias* aliases_;
-  const kiss::Beacon* beacons_;
-
-  Digipeater(const kiss::Alias* aliases, const kiss::Beacon* beacons)
-  : aliases_(aliases), beacons_(beacons)
-  {}
-
-  /**
-   * Scan the history table and remove outdated entries.
-   */
-  void clean_history()
-  {
-
-  }
-
-  /**
-   * Can the frame be digipeated?
-   *
-   *  - Is it a UI frame
-   *  - Does it match an active digi alias?
-   *    - set = true
-   *    - use = true
-   *    - hops > 0
-   *    - alias name matches first frame via OR preempt = true and alias name
-   *      matches any frame via.
-   *  - Does it not exist in history?
-   * @param frame
-   * @return nullptr if the frame cannot be digipeated, otherwise a pointer
-   *    to the alias that it matched.
-   */
-  const kiss::Alias* can_repeat(hdlc::IoFrame* frame)
-  {
-    return nullptr;
-  }
-
-  hdlc::IoFrame* rewrite_frame(hdlc::IoFrame* frame)
-  {
-    frame->source(hdlc::IoFrame::DIGI_DATA);
-    return frame;
-  }
+public:
+    static constexpr size_t SIZE = 128;     // Must be a power of 2.
+    static constexpr size_t PROBES = 4;
+
+    /**
+     * Record the frame unless it was recorded less than window ms ago.
+     *
+     * @return false if the frame is a duplicate.
+     */
+    bool insert(uint32_t crc, uint32_t now, uint32_t window);
+
+private:
+    struct Entry
+    {
+        uint32_t crc;       ///< 0 when empty.
+        uint32_t time;      ///< ms.
+    };
+
+    std::array<Entry, SIZE> entries_{};
 };
 
+/**
+ * Frames held by a viscous digipeater, keyed by the dedupe CRC.
+ *
+ * Like DigipeaterHistory, this is an open-addressed table with a fixed
+ * number of probes, so insert() and cancel() are constant time.  The
+ * table owns the frames it holds.  Due frames are found by scanning the
+ * table, which is done only when the digipeater timer fires.
+ */
+class DigipeaterPending
+{
+public:
+    static constexpr size_t SIZE = 16;      // Must be a power of 2.
+    static constexpr size_t PROBES = 4;
+
+    bool empty() const { return count_ == 0; }
 
-}} // mobilinkd::tnc
+    /// @return false if there is no free slot.  The frame is not taken.
+    bool insert(uint32_t crc, uint32_t due, hdlc::IoFrame* frame);
+
+    /// Release the frame held for crc. @return false if there is none.
+    bool cancel(uint32_t crc);
+
+    /// Remove and return a frame due at now, or nullptr.
+    hdlc::IoFrame* pop(uint32_t now);
+
+    /// @return ms until the next frame is due, or 0 if none is held.
+    uint32_t next(uint32_t now) const;
 
-#endif // __cplusplus
+private:
+    struct Entry
+    {
+        uint32_t crc;
+        uint32_t due;               ///< ms.
+        hdlc::IoFrame* frame;       ///< nullptr when empty.
+    };
+
+    std::array<Entry, SIZE> entries_{};
+    size_t count_{0};
+};
+
+/**
+ * APRS digipeater.  Frames heard on RF are passed to operator() by the IO
+ * event task, which transmits the rewritten frame returned.
+ *
+ * The digipeater is enabled when any alias is set and in use.  Aliases are
+ * matched against the callsign part of a via.  An alias with hops > 0 is
+ * a WIDEn-N style alias: it matches a via with an SSID from 1 to hops,
+ * and the SSID is decremented.  An alias with an explicit SSID ("RELAY-1")
+ * or no hops matches exactly.  Frames addressed via MYCALL are always
+ * repeated.
+ *
+ * The address field is rewritten in place with ax25::Ax25View.
+ *
+ * In viscous mode (KISS_OPTION_VISCOUS_DIGI), for fill-in digipeaters,
+ * frames are held for VISCOUS_DELAY ms before they are sent.  A held
+ * frame is dropped if the same packet is heard with a repeated via in
+ * the meantime, as another digipeater has handled it.  Frames addressed
+ * via MYCALL are not held.
+ */
+class Digipeater
+{
+public:
+    static constexpr uint32_t VISCOUS_DELAY = 5000;     // ms.
+    static constexpr uint32_t SEND_TIMEOUT = 100;       // ms.
+    static constexpr uint32_t PENDING_RETRY = 50;       // ms.
+
+    /// Encoded (shifted) callsign and the SSID, or -1 if none was given.
+    struct Call
+    {
+        ax25::Callsign call;
+        int8_t ssid;
+    };
+
+    /// Update MYCALL and the aliases from the settings.
+    void configure(const kiss::Hardware& hw);
+
+    bool enabled() const { return enabled_; }
+
+    /**
+     * Digipeat the received frame if it should be, queueing it for
+     * transmission or holding it in viscous mode.  If copy is set, a new
+     * frame is sent and the received frame is not changed.  Otherwise the
+     * received frame itself is rewritten and sent.
+     *
+     * @return true if the received frame was taken.
+     */
+    bool operator()(hdlc::IoFrame* frame, bool copy);
+
+    /// Send the held frames that are due.  Called on CMD_DIGI_PENDING.
+    void expire();
+
+private:
+    static constexpr int NO_MATCH = -1;
+    static constexpr int MYCALL_MATCH = kiss::NUMBER_OF_ALIASES;
+
+    int match(const uint8_t* via, bool preempt) const;
+    bool is_local(const uint8_t* dest) const;
+    uint32_t crc(const ax25::Ax25View& view) const;
+    void rewrite(ax25::Ax25View& view, uint8_t next, uint8_t via, int alias);
+    void send(hdlc::IoFrame* frame);
+    void hold(uint32_t crc, hdlc::IoFrame* frame);
+
+    Call mycall_{};
+    std::array<Call, kiss::NUMBER_OF_ALIASES> calls_{};
+    std::array<kiss::Alias, kiss::NUMBER_OF_ALIASES> aliases_{};
+    uint32_t window_{0};                    ///< Dedupe time, ms.
+    bool enabled_{false};
+    bool viscous_{false};
+
+    DigipeaterHistory history_;
+    DigipeaterPending pending_;
+};
+
+Digipeater& digipeater();
+
+}} // mobilinkd::tnc
 
 #endif // MOBILINKD__TNC__DIGIPEATER_HPP_
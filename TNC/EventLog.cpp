@@ -0,0 +1,320 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "EventLog.hpp"
+#include "Kiss.hpp"
+#include "PortInterface.hpp"
+#include "IOEventTask.h"
+#include "main.h"
+
+#include "stm32l4xx_hal.h"
+#include "cmsis_os.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" void event_log_(int level, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    mobilinkd::tnc::eventlog::eventLog().record(level, fmt, args);
+    va_end(args);
+}
+
+extern "C" void event_log_v(int level, const char* fmt, va_list args)
+{
+    mobilinkd::tnc::eventlog::eventLog().record(level, fmt, args);
+}
+
+namespace mobilinkd { namespace tnc { namespace eventlog {
+
+namespace {
+
+// Preserved across warm reset.
+EventLog eventLog_ __attribute__((section(".bss3")));
+
+bool initialized{false};
+uint8_t tokens{EventLog::RATE_BURST};
+uint32_t last_token{0};
+uint8_t suppressed{0};
+
+// Next entry to send to the host and the first entry not to send.
+volatile uint32_t cursor{0};
+volatile bool live{false};
+volatile bool sending{false};
+
+constexpr uint32_t fnv1a(const char* s, uint32_t hash = 2166136261u)
+{
+    return *s ? fnv1a(s + 1, (hash ^ uint8_t(*s)) * 16777619u) : hash;
+}
+
+constexpr uint32_t IMAGE_ID = fnv1a(__DATE__ " " __TIME__);
+
+constexpr uintptr_t FLASH_START = 0x08000000;
+constexpr uintptr_t FLASH_END = 0x08040000;
+
+bool in_flash(const void* p)
+{
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    return addr >= FLASH_START and addr < FLASH_END;
+}
+
+/// Tiny formatter for the subset of printf used by WARN/ERROR/SEVERE.
+size_t format_message(char* out, size_t size, const char* fmt,
+    const uint32_t* args, size_t nargs)
+{
+    size_t pos = 0;
+    size_t arg = 0;
+
+    auto put = [&](char c) { if (pos + 1 < size) out[pos++] = c; };
+
+    while (*fmt and pos + 1 < size)
+    {
+        char c = *fmt++;
+        if (c != '%') { put(c); continue; }
+        if (*fmt == '%') { put(*fmt++); continue; }
+
+        bool zero = false;
+        int width = 0;
+        if (*fmt == '0') { zero = true; ++fmt; }
+        while (*fmt >= '0' and *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        while (*fmt == 'l' or *fmt == 'h' or *fmt == 'z') ++fmt;
+
+        char conv = *fmt;
+        if (conv == 0) break;
+        ++fmt;
+
+        uint32_t value = arg < nargs ? args[arg] : 0;
+        ++arg;
+
+        char digits[12];
+        int n = 0;
+        bool negative = false;
+
+        switch (conv) {
+        case 's':
+        {
+            auto s = reinterpret_cast<const char*>(value);
+            if (!in_flash(s)) s = "?";
+            for (size_t i = 0; s[i] and i != 64; ++i) put(s[i]);
+            continue;
+        }
+        case 'c':
+            put(char(value));
+            continue;
+        case 'd': case 'i':
+            if (int32_t(value) < 0) {
+                negative = true;
+                value = -value;
+            }
+            // Fall through.
+        case 'u':
+            do { digits[n++] = '0' + value % 10; value /= 10; } while (value);
+            break;
+        case 'p':
+            put('0'); put('x');
+            zero = true;
+            width = 8;
+            // Fall through.
+        case 'x': case 'X':
+        {
+            const char* hex = conv == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+            do { digits[n++] = hex[value & 15]; value >>= 4; } while (value);
+            break;
+        }
+        default:
+            put('%');
+            put(conv);
+            continue;
+        }
+
+        if (negative and zero) put('-');
+        for (int i = n + negative; i < width; ++i) put(zero ? '0' : ' ');
+        if (negative and not zero) put('-');
+        while (n) put(digits[--n]);
+    }
+
+    out[pos] = 0;
+    return pos;
+}
+
+/// Capture up to MAX_ARGS 32-bit arguments according to the format.
+size_t capture(const char* fmt, va_list ap, uint32_t* args)
+{
+    size_t count = 0;
+    while (*fmt and count != EventLog::MAX_ARGS)
+    {
+        if (*fmt++ != '%') continue;
+        if (*fmt == '%') { ++fmt; continue; }
+        while (*fmt and strchr("-+ #0123456789.lhz", *fmt)) ++fmt;
+        if (*fmt == 0) break;
+        args[count++] = va_arg(ap, uint32_t);
+        ++fmt;
+    }
+    return count;
+}
+
+} // namespace
+
+EventLog& eventLog()
+{
+    if (!initialized) {
+        eventLog_.init();
+        initialized = true;
+    }
+    return eventLog_;
+}
+
+void EventLog::init()
+{
+    if (magic != MAGIC or image != IMAGE_ID) {
+        clear();
+        return;
+    }
+    ++boot;
+}
+
+void EventLog::clear()
+{
+    memset(this, 0, sizeof(*this));
+    magic = MAGIC;
+    image = IMAGE_ID;
+}
+
+void EventLog::record(int level, const char* fmt, va_list ap)
+{
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    capture(fmt, ap, entry.args);
+    entry.timestamp = HAL_GetTick();
+    entry.fmt = fmt;
+    entry.level = level;
+    entry.boot = boot;
+
+    bool notify;
+
+    // May be called from interrupt handlers.
+    auto x = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t elapsed = entry.timestamp - last_token;
+    if (elapsed >= RATE_INTERVAL) {
+        uint32_t refill = elapsed / RATE_INTERVAL;
+        tokens = refill >= RATE_BURST ? RATE_BURST
+            : std::min<uint32_t>(RATE_BURST, tokens + refill);
+        last_token = entry.timestamp;
+    }
+
+    if (tokens == 0) {
+        if (suppressed != 0xFF) ++suppressed;
+        taskEXIT_CRITICAL_FROM_ISR(x);
+        return;
+    }
+
+    --tokens;
+    entry.suppressed = suppressed;
+    suppressed = 0;
+    entries[next % SIZE] = entry;
+    ++next;
+    notify = live and not sending;
+    if (notify) sending = true;
+    taskEXIT_CRITICAL_FROM_ISR(x);
+
+    if (notify and ioEventQueueHandle) {
+        if (osMessagePut(ioEventQueueHandle, CMD_EVENT_LOG, 0) != osOK) {
+            sending = false;
+        }
+    }
+}
+
+size_t EventLog::format(uint32_t index, char* buffer, size_t size) const
+{
+    static const char levels[] = "DIWES";
+
+    const auto& entry = entries[index % SIZE];
+
+    const uint32_t prefix[] = {
+        entry.timestamp / 1000, entry.timestamp % 1000, entry.boot,
+        uint32_t(entry.level < 5 ? levels[entry.level] : '?')
+    };
+    size_t len = format_message(buffer, size, "%u.%03u #%u %c: ", prefix, 4);
+
+    if (in_flash(entry.fmt)) {
+        len += format_message(buffer + len, size - len, entry.fmt,
+            entry.args, MAX_ARGS);
+    }
+
+    if (entry.suppressed) {
+        const uint32_t count = entry.suppressed;
+        len += format_message(buffer + len, size - len, " (%u suppressed)",
+            &count, 1);
+    }
+
+    return len;
+}
+
+void handle_request(uint8_t command)
+{
+    auto& log = eventLog();
+
+    switch (command) {
+    case EventLog::DUMP:
+        cursor = log.next > EventLog::SIZE ? log.next - EventLog::SIZE : 0;
+        break;
+    case EventLog::LIVE_ON:
+        live = true;
+        break;
+    case EventLog::LIVE_OFF:
+        live = false;
+        return;
+    case EventLog::CLEAR:
+    {
+        auto x = taskENTER_CRITICAL_FROM_ISR();
+        log.clear();
+        cursor = 0;
+        taskEXIT_CRITICAL_FROM_ISR(x);
+        return;
+    }
+    default:
+        return;
+    }
+
+    sending = true;
+    send_next();
+}
+
+void send_next()
+{
+    auto& log = eventLog();
+
+    // Entries may have been overwritten since they were requested.
+    if (log.next - cursor > EventLog::SIZE) cursor = log.next - EventLog::SIZE;
+
+    if (cursor == log.next) {
+        sending = false;
+        // Catch an entry recorded after the check above.
+        if (live and log.next != cursor and not sending) {
+            sending = true;
+            osMessagePut(ioEventQueueHandle, CMD_EVENT_LOG, 0);
+        }
+        return;
+    }
+
+    char buffer[128];
+    auto len = log.format(cursor, buffer, sizeof(buffer));
+
+    // Do not wait long on a busy port.  The rest is sent on the next
+    // request or, when live, the next entry recorded.
+    if (not ioport->write(reinterpret_cast<uint8_t*>(buffer), len,
+        kiss::FRAME_LOG, 10))
+    {
+        sending = false;
+        return;
+    }
+
+    cursor = cursor + 1;
+
+    if (osMessagePut(ioEventQueueHandle, CMD_EVENT_LOG, 0) != osOK) {
+        sending = false;
+    }
+}
+
+}}} // mobilinkd::tnc::eventlog
@@ -0,0 +1,88 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace eventlog {
+
+/**
+ * On-device log of warnings and errors for units in the field, where no
+ * ITM/SWO is attached.  WARN(), ERROR() and SEVERE() are recorded here in
+ * all builds.
+ *
+ * Entries are not formatted when recorded.  The format string address and
+ * up to four 32-bit arguments are stored.  This makes recording cheap
+ * enough for interrupt handlers and tasks with small stacks.  The text is
+ * formatted by the IO event task when the entry is sent to the host.  Only
+ * %d, %i, %u, %x, %X, %c, %s and %p are supported, with optional zero
+ * padding, width and length modifiers.
+ *
+ * The log is kept in SRAM2 (.bss3), which is preserved across a warm
+ * reset.  Entries from earlier boots are kept as long as the firmware
+ * image has not changed, so that the format strings are still valid.
+ *
+ * Recording is rate-limited.  The number of entries suppressed since the
+ * previous entry is stored with each entry.
+ *
+ * The log is read with KISS FRAME_LOG (0x07) frames from the host.  The
+ * first byte is the command:
+ *
+ *  - DUMP: send all entries in the log.
+ *  - LIVE_ON: send new entries as they are recorded.
+ *  - LIVE_OFF: stop sending new entries.
+ *  - CLEAR: erase the log.
+ *
+ * Each entry is sent as one KISS FRAME_LOG frame containing a line of
+ * text: "<seconds since boot> <boot count> <level>: <message>".  Entries
+ * are sent one at a time from the IO event queue so that the IO event
+ * task is never blocked for long.
+ */
+struct EventLog
+{
+    static constexpr uint32_t MAGIC = 0x4C4F4701;
+    static constexpr size_t SIZE = 48;
+    static constexpr size_t MAX_ARGS = 4;
+    static constexpr uint32_t RATE_INTERVAL = 500;  // ms per token.
+    static constexpr uint8_t RATE_BURST = 8;
+
+    enum Command : uint8_t {DUMP = 1, LIVE_ON = 2, LIVE_OFF = 3, CLEAR = 4};
+
+    struct Entry
+    {
+        uint32_t timestamp;
+        const char* fmt;
+        uint32_t args[MAX_ARGS];
+        uint8_t level;
+        uint8_t boot;
+        uint8_t suppressed;
+        uint8_t reserved;
+    };
+
+    uint32_t magic;
+    uint32_t image;             // Firmware image identity.
+    uint32_t next;              // Total number of entries recorded.
+    uint8_t boot;
+    std::array<Entry, SIZE> entries;
+
+    void init();
+    void clear();
+    void record(int level, const char* fmt, va_list args);
+
+    /// Format entry index into buffer.  Returns the length.
+    size_t format(uint32_t index, char* buffer, size_t size) const;
+};
+
+EventLog& eventLog();
+
+/// Handle a KISS FRAME_LOG request from the host.
+void handle_request(uint8_t command);
+
+/// Send the next pending entry to the host.  Called from the IO event task.
+void send_next();
+
+}}} // mobilinkd::tnc::eventlog
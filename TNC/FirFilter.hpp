@@ -7,7 +7,6 @@
 
 #include "arm_math.h"
 
-#include <vector>
 #include <cstdlib>
 
 namespace mobilinkd { namespace tnc {
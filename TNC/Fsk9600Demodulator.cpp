@@ -6,6 +6,7 @@
 #include "AudioInput.hpp"
 #include "GPIO.hpp"
 #include "Log.h"
+#include "Statistics.hpp"
 
 namespace mobilinkd { namespace tnc {
 
@@ -33,6 +34,7 @@ hdlc::IoFrame* Fsk9600Demodulator::operator()(const q15_t* samples)
                 if (tmp) hdlc::release(tmp);
             } else {
                 result = hdlc_decoder_(nrzi_.decode(lfsr_(bit)), locked_);
+                if (result) stats::count(stats::counters().decoded[0]);
 #ifdef KISS_LOGGING
                 if (result) {
                     INFO("samples = %ld, mean = %d, dev = %d",
@@ -81,36 +83,35 @@ float Fsk9600Demodulator::readTwist()
 
     startADC(416, ADC_BLOCK_SIZE);
 
+    uint32_t received = 0;
     for (uint32_t i = 0; i != AVG_SAMPLES; ++i)
     {
-        uint32_t count = 0;
-        while (count < ADC_BLOCK_SIZE)
-        {
-            osEvent evt = osMessageGet(adcInputQueueHandle, osWaitForever);
-            if (evt.status != osEventMessage)
-                continue;
-
-            auto block = (audio::adc_pool_type::chunk_type*) evt.value.p;
-            uint16_t* data = (uint16_t*) block->buffer;
-            gf120(data, ADC_BLOCK_SIZE);
-            gf4800(data, ADC_BLOCK_SIZE);
+        auto block = audio::next_block(audio::MEASUREMENT_BLOCK_TIMEOUT, false);
+        if (!block) break;      // The ADC has stopped.
 
-            audio::adcPool.deallocate(block);
+        uint16_t* data = (uint16_t*) block->buffer;
+        gf120(data, ADC_BLOCK_SIZE);
+        gf4800(data, ADC_BLOCK_SIZE);
 
-            count += ADC_BLOCK_SIZE;
-        }
+        audio::adcPool.deallocate(block);
 
-        g120 += (gf120 / count);
-        g4800 += (gf4800 / count);
+        g120 += (gf120 / ADC_BLOCK_SIZE);
+        g4800 += (gf4800 / ADC_BLOCK_SIZE);
 
         gf120.reset();
         gf4800.reset();
+        ++received;
     }
 
     IDemodulator::stopADC();
 
-    g120 = 10.0f * log10f(g120 / AVG_SAMPLES);
-    g4800 = 10.0f * log10f(g4800 / AVG_SAMPLES);
+    if (received == 0) {
+        WARN("readTwist: no ADC blocks");
+        return 0.0f;
+    }
+
+    g120 = 10.0f * log10f(g120 / received);
+    g4800 = 10.0f * log10f(g4800 / received);
 
     auto result = g120 - g4800;
 
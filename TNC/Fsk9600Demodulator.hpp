@@ -61,22 +61,7 @@ struct Fsk9600Demodulator : IDemodulator
         demod_filter.init(bpf);
         passall(kiss::settings().options & KISS_OPTION_PASSALL);
 
-        hadc1.Init.OversamplingMode = DISABLE;
-        if (HAL_ADC_Init(&hadc1) != HAL_OK)
-        {
-            CxxErrorHandler();
-        }
-
-        ADC_ChannelConfTypeDef sConfig;
-
-        sConfig.Channel = AUDIO_IN;
-        sConfig.Rank = ADC_REGULAR_RANK_1;
-        sConfig.SingleDiff = ADC_SINGLE_ENDED;
-        sConfig.SamplingTime = ADC_SAMPLETIME_247CYCLES_5;
-        sConfig.OffsetNumber = ADC_OFFSET_NONE;
-        sConfig.Offset = 0;
-        if (HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK)
-            CxxErrorHandler();
+        configureADC(false, ADC_SAMPLETIME_247CYCLES_5);
 
         startADC(416, ADC_BLOCK_SIZE);
     }
@@ -27,7 +27,7 @@ const Fsk9600Modulator::cos_table_type Fsk9600Modulator::cos_table = {
     -507,  -968, -1345, -1626, -1815, -1931, -1995, -2027, -2042, -2048
 };
 
-void Fsk9600Modulator::init(const kiss::Hardware& hw)
+void Fsk9600Modulator::configure(const kiss::Hardware& hw)
 {
     for (auto& x : buffer_) x = 2048;
 
@@ -45,6 +45,19 @@ void Fsk9600Modulator::init(const kiss::Hardware& hw)
         ERROR("htim7 init failed");
         CxxErrorHandler();
     }
+}
+
+void Fsk9600Modulator::activate(const kiss::Hardware& hw)
+{
+    configure(hw);
+
+    if (HAL_DAC_SetValue(&hdac1, DAC_CHANNEL_1, DAC_ALIGN_12B_R, 2048) != HAL_OK) CxxErrorHandler();
+    if (HAL_DAC_Start(&hdac1, DAC_CHANNEL_1) != HAL_OK) CxxErrorHandler();
+}
+
+void Fsk9600Modulator::init(const kiss::Hardware& hw)
+{
+    configure(hw);
 
     DAC_ChannelConfTypeDef sConfig;
 
@@ -50,6 +50,7 @@ struct Fsk9600Modulator : Modulator
     ~Fsk9600Modulator() override {}
 
     void init(const kiss::Hardware& hw) override;
+    void activate(const kiss::Hardware& hw) override;
 
     void deinit() override
     {
@@ -109,11 +110,13 @@ struct Fsk9600Modulator : Modulator
     void fill_first(bool bit) override
     {
         fill(buffer_.data(), bit);
+        loopback::loopback().write(buffer_.data(), BIT_LEN);
     }
 
     void fill_last(bool bit) override
     {
         fill(buffer_.data() + BIT_LEN, bit);
+        loopback::loopback().write(buffer_.data() + BIT_LEN, BIT_LEN);
     }
 
     void empty() override
@@ -159,6 +162,8 @@ struct Fsk9600Modulator : Modulator
 
 private:
 
+    void configure(const kiss::Hardware& hw);
+
     /**
      * Configure the DAC for timer-based DMA conversion, start the timer,
      * and start DMA to DAC.
@@ -12,6 +12,10 @@
 #include "KissHardware.hpp"
 #include "AudioInput.hpp"
 #include "DCD.h"
+#include "IOEventTask.h"
+#include "Loopback.hpp"
+#include "Statistics.hpp"
+#include "Beacon.hpp"
 
 #include "main.h"
 
@@ -68,11 +72,13 @@ struct Encoder {
             state_ = state_type::STATE_IDLE;
             osEvent evt = osMessageGet(input_, osWaitForever);
             if (evt.status == osEventMessage) {
+                stats::high_water(stats::counters().hdlc_output_hwm, input_);
                 tx_delay_ = kiss::settings().txdelay;
                 tx_tail_ = kiss::settings().txtail;
                 p_persist_ = kiss::settings().ppersist;
                 slot_time_ = kiss::settings().slot;
-                duplex_ = kiss::settings().duplex;
+                // The demodulator must keep running in loopback mode.
+                duplex_ = kiss::settings().duplex or loopback::loopback().enabled();
                 auto frame = (IoFrame*) evt.value.p;
                 process(frame);
                 // See if we have back-to-back frames.
@@ -82,7 +88,7 @@ struct Encoder {
                     send_raw(IDLE);
                     send_delay_ = true;
                     if (!duplex_) {
-                      osMessagePut(audioInputQueueHandle, audio::DEMODULATOR,
+                      audio::post(audio::DEMODULATOR,
                         osWaitForever);
                     }
                 }
@@ -179,20 +185,29 @@ struct Encoder {
      *  expect that send_delay_ is false only when we have back-to-back
      *  packets.
      *
+     * ACKMODE frames are not released once sent.  They are returned to
+     * the host as the ACK for the frame.  Dropped frames are not ACKed.
+     *
+     * BEACON_DATA frames already hold the stuffed bitstream and are
+     * handed back to the beacons once sent or dropped.
+     *
      * @param frame
      */
     void process(IoFrame* frame) {
         ones_ = 0;      // Reset the ones count for each frame.
 
-        frame->add_fcs();
+        bool beacon = frame->source() == IoFrame::BEACON_DATA;
+        if (!beacon) frame->add_fcs();
 
         if (send_delay_) {
             if (not do_csma()) {
-                release(frame);
+                stats::count(stats::counters().csma_drops);
+                if (beacon) beacons().sent(frame);
+                else release(frame);
                 return;
             }
             if (!duplex_) {
-                osMessagePut(audioInputQueueHandle, audio::IDLE, osWaitForever);
+                audio::post(audio::IDLE, osWaitForever);
             }
             send_delay();
             send_delay_ = false;
@@ -200,9 +215,57 @@ struct Encoder {
             send_raw(FLAG);
         }
 
-        for (auto c : *frame) send(c);
-        release(frame);
+        // Only frames that go on the air can be looped back.
+        if (loopback::loopback().enabled()) {
+            loopback::loopback().transmitted(
+                beacon ? Beacons::fcs(frame) : frame->fcs(), osKernelSysTick());
+        }
+
+        if (beacon) {
+            send_stuffed(frame);
+        } else {
+            for (auto c : *frame) send(c);
+        }
         send_tail();
+        stats::count(stats::counters().tx_frames);
+
+        if (beacon) {
+            beacons().sent(frame);
+        } else if (frame->type() == IoFrame::ACKMODE) {
+            ack(frame);
+        } else {
+            release(frame);
+        }
+    }
+
+    /**
+     * Send the KISS ACKMODE sequence number back to the host.  The frame
+     * is re-used for the reply and is handed to the IO event task, which
+     * owns the port.  This keeps a slow port from stalling the modulator.
+     *
+     * The IO event task may itself be waiting to put the next frame on
+     * the TX queue, so this must not block.  If the IO event queue is
+     * full the ACK is dropped and counted.
+     *
+     * The FCS is added only because PortInterface::write() strips it.
+     *
+     * @param frame is an ACKMODE frame that has been transmitted.
+     */
+    void ack(IoFrame* frame) {
+        uint16_t sequence = frame->sequence();
+        frame->clear();
+        frame->push_back(sequence >> 8);
+        frame->push_back(sequence & 0xFF);
+        frame->add_fcs();
+        frame->type(IoFrame::ACKMODE);
+        frame->source(IoFrame::ACK_DATA);
+
+        if (osMessagePut(ioEventQueueHandle, reinterpret_cast<uint32_t>(frame),
+            0) != osOK)
+        {
+            stats::count(stats::counters().ack_drops);
+            release(frame);
+        }
     }
 
     void send_delay() {
@@ -227,6 +290,20 @@ struct Encoder {
         send_raw(FLAG);
     }
 
+    /// Send the bits of a BEACON_DATA frame, which are already stuffed.
+    void send_stuffed(IoFrame* frame) {
+        uint16_t bits = Beacons::bits(frame);
+        auto it = frame->begin();
+        std::advance(it, Beacons::HEADER_SIZE);
+
+        uint8_t byte = 0;
+        for (uint16_t i = 0; i != bits; ++i) {
+            if ((i & 7) == 0) byte = *it++;
+            modulator_->send(nrzi_.encode(byte & 1));
+            byte >>= 1;
+        }
+    }
+
     // No bit stuffing for PREAMBLE and TAIL
     void send_raw(uint8_t byte) {
         for (size_t i = 0; i != 8; i++) {
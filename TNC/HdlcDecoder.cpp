@@ -4,6 +4,7 @@
 #include "HdlcDecoder.hpp"
 #include "GPIO.hpp"
 #include "Log.h"
+#include "Statistics.hpp"
 
 namespace mobilinkd { namespace tnc { namespace hdlc {
 
@@ -15,8 +16,12 @@ NewDecoder::optional_result_type NewDecoder::operator()(bool input, bool pll_loc
     if (status)
     {
         INFO("HDLC decode status = 0x%02x, bits = %d", int(status), int(report_bits));
+        if (status == STATUS_CRC_ERROR) stats::count(stats::counters().crc_errors);
         if (can_pass(status) and packet->size() > 2)
         {
+            if (status == STATUS_CRC_ERROR) {
+                stats::count(stats::counters().passall_frames);
+            }
             result = packet;
             packet = nullptr;
         } else {
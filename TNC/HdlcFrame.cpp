@@ -9,6 +9,19 @@ namespace mobilinkd { namespace tnc { namespace hdlc {
 
 FrameSegmentPool frameSegmentPool __attribute__((section(".bss2")));
 
+#ifdef KISS_NO_HEAP
+// Must follow frameSegmentPool, which it is added to when constructed.
+struct ExtraFrameSegments
+{
+    FrameSegmentPool::chunk_type segments[EXTRA_FRAME_SEGMENTS];
+
+    ExtraFrameSegments()
+    {
+        frameSegmentPool.add(segments, EXTRA_FRAME_SEGMENTS);
+    }
+} extraFrameSegments;
+#endif
+
 IoFramePool& ioFramePool() {
     static IoFramePool pool;
     return pool;
@@ -37,11 +37,11 @@ public:
 
     enum Type {
         DATA = 0, TX_DELAY, P_PERSIST, SLOT_TIME, TX_TAIL, DUPLEX, HARDWARE,
-        TEXT, LOG};
+        TEXT, LOG, ACKMODE = 0x0C};
 
     enum Source {
       RF_DATA = 0x00, SERIAL_DATA = 0x10, DIGI_DATA = 0x20,
-      FRAME_RETURN = 0xF0};
+      BEACON_DATA = 0x30, ACK_DATA = 0x40, FRAME_RETURN = 0xF0};
 
 private:
     data_type data_;
@@ -49,6 +49,8 @@ private:
     int fcs_{-2};
     bool complete_{false};
     uint8_t frame_type_{Type::DATA};
+    uint8_t sequence_[2]{0, 0};     // ACKMODE sequence number.
+    uint8_t sequence_size_{0};
 
 #ifndef EXCLUDE_CRC
     uint16_t compute_crc(iterator first) {
@@ -96,6 +98,7 @@ public:
         fcs_ = -2;
         complete_ = false;
         frame_type_ = 0;    // RF_DATA.
+        sequence_size_ = 0;
     }
 
     void assign(data_type& data) {
@@ -114,8 +117,31 @@ public:
     typename data_type::iterator begin() { return data_.begin(); }
     typename data_type::iterator end() { return data_.end(); }
 
+    /// The first segment of the frame data; see SegmentedBuffer::data().
+    uint8_t* data() { return data_.data(); }
+
+    /// Open a gap of len bytes at pos.  See SegmentedBuffer::insert().
+    bool insert(uint16_t pos, uint16_t len) { return data_.insert(pos, len); }
+
+    void truncate(uint16_t size) { data_.truncate(size); }
+
+    /**
+     * The sequence number sent with a KISS ACKMODE frame.  It is returned
+     * to the host, unchanged, when the frame has been transmitted.
+     */
+    uint16_t sequence() const {return (sequence_[0] << 8) | sequence_[1];}
+
+    /**
+     * Append a byte to the frame.  ACKMODE frames carry a two byte
+     * sequence number ahead of the AX.25 data.  These bytes are split
+     * off here so that the KISS decoders need not know about them.
+     */
     bool push_back(uint8_t value)
     {
+        if (type() == Type::ACKMODE and sequence_size_ != 2) {
+            sequence_[sequence_size_++] = value;
+            return true;
+        }
         return data_.push_back(value);
     }
 
@@ -189,8 +215,21 @@ typedef buffer::Pool<48> FrameSegmentPool;  // 12K buffer of frames;
 
 extern FrameSegmentPool frameSegmentPool;
 
+#ifdef KISS_NO_HEAP
+// Nothing is allocated from the heap in this build.  The configTOTAL_HEAP_SIZE
+// bytes it would have used hold more frames, about 2.4kB, and with the rest,
+// more ADC blocks (audio::EXTRA_ADC_BLOCKS).  SRAM2 is full, so the extra
+// segments are added to frameSegmentPool from SRAM1.
+constexpr uint16_t EXTRA_IO_FRAMES = 8;
+constexpr uint16_t EXTRA_FRAME_SEGMENTS = 8;
+#else
+constexpr uint16_t EXTRA_IO_FRAMES = 0;
+constexpr uint16_t EXTRA_FRAME_SEGMENTS = 0;
+#endif
+constexpr uint16_t IO_FRAME_COUNT = 48 + EXTRA_IO_FRAMES;
+
 typedef Frame<FrameSegmentPool, &frameSegmentPool> IoFrame;
-typedef FramePool<IoFrame, 48> IoFramePool;
+typedef FramePool<IoFrame, IO_FRAME_COUNT> IoFramePool;
 
 IoFramePool& ioFramePool(void);
 
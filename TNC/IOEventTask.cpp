@@ -18,6 +18,10 @@
 #include "NullPort.hpp"
 #include "LEDIndicator.h"
 #include "bm78.h"
+#include "Statistics.hpp"
+#include "EventLog.hpp"
+#include "Digipeater.hpp"
+#include "Beacon.hpp"
 
 #include "stm32l4xx_hal.h"
 #include "usbd_cdc_if.h"
@@ -40,6 +44,28 @@ static PTT getPttStyle(const mobilinkd::tnc::kiss::Hardware& hardware)
     return hardware.options & KISS_OPTION_PTT_SIMPLEX ? PTT::SIMPLEX : PTT::MULTIPLEX;
 }
 
+/**
+ * The audio state when no host is connected.  A digipeater keeps listening,
+ * as do beacons, for carrier detect.
+ */
+static mobilinkd::tnc::audio::AdcState idle_state()
+{
+    using namespace mobilinkd::tnc;
+    return digipeater().enabled() or beacons().enabled()
+        ? audio::DEMODULATOR : audio::IDLE;
+}
+
+/**
+ * Finish any pending EEPROM write, then shut down.  The flush is done here
+ * rather than in shutdown(), which also runs from the timer task, where
+ * waiting for the EEPROM would stall the other timers.
+ */
+static void flushAndShutdown()
+{
+    flushSettings();
+    shutdown(0);
+}
+
 void startIOEventTask(void const*)
 {
     using namespace mobilinkd::tnc;
@@ -64,13 +90,17 @@ void startIOEventTask(void const*)
 
     osMutexRelease(hardwareInitMutexHandle);
 
-    if (!go_back_to_sleep) {
+    digipeater().configure(hardware);
+    beacons().configure(hardware);
 
-        hardware.debug();
+    if (!go_back_to_sleep) {
 
-        audio::init_log_volume();
+        // Use the cached virtual ground rather than measuring the input,
+        // unless the settings were reset.
         audio::setAudioOutputLevel();
-        audio::setAudioInputLevels();
+        if (reset_requested or !audio::restoreAudioInputLevels()) {
+            audio::configureInputLevels();
+        }
         setPtt(getPttStyle(hardware));
 
         // Cannot enable these interrupts until we start the io loop because
@@ -99,14 +129,23 @@ void startIOEventTask(void const*)
         {
             indicate_waiting_to_connect();
         }
+
+        INFO("Audio ready %lums after boot", HAL_GetTick());
+        hardware.debug();
+
+        // A digipeater or beacon does not need a host.
+        if (idle_state() == audio::DEMODULATOR) {
+            audio::post(audio::DEMODULATOR, osWaitForever);
+        }
     } else {
         if (!usb_wake_state) {
             DEBUG("USB disconnected -- shutdown");
-            shutdown(0);
+            flushAndShutdown();
         } else {
             DEBUG("USB connected -- negotiate");
             HAL_GPIO_WritePin(BT_SLEEP_GPIO_Port, BT_SLEEP_Pin,
                 GPIO_PIN_RESET);
+            flushSettings();    // The timer calls shutdown() directly.
             osTimerStart(usbShutdownTimerHandle, 5000);
         }
     }
@@ -124,6 +163,8 @@ void startIOEventTask(void const*)
         if (evt.status != osEventMessage)
             continue;
 
+        stats::high_water(stats::counters().io_event_hwm, ioEventQueueHandle);
+
         uint32_t cmd = evt.value.v;
         if (cmd < FLASH_BASE) // Assumes FLASH_BASE < SRAM_BASE.
         {
@@ -139,7 +180,7 @@ void startIOEventTask(void const*)
                         GPIO_PIN_RESET);
                     INFO("CDC Opened");
                     indicate_connected_via_usb();
-                    osMessagePut(audioInputQueueHandle,
+                    audio::post(
                         audio::DEMODULATOR, osWaitForever);
                 }
                 break;
@@ -147,7 +188,7 @@ void startIOEventTask(void const*)
                 INFO("VBUS Lost");
                 charging_enabled = 0;
                 if (powerOffViaUSB()) {
-                    shutdown(0); // ***NO RETURN***
+                    flushAndShutdown(); // ***NO RETURN***
                 } else {
                     hpcd_USB_FS.Instance->BCDR = 0;
                     HAL_PCD_MspDeInit(&hpcd_USB_FS);
@@ -162,10 +203,9 @@ void startIOEventTask(void const*)
             case CMD_USB_CDC_DISCONNECT:
                 if (cdc_connected) {
                     cdc_connected = false;
-                    osMessagePut(audioInputQueueHandle, audio::IDLE,
-                        osWaitForever);
                     kiss::getAFSKTestTone().stop();
                     closeCDC();
+                    audio::post(idle_state(), osWaitForever);
                     INFO("CDC Closed");
 
                     // Enable Bluetooth Module
@@ -183,7 +223,7 @@ void startIOEventTask(void const*)
                 INFO("Power Down");
                 power_button_counter = osKernelSysTick();
                 HAL_GPIO_WritePin(VDD_EN_GPIO_Port, VDD_EN_Pin, GPIO_PIN_SET);
-                osMessagePut(audioInputQueueHandle, audio::IDLE,
+                audio::post(audio::IDLE,
                     osWaitForever);
                 break;
             case CMD_POWER_BUTTON_UP:
@@ -191,7 +231,7 @@ void startIOEventTask(void const*)
                 if (power_button_counter == 0) break; // reset_requested
                 power_button_duration = osKernelSysTick() - power_button_counter;
                 DEBUG("Button pressed for %lums", power_button_duration);
-                shutdown(0); // ***NO RETURN***
+                flushAndShutdown(); // ***NO RETURN***
                 break;
             case CMD_BOOT_BUTTON_DOWN:
                 DEBUG("BOOT Down");
@@ -201,30 +241,30 @@ void startIOEventTask(void const*)
                 // standard USB port and not just a charging port.
                 if (gpio::USB_POWER::get() and ioport == getNullPort())
                 {
+                    flushSettings();
                     HAL_NVIC_SystemReset();
                 }
                 break;
             case CMD_BOOT_BUTTON_UP:
                 DEBUG("BOOT Up");
-                osMessagePut(audioInputQueueHandle,
+                audio::post(
                     audio::AUTO_ADJUST_INPUT_LEVEL,
                     osWaitForever);
                 if (ioport != getNullPort())
                 {
-                    osMessagePut(audioInputQueueHandle,
+                    audio::post(
                         audio::DEMODULATOR, osWaitForever);
                 }
                 else
                 {
-                    osMessagePut(audioInputQueueHandle,
-                        audio::IDLE, osWaitForever);
+                    audio::post(idle_state(), osWaitForever);
                 }
                 break;
             case CMD_BT_CONNECT:
                 DEBUG("BT Connect");
                 if (openSerial())
                 {
-                    osMessagePut(audioInputQueueHandle,
+                    audio::post(
                         audio::DEMODULATOR, osWaitForever);
                     INFO("BT Opened");
                     indicate_connected_via_ble();
@@ -236,8 +276,7 @@ void startIOEventTask(void const*)
                 closeSerial();
                 indicate_waiting_to_connect();
                 HAL_PCD_EP_ClrStall(&hpcd_USB_FS, CDC_CMD_EP);
-                osMessagePut(audioInputQueueHandle, audio::IDLE,
-                    osWaitForever);
+                audio::post(idle_state(), osWaitForever);
                 kiss::getAFSKTestTone().stop();
                 INFO("BT Closed");
                 break;
@@ -249,11 +288,11 @@ void startIOEventTask(void const*)
                 break;
             case CMD_SHUTDOWN:
                 INFO("STOP mode");
-                shutdown(0);
+                flushAndShutdown();
                 INFO("RUN mode");
                 HAL_GPIO_WritePin(BT_SLEEP_GPIO_Port, BT_SLEEP_Pin, GPIO_PIN_SET);
                 audio::setAudioOutputLevel();
-                audio::setAudioInputLevels();
+                audio::configureInputLevels();
                 bm78_wait_until_ready();
 
                 HAL_NVIC_SetPriority(EXTI4_IRQn, 5, 0);
@@ -285,7 +324,7 @@ void startIOEventTask(void const*)
                 INFO("USB charging enabled");
                 HAL_GPIO_WritePin(USB_CE_GPIO_Port, USB_CE_Pin, GPIO_PIN_RESET);
                 charging_enabled = 1;
-                if (go_back_to_sleep) shutdown(0);
+                if (go_back_to_sleep) flushAndShutdown();
                 break;
             case CMD_USB_DISCOVERY_COMPLETE:
                 INFO("USB discovery complete");
@@ -304,7 +343,7 @@ void startIOEventTask(void const*)
                     HAL_GPIO_WritePin(USB_CE_GPIO_Port, USB_CE_Pin, GPIO_PIN_RESET);
                     charging_enabled = 1;
                 }
-                if (go_back_to_sleep) shutdown(0);
+                if (go_back_to_sleep) flushAndShutdown();
                 break;
             case CMD_BT_DEEP_SLEEP:
                 INFO("BT deep sleep");
@@ -324,6 +363,18 @@ void startIOEventTask(void const*)
             case CMD_USB_RESUME:
                 INFO("USB resume");
                 break;
+            case CMD_PUSH_COUNTERS:
+                kiss::settings().get_counters();
+                break;
+            case CMD_DIGI_PENDING:
+                digipeater().expire();
+                break;
+            case CMD_EVENT_LOG:
+                eventlog::send_next();
+                break;
+            case CMD_SETTINGS_COMMITTED:
+                kiss::settings().settings_committed();
+                break;
             default:
                 WARN("unknown command = %04x", static_cast<unsigned int>(cmd));
                 break;
@@ -334,10 +385,13 @@ void startIOEventTask(void const*)
         using hdlc::IoFrame;
 
         auto frame = static_cast<IoFrame*>(evt.value.p);
+        stats::frame_pool_low_water();
 
         switch (frame->source()) {
         case IoFrame::RF_DATA:
             DEBUG("RF frame");
+            // Without a host the received frame itself is repeated.
+            if (digipeater()(frame, ioport != getNullPort())) break;
             if (!ioport->write(frame, 100))
             {
                 ERROR("Timed out sending frame");
@@ -345,9 +399,15 @@ void startIOEventTask(void const*)
                 // hdlc::release(frame);
             }
             break;
+        case IoFrame::ACK_DATA:
+            DEBUG("ACK frame");
+            // The ACKMODE reply for a transmitted frame; not from RF.
+            ioport->write(frame, 100);
+            break;
         case IoFrame::SERIAL_DATA:
             DEBUG("Serial frame");
-            if ((frame->type() & 0x0F) == IoFrame::DATA)
+            if ((frame->type() & 0x0F) == IoFrame::DATA
+                or (frame->type() & 0x0F) == IoFrame::ACKMODE)
             {
             	kiss::getAFSKTestTone().stop();
                 if (osMessagePut(hdlcOutputQueueHandle,
@@ -0,0 +1,72 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "InputAgc.hpp"
+#include "AudioLevel.hpp"
+#include "KissHardware.hpp"
+#include "Log.h"
+
+#include "cmsis_os.h"
+
+#include <algorithm>
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+InputAgc& agc()
+{
+    static InputAgc instance;
+    return instance;
+}
+
+void InputAgc::reset()
+{
+    pending_ = 0;
+    quiet_ = 0;
+    measure_vgnd_ = false;
+}
+
+void InputAgc::operator()(const levels_type& levels, bool dcd)
+{
+    if (!(kiss::settings().options & KISS_OPTION_INPUT_AGC)) return;
+
+    uint16_t vpp, vavg, vmin, vmax;
+    std::tie(vpp, vavg, vmin, vmax) = levels;
+
+    if (measure_vgnd_ and !dcd) {
+        set_virtual_ground(vavg);
+        measure_vgnd_ = false;
+    }
+
+    int32_t vgnd = virtual_ground;
+    int32_t headroom = std::min<int32_t>(vgnd, adc_full_scale() - vgnd);
+    int32_t peak = std::max<int32_t>(vmax - vgnd, vgnd - vmin);
+
+    if (peak >= headroom - headroom / 16) {
+        pending_ = -1;
+        quiet_ = 0;
+    } else if (peak < headroom / 32) {
+        // Silence.
+    } else if (peak * 4 < headroom) {
+        if (++quiet_ >= RAISE_WINDOWS) pending_ = 1;
+    } else {
+        quiet_ = 0;
+        pending_ = std::min(pending_, 0);
+    }
+
+    if (dcd or pending_ == 0) return;
+
+    uint32_t now = osKernelSysTick();
+    if (now - last_change_ < HOLD) return;
+
+    int gain = input_gain() + pending_;
+    pending_ = 0;
+    quiet_ = 0;
+    if (gain < 0 or gain > 4) return;
+
+    INFO("AGC: input gain %d (peak %ld of %ld)", gain, peak, headroom);
+    step_input_gain(gain);
+    last_change_ = now;
+    measure_vgnd_ = true;
+}
+
+}}} // mobilinkd::tnc::audio
@@ -0,0 +1,48 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "AudioInput.hpp"
+
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+/**
+ * Input AGC, enabled by KISS_OPTION_INPUT_AGC.  It follows changes in
+ * the radio's volume by stepping the PGA gain between packets.
+ *
+ * Each input monitor level window, including those taken during packets,
+ * is compared with the headroom around the virtual ground.  A window
+ * within 1/16 of clipping asks for the gain to be lowered; RAISE_WINDOWS
+ * windows in a row that would still be under half scale at twice the
+ * gain ask for it to be raised.  Silent windows (a closed squelch) are
+ * ignored.  Changes are made only while DCD is off and at most once per
+ * HOLD ms, with step_input_gain().  The virtual ground is re-measured
+ * on the next window with DCD off.
+ *
+ * The stored input gain is not changed; it is the starting point after
+ * the input levels are configured.
+ */
+class InputAgc
+{
+public:
+    static constexpr uint32_t RAISE_WINDOWS = 10;
+    static constexpr uint32_t HOLD = 1000;          // ms.
+
+    void reset();
+
+    /// Add a completed level window.
+    void operator()(const levels_type& levels, bool dcd);
+
+private:
+    int pending_{0};            ///< -1 to lower the gain, +1 to raise it.
+    uint32_t quiet_{0};
+    uint32_t last_change_{0};
+    bool measure_vgnd_{false};
+};
+
+InputAgc& agc();
+
+}}} // mobilinkd::tnc::audio
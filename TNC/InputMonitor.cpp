@@ -0,0 +1,148 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "InputMonitor.hpp"
+#include "AudioLevel.hpp"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+namespace {
+
+float goertzel_coeff(float freq, uint32_t sample_rate, uint32_t block_size)
+{
+    // Same bin as GoertzelFilter.
+    int bin = 0.5f + (freq * block_size) / sample_rate;
+    return 2.0f * cosf((2.0f * M_PI * bin) / float(block_size));
+}
+
+// A silent input has no energy at the tones.  Clamping to this floor
+// keeps log10f() finite and the result within int16_t.
+constexpr float MIN_TONE_ENERGY = 1e-6f;     // -60dB.
+constexpr float MAX_DB = 127.0f;
+
+int16_t to_db(float energy)
+{
+    energy = std::max(energy / InputMonitor::TWIST_BLOCKS, MIN_TONE_ENERGY);
+    return int16_t(std::min(10.0f * log10f(energy), MAX_DB) * 256);
+}
+
+} // namespace
+
+InputMonitor& monitor()
+{
+    static InputMonitor instance;
+    return instance;
+}
+
+void InputMonitor::start(float mark, float space, uint32_t sample_rate,
+    uint32_t block_size, uint32_t stride)
+{
+    running_ = false;
+    levels_ready_ = false;
+    twist_ready_ = false;
+
+    vmin_ = std::numeric_limits<uint16_t>::max();
+    vmax_ = std::numeric_limits<uint16_t>::min();
+    accum_ = 0;
+    level_count_ = 0;
+
+    mark_ = Tone{goertzel_coeff(mark, sample_rate, block_size), 0.0f};
+    space_ = Tone{goertzel_coeff(space, sample_rate, block_size), 0.0f};
+    stride_ = stride;
+    block_count_ = 0;
+    twist_count_ = 0;
+
+    running_ = true;
+}
+
+bool InputMonitor::operator()(const uint16_t* samples, uint32_t len)
+{
+    if (++block_count_ == stride_) {
+        block_count_ = 0;
+        measure(samples, len);
+    }
+
+    auto end = samples + len;
+    vmin_ = std::min(vmin_, *std::min_element(samples, end));
+    vmax_ = std::max(vmax_, *std::max_element(samples, end));
+    accum_ = std::accumulate(samples, end, accum_);
+
+    if (++level_count_ != LEVEL_BLOCKS) return false;
+
+    levels_type levels(vmax_ - vmin_, accum_ / (len * LEVEL_BLOCKS), vmin_, vmax_);
+
+    taskENTER_CRITICAL();
+    levels_ = levels;
+    taskEXIT_CRITICAL();
+    levels_ready_ = true;
+
+    vmin_ = std::numeric_limits<uint16_t>::max();
+    vmax_ = std::numeric_limits<uint16_t>::min();
+    accum_ = 0;
+    level_count_ = 0;
+
+    return true;
+}
+
+/**
+ * Run both tone filters over one block.  The energy is normalized by the
+ * block size, as in the demodulators' readTwist().
+ */
+void InputMonitor::measure(const uint16_t* samples, uint32_t len)
+{
+    float m1 = 0.0f, m2 = 0.0f;
+    float s1 = 0.0f, s2 = 0.0f;
+
+    for (uint32_t i = 0; i != len; ++i)
+    {
+        float sample = (float(samples[i]) - virtual_ground) * i_vgnd;
+        float m0 = sample + mark_.coeff * m1 - m2;
+        m2 = m1;
+        m1 = m0;
+        float s0 = sample + space_.coeff * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+
+    mark_.energy += (m1 * m1 + m2 * m2 - mark_.coeff * m1 * m2) / len;
+    space_.energy += (s1 * s1 + s2 * s2 - space_.coeff * s1 * s2) / len;
+
+    if (++twist_count_ != TWIST_BLOCKS) return;
+
+    Twist twist{to_db(mark_.energy), to_db(space_.energy)};
+
+    taskENTER_CRITICAL();
+    twist_ = twist;
+    taskEXIT_CRITICAL();
+    twist_ready_ = true;
+
+    mark_.energy = 0.0f;
+    space_.energy = 0.0f;
+    twist_count_ = 0;
+}
+
+levels_type InputMonitor::levels() const
+{
+    taskENTER_CRITICAL();
+    auto result = levels_;
+    taskEXIT_CRITICAL();
+    return result;
+}
+
+InputMonitor::Twist InputMonitor::twist() const
+{
+    taskENTER_CRITICAL();
+    auto result = twist_;
+    taskEXIT_CRITICAL();
+    return result;
+}
+
+}}} // mobilinkd::tnc::audio
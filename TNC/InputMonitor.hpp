@@ -0,0 +1,101 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "AudioInput.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace audio {
+
+/**
+ * Input levels and twist measured on the ADC blocks that the demodulator
+ * already receives, so that the host can poll or stream them without
+ * stopping reception.
+ *
+ * Levels (Vpp, Vavg, Vmin, Vmax) are taken over LEVEL_BLOCKS blocks, as
+ * readLevels() does.  Twist is the energy at the modem's two tones, from
+ * a Goertzel filter run over every stride'th block, averaged over
+ * TWIST_BLOCKS of them.  Each result is published when its window is
+ * complete, so readers always see a whole window.
+ *
+ * The monitor is updated by the audio input task and may be read from
+ * any task.
+ */
+class InputMonitor
+{
+public:
+    static constexpr uint32_t LEVEL_BLOCKS = 30;
+    static constexpr uint32_t TWIST_BLOCKS = 20;
+
+    /// Tone levels in dB * 256, as sent in POLL_INPUT_TWIST.
+    struct Twist
+    {
+        int16_t mark;
+        int16_t space;
+    };
+
+    /**
+     * Set the tones and block size of the demodulator about to start and
+     * discard any previous results.
+     *
+     * @param stride is the number of blocks per twist measurement.
+     */
+    void start(float mark, float space, uint32_t sample_rate,
+        uint32_t block_size, uint32_t stride);
+
+    /// The demodulator has stopped; results are no longer current.
+    void stop() { running_ = false; }
+
+    /**
+     * Add a block of raw ADC samples.
+     *
+     * @return true if this block completed a level window.
+     */
+    bool operator()(const uint16_t* samples, uint32_t len);
+
+    /// The demodulator is running and a level window is complete.
+    bool levels_ready() const { return running_ and levels_ready_; }
+
+    /// The demodulator is running and a twist window is complete.
+    bool twist_ready() const { return running_ and twist_ready_; }
+
+    levels_type levels() const;
+    Twist twist() const;
+
+private:
+
+    struct Tone
+    {
+        float coeff{0.0f};
+        float energy{0.0f};     ///< Sum over the current window.
+    };
+
+    void measure(const uint16_t* samples, uint32_t len);
+
+    // Level window.
+    uint16_t vmin_{0};
+    uint16_t vmax_{0};
+    uint32_t accum_{0};
+    uint32_t level_count_{0};
+
+    // Twist window.
+    Tone mark_;
+    Tone space_;
+    uint32_t stride_{1};
+    uint32_t block_count_{0};
+    uint32_t twist_count_{0};
+
+    // Published results.
+    levels_type levels_{0, 0, 0, 0};
+    Twist twist_{0, 0};
+    std::atomic<bool> running_{false};
+    std::atomic<bool> levels_ready_{false};
+    std::atomic<bool> twist_ready_{false};
+};
+
+InputMonitor& monitor();
+
+}}} // mobilinkd::tnc::audio
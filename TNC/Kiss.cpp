@@ -5,6 +5,7 @@
 #include "Kiss.hpp"
 #include "KissHardware.hpp"
 #include "ModulatorTask.hpp"
+#include "EventLog.hpp"
 
 // extern osMessageQId hdlcOutputQueueHandle;
 
@@ -60,7 +61,7 @@ void handle_frame(uint8_t frame_type, hdlc::IoFrame* frame) {
     case kiss::FRAME_LOG:
         DEBUG("FRAME_LOG");
         hdlc::release(frame);
-        // IGNORE
+        eventlog::handle_request(value);
         break;
     case kiss::FRAME_RETURN:
         DEBUG("FRAME_RETURN");
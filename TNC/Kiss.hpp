@@ -20,6 +20,7 @@ const uint8_t FRAME_TX_TAIL = 0x04;
 const uint8_t FRAME_DUPLEX = 0x05;
 const uint8_t FRAME_HARDWARE = 0x06;
 const uint8_t FRAME_LOG = 0x07;
+const uint8_t FRAME_ACKMODE = 0x0C;
 const uint8_t FRAME_RETURN = 0xFF;
 
 void handle_frame(uint8_t frame_type, hdlc::IoFrame* frame) __attribute__((optimize("-Os")));
@@ -9,6 +9,11 @@
 #include "ModulatorTask.hpp"
 #include "Modulator.hpp"
 #include "HDLCEncoder.hpp"
+#include "Loopback.hpp"
+#include "Statistics.hpp"
+#include "SettingsWriter.hpp"
+#include "Digipeater.hpp"
+#include "Beacon.hpp"
 
 #include <memory>
 #include <array>
@@ -148,23 +153,486 @@ void ext_reply(const std::array<uint8_t, M>& cmd, const std::array<uint8_t, N>&
     ioport->write(data.data(), M + N, 6, osWaitForever);
 }
 
+void Hardware::get_aliases() {
+    ext_reply(hardware::EXT_GET_ALIASES, uint8_t(NUMBER_OF_ALIASES));
+}
+
 void Hardware::get_alias(uint8_t alias) {
-    uint8_t result[14];
-    if (alias >= NUMBER_OF_ALIASES or not aliases[alias].set) return;
+    std::array<uint8_t, 14> result;
+    if (alias >= NUMBER_OF_ALIASES) return;
     result[0] = alias;
-    memcpy(result + 1, aliases[alias].call, CALLSIGN_LEN);
+    memcpy(result.data() + 1, aliases[alias].call, CALLSIGN_LEN);
     result[9] = aliases[alias].set;
     result[10] = aliases[alias].use;
     result[11] = aliases[alias].insert_id;
     result[12] = aliases[alias].preempt;
     result[13] = aliases[alias].hops;
-    reply_ext(hardware::EXT_GET_ALIASES, result, 14);
+    ext_reply(hardware::EXT_GET_ALIAS, result);
+}
+
+/**
+ * Set an alias.  The frame contains the two extended command bytes, then
+ * the fields returned by get_alias().  The digipeater is updated and the
+ * alias is returned.
+ */
+void Hardware::set_alias(hdlc::IoFrame* frame) {
+    if (frame->size() != 16) {
+        ERROR("Invalid alias length %d", int(frame->size()));
+        return;
+    }
+
+    auto it = frame->begin();
+    std::advance(it, 2);
+    uint8_t index = *it++;
+    if (index >= NUMBER_OF_ALIASES) return;
+
+    auto& alias = aliases[index];
+    for (auto& c : alias.call) c = *it++;
+    alias.set = *it++;
+    alias.use = *it++;
+    alias.insert_id = *it++;
+    alias.preempt = *it++;
+    alias.hops = *it;
+    update_crc();
+
+    digipeater().configure(*this);
+    get_alias(index);
+}
+
+/// Set MYCALL from up to CALLSIGN_LEN characters after the command bytes.
+void Hardware::set_mycall(hdlc::IoFrame* frame) {
+    auto it = frame->begin();
+    std::advance(it, 2);
+    size_t len = std::min<size_t>(frame->size() - 2, CALLSIGN_LEN);
+
+    memset(mycall, 0, sizeof(mycall));
+    for (size_t i = 0; i != len; ++i) mycall[i] = *it++;
+    update_crc();
+
+    digipeater().configure(*this);
+    tnc::beacons().configure(*this);
+}
+
+void Hardware::get_beacon(uint8_t index) {
+    if (index >= NUMBER_OF_BEACONS) return;
+    auto& beacon = beacons[index];
+
+    std::array<uint8_t, 5 + CALLSIGN_LEN + BEACON_PATH_LEN + BEACON_TEXT_LEN + 3> data;
+    auto it = std::copy(hardware::EXT_GET_BEACON.begin(),
+        hardware::EXT_GET_BEACON.end(), data.begin());
+    *it++ = index;
+    *it++ = beacon.seconds >> 8;
+    *it++ = beacon.seconds & 0xFF;
+    it = std::copy(beacon.dest, std::find(beacon.dest, beacon.dest + CALLSIGN_LEN, 0), it);
+    *it++ = 0;
+    it = std::copy(beacon.path, std::find(beacon.path, beacon.path + BEACON_PATH_LEN, 0), it);
+    *it++ = 0;
+    it = std::copy(beacon.text, std::find(beacon.text, beacon.text + BEACON_TEXT_LEN, 0), it);
+    *it++ = 0;
+
+    ioport->write(data.data(), it - data.begin(), 6, osWaitForever);
+}
+
+/**
+ * Set a beacon.  The frame contains the two extended command bytes, then
+ * the fields returned by get_beacon().  Missing strings are empty.  The
+ * beacons are rebuilt and the beacon is returned.
+ */
+void Hardware::set_beacon(hdlc::IoFrame* frame) {
+    if (frame->size() < 5) {
+        ERROR("Invalid beacon length %d", int(frame->size()));
+        return;
+    }
+
+    auto it = frame->begin();
+    auto last = frame->end();
+    std::advance(it, 2);
+    uint8_t index = *it++;
+    if (index >= NUMBER_OF_BEACONS) return;
+
+    auto& beacon = beacons[index];
+    beacon.seconds = *it++ << 8;
+    beacon.seconds |= *it++;
+
+    // Copy a NUL terminated string, truncating it to fit.
+    auto copy = [&it, &last](uint8_t* dest, size_t len) {
+        memset(dest, 0, len);
+        for (size_t i = 0; it != last and *it != 0; ++it) {
+            if (i != len) dest[i++] = *it;
+        }
+        if (it != last) ++it;
+    };
+
+    copy(beacon.dest, CALLSIGN_LEN);
+    copy(beacon.path, BEACON_PATH_LEN);
+    copy(beacon.text, BEACON_TEXT_LEN);
+    update_crc();
+
+    tnc::beacons().configure(*this);
+    get_beacon(index);
+}
+
+/**
+ * Enable or disable software RF loopback.  The frame contains the two
+ * extended command bytes, the enable flag, and optionally the noise level
+ * (big-endian uint16_t) and twist (int8_t).
+ *
+ * The modulator and demodulator are re-initialized so that the PTT
+ * selection and the virtual ground level reflect the new input.
+ */
+void Hardware::set_loopback(hdlc::IoFrame* frame) {
+    auto& loop = loopback::loopback();
+
+    auto it = frame->begin();
+    std::advance(it, 2);
+    auto size = frame->size();
+
+    if (size < 3) return;
+
+    bool enabled = *it++;
+    uint16_t noise = 0;
+    int8_t twist = 0;
+
+    if (size >= 5) {
+        noise = *it++ << 8;
+        noise |= *it++;
+    }
+    if (size >= 6) {
+        twist = *it;
+    }
+
+    if (enabled) {
+        INFO("Loopback enabled (noise = %hu, twist = %hd)", noise, twist);
+        loop.enable(noise, twist);
+    } else {
+        INFO("Loopback disabled");
+        loop.disable();
+    }
+
+    audio::post(audio::UPDATE_SETTINGS,
+        osWaitForever);
+    audio::post(audio::DEMODULATOR,
+        osWaitForever);
+}
+
+void Hardware::get_loopback() {
+    auto& loop = loopback::loopback();
+    std::array<uint8_t, 4> result = {
+        uint8_t(loop.enabled()),
+        uint8_t(loop.noise() >> 8), uint8_t(loop.noise() & 0xFF),
+        uint8_t(loop.twist())
+    };
+    ext_reply(hardware::EXT_GET_LOOPBACK, result);
+}
+
+void Hardware::get_loopback_stats() {
+    auto const& stats = loopback::loopback().stats();
+
+    uint32_t latency_avg = stats.received ? stats.latency_sum / stats.received : 0;
+    uint32_t latency_min = stats.received ? stats.latency_min : 0;
+    uint32_t rate = stats.elapsed ?
+        (uint64_t(stats.received) * 100000) / stats.elapsed : 0;
+
+    const uint32_t values[] = {
+        stats.transmitted, stats.received, stats.elapsed,
+        latency_min, latency_avg, stats.latency_max, rate
+    };
+
+    std::array<uint8_t, sizeof(values)> result;
+    auto out = result.begin();
+    for (auto value : values) {
+        *out++ = (value >> 24) & 0xFF;
+        *out++ = (value >> 16) & 0xFF;
+        *out++ = (value >> 8) & 0xFF;
+        *out++ = value & 0xFF;
+    }
+    ext_reply(hardware::EXT_GET_LOOPBACK_STATS, result);
+}
+
+
+void Hardware::get_counters() {
+    ext_reply(hardware::EXT_GET_COUNTERS, stats::counters().record());
+}
+
+namespace {
+
+/// Builds TLV records for EXT_GET_ALL_VALUES.
+struct TlvBuffer
+{
+    uint8_t* begin_;
+    uint8_t* pos_;
+    uint8_t* end_;
+
+    template <size_t N>
+    TlvBuffer(std::array<uint8_t, N>& buffer)
+    : begin_(buffer.data()), pos_(begin_), end_(begin_ + N)
+    {}
+
+    template <size_t N>
+    void header(const std::array<uint8_t, N>& cmd, uint8_t version)
+    {
+        pos_ = std::copy(cmd.begin(), cmd.end(), begin_);
+        *pos_++ = version;
+    }
+
+    void put(uint8_t tag, const uint8_t* value, size_t len)
+    {
+        if (len > 255 or size_t(end_ - pos_) < len + 2) {
+            ERROR("TLV %02x does not fit", tag);
+            return;
+        }
+        *pos_++ = tag;
+        *pos_++ = len;
+        pos_ = std::copy(value, value + len, pos_);
+    }
+
+    void put8(uint8_t tag, uint8_t value)
+    {
+        put(tag, &value, 1);
+    }
+
+    void put16(uint8_t tag, uint16_t value)
+    {
+        uint8_t data[2] = {uint8_t(value >> 8), uint8_t(value & 0xFF)};
+        put(tag, data, 2);
+    }
+
+    size_t size() const { return pos_ - begin_; }
+};
+
+/// Side effects of changing a setting, which are applied once per batch.
+enum Effect : uint8_t {
+    EFFECT_NONE = 0,
+    EFFECT_OUTPUT_LEVEL = 1,
+    EFFECT_MODULATOR = 2,
+    EFFECT_AUDIO_INPUT = 4,     // Includes the modulator.
+    EFFECT_PTT = 8,
+    EFFECT_MODEM = 16,          // Includes the modulator.
+    EFFECT_DIGIPEATER = 32,
+    EFFECT_INVALID = 0x80
+};
+
+void set_option(Hardware* target, uint16_t option, bool value)
+{
+    if (!target) return;
+    if (value) target->options |= option;
+    else target->options &= ~option;
+}
+
+/**
+ * Validate one EXT_SET_VALUES record and, if target is not null, apply it.
+ *
+ * @return the side effects of the change, or EFFECT_INVALID.
+ */
+uint8_t apply_value(Hardware* target, uint8_t tag, const uint8_t* value, uint8_t len)
+{
+    uint8_t expected = (tag == hardware::SET_OUTPUT_GAIN or
+        tag == hardware::SET_INPUT_GAIN) ? 2 : 1;
+    if (len != expected) return EFFECT_INVALID;
+
+    uint16_t value16 = len == 2 ? (value[0] << 8) | value[1] : value[0];
+
+    switch (tag) {
+    case hardware::SET_OUTPUT_GAIN:
+        if (target) target->output_gain = value16;
+        return EFFECT_OUTPUT_LEVEL;
+    case hardware::SET_INPUT_GAIN:
+        if (value16 > 4) return EFFECT_INVALID;
+        if (target) target->input_gain = value16;
+        return EFFECT_AUDIO_INPUT;
+    case hardware::SET_INPUT_TWIST:
+        if (int8_t(value[0]) < -3 or int8_t(value[0]) > 9) return EFFECT_INVALID;
+        if (target) target->rx_twist = value[0];
+        return EFFECT_AUDIO_INPUT;
+    case hardware::SET_OUTPUT_TWIST:
+        if (target) target->tx_twist = std::min<uint8_t>(value[0], 100);
+        return EFFECT_MODULATOR;
+    case hardware::GET_TXDELAY:
+        if (target) target->txdelay = value[0];
+        return EFFECT_MODULATOR;
+    case hardware::GET_PERSIST:
+        if (target) target->ppersist = value[0];
+        return EFFECT_MODULATOR;
+    case hardware::GET_TIMESLOT:
+        if (target) target->slot = value[0];
+        return EFFECT_MODULATOR;
+    case hardware::GET_TXTAIL:
+        if (target) target->txtail = value[0];
+        return EFFECT_MODULATOR;
+    case hardware::GET_DUPLEX:
+        if (target) target->duplex = value[0];
+        return EFFECT_MODULATOR;
+    case hardware::SET_PTT_CHANNEL:
+        set_option(target, KISS_OPTION_PTT_SIMPLEX, !value[0]);
+        return EFFECT_PTT;
+    case hardware::SET_PASSALL:
+        set_option(target, KISS_OPTION_PASSALL, value[0]);
+        return EFFECT_AUDIO_INPUT;
+    case hardware::SET_USB_POWER_ON:
+        set_option(target, KISS_OPTION_VIN_POWER_ON, value[0]);
+        return EFFECT_NONE;
+    case hardware::EXT_SET_INPUT_AGC[1]:
+        set_option(target, KISS_OPTION_INPUT_AGC, value[0]);
+        return EFFECT_AUDIO_INPUT;
+    case hardware::EXT_SET_VISCOUS_DIGI[1]:
+        set_option(target, KISS_OPTION_VISCOUS_DIGI, value[0]);
+        return EFFECT_DIGIPEATER;
+    case hardware::SET_USB_POWER_OFF:
+        set_option(target, KISS_OPTION_VIN_POWER_OFF, value[0]);
+        return EFFECT_NONE;
+    case hardware::EXT_SET_MODEM_TYPE[1]:
+        if (value[0] != hardware::MODEM_TYPE_1200 and
+            value[0] != hardware::MODEM_TYPE_9600) return EFFECT_INVALID;
+        if (target) target->modem_type = value[0];
+        return EFFECT_MODEM;
+    default:
+        return EFFECT_INVALID;
+    }
+}
+
+} // namespace
+
+void Hardware::set_values(hdlc::IoFrame* frame) {
+    // Only used by the IO event task; too large for its stack.
+    static std::array<uint8_t, 332> data;
+
+    std::array<uint8_t, 3> result = {0, 0, 0};
+
+    size_t size = frame->size();
+    if (size < 3 or size > data.size()) {
+        ERROR("EXT_SET_VALUES: bad frame size %u", unsigned(size));
+        result[0] = 1;
+        ext_reply(hardware::EXT_SET_VALUES, result);
+        return;
+    }
+
+    std::copy_n(frame->begin(), size, data.begin());
+
+    uint8_t flags = data[2];
+    const uint8_t* begin = data.data() + 3;
+    const uint8_t* end = data.data() + size;
+
+    // Validate everything first; then apply.
+    uint8_t effects = 0;
+    uint8_t count = 0;
+    for (auto pos = begin; pos != end; pos += 2 + pos[1], ++count)
+    {
+        uint8_t effect = EFFECT_INVALID;
+        if (end - pos >= 2 and end - pos >= 2 + pos[1]) {
+            effect = apply_value(nullptr, pos[0], pos + 2, pos[1]);
+        }
+        if (effect == EFFECT_INVALID) {
+            ERROR("EXT_SET_VALUES: invalid record %d", int(count));
+            result = {1, pos[0], 0};
+            ext_reply(hardware::EXT_SET_VALUES, result);
+            return;
+        }
+        effects |= effect;
+    }
+
+    // Other tasks must not see a partial update.
+    vTaskSuspendAll();
+    for (auto pos = begin; pos != end; pos += 2 + pos[1]) {
+        apply_value(this, pos[0], pos + 2, pos[1]);
+    }
+    xTaskResumeAll();
+
+    update_crc();
+
+    INFO("EXT_SET_VALUES: %d records, effects = %02x", int(count), effects);
+
+    if (effects & EFFECT_OUTPUT_LEVEL) audio::setAudioOutputLevel();
+
+    // This runs in the IO event task, so set the PTT here rather than
+    // posting CMD_SET_PTT_* to our own queue.
+    if (effects & EFFECT_PTT) updatePtt();
+
+    if (effects & EFFECT_AUDIO_INPUT) {
+        // UPDATE_SETTINGS also updates the modulator.
+        audio::post(audio::UPDATE_SETTINGS, osWaitForever);
+        audio::post(audio::DEMODULATOR, osWaitForever);
+    } else if (effects & EFFECT_MODEM) {
+        // The input levels are kept across a modem switch.
+        audio::post(audio::SWITCH_MODEM, osWaitForever);
+        audio::post(audio::DEMODULATOR, osWaitForever);
+    } else if (effects & EFFECT_MODULATOR) {
+        updateModulator();
+    }
+
+    if (effects & EFFECT_DIGIPEATER) digipeater().configure(*this);
+
+    if (flags & hardware::SET_VALUES_SAVE) store();
+
+    result[2] = count;
+    ext_reply(hardware::EXT_SET_VALUES, result);
 }
 
-void Hardware::set_alias(const hdlc::IoFrame* frame) {
-  UNUSED(frame);
+void Hardware::get_all_values() {
+    // Only used by the IO event task; too large for its stack.
+    static std::array<uint8_t, 320> data;
+
+    TlvBuffer tlv(data);
+    tlv.header(hardware::EXT_GET_ALL_VALUES, hardware::ALL_VALUES_VERSION);
+
+    tlv.put16(hardware::GET_API_VERSION, hardware::KISS_API_VERSION);
+    tlv.put(hardware::GET_FIRMWARE_VERSION, (const uint8_t*) FIRMWARE_VERSION,
+        sizeof(FIRMWARE_VERSION) - 1);
+    tlv.put(hardware::GET_HARDWARE_VERSION, (const uint8_t*) HARDWARE_VERSION,
+        sizeof(HARDWARE_VERSION) - 1);
+    tlv.put(hardware::GET_SERIAL_NUMBER, (const uint8_t*) serial_number_64,
+        sizeof(serial_number_64) - 1);
+    tlv.put16(hardware::GET_BATTERY_LEVEL, audio::battery_level());
+    tlv.put8(hardware::GET_USB_POWER_OFF, options & KISS_OPTION_VIN_POWER_OFF ? 1 : 0);
+    tlv.put8(hardware::GET_USB_POWER_ON, options & KISS_OPTION_VIN_POWER_ON ? 1 : 0);
+    tlv.put16(hardware::GET_OUTPUT_GAIN, output_gain);
+    tlv.put8(hardware::GET_OUTPUT_TWIST, tx_twist);
+    tlv.put16(hardware::GET_INPUT_GAIN, input_gain);
+    tlv.put8(hardware::GET_INPUT_TWIST, rx_twist);
+    tlv.put8(hardware::GET_TXDELAY, txdelay);
+    tlv.put8(hardware::GET_PERSIST, ppersist);
+    tlv.put8(hardware::GET_TIMESLOT, slot);
+    tlv.put8(hardware::GET_TXTAIL, txtail);
+    tlv.put8(hardware::GET_DUPLEX, duplex);
+    tlv.put8(hardware::GET_PTT_CHANNEL,
+        options & KISS_OPTION_PTT_SIMPLEX ? 0 : 1);
+    tlv.put8(hardware::GET_PASSALL, options & KISS_OPTION_PASSALL ? 1 : 0);
+    tlv.put16(hardware::GET_CAPABILITIES,
+        hardware::CAP_EEPROM_SAVE|hardware::CAP_BATTERY_LEVEL|
+        hardware::CAP_ADJUST_INPUT|hardware::CAP_DFU_FIRMWARE|
+        hardware::CAP_ACKMODE);
+    tlv.put16(hardware::GET_MIN_INPUT_GAIN, 0);
+    tlv.put16(hardware::GET_MAX_INPUT_GAIN, 4);
+    tlv.put8(hardware::GET_MIN_INPUT_TWIST, -3);
+    tlv.put8(hardware::GET_MAX_INPUT_TWIST, 9);
+    tlv.put(hardware::GET_MAC_ADDRESS, mac_address, sizeof(mac_address));
+    tlv.put8(hardware::EXT_GET_MODEM_TYPE[1], modem_type);
+    tlv.put8(hardware::EXT_GET_INPUT_AGC[1], options & KISS_OPTION_INPUT_AGC ? 1 : 0);
+    tlv.put8(hardware::EXT_GET_VISCOUS_DIGI[1], options & KISS_OPTION_VISCOUS_DIGI ? 1 : 0);
+    tlv.put(hardware::EXT_GET_MODEM_TYPES[1], supported_modem_types.data(),
+        supported_modem_types.size());
+    if (*error_message) {
+        tlv.put(hardware::GET_ERROR_MSG, (const uint8_t*) error_message,
+            strnlen(error_message, sizeof(error_message)));
+    }
+    tlv.put(hardware::GET_DATETIME, get_rtc_datetime(), 7);
+
+    ioport->write(data.data(), tlv.size(), 6, osWaitForever);
+}
+
+void Hardware::settings_committed() {
+    auto result = settingsWriter().result();
+    std::array<uint8_t, 2> data = {result.status, result.pages};
+    ext_reply(hardware::EXT_SETTINGS_COMMITTED, data);
 }
 
+void Hardware::get_task_stats() {
+    constexpr auto N = hardware::EXT_GET_TASK_STATS.size();
+    std::array<uint8_t, N + stats::TaskStats::RECORD_SIZE> data;
+    std::copy(hardware::EXT_GET_TASK_STATS.begin(),
+        hardware::EXT_GET_TASK_STATS.end(), data.begin());
+    auto len = stats::task_stats().record(data.data() + N);
+    ioport->write(data.data(), N + len, 6, osWaitForever);
+}
 
 void Hardware::announce_input_settings()
 {
@@ -206,50 +674,52 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
     case hardware::POLL_INPUT_LEVEL:
         DEBUG("POLL_INPUT_VOLUME");
         reply8(hardware::POLL_INPUT_LEVEL, 0);
-        osMessagePut(audioInputQueueHandle, audio::POLL_AMPLIFIED_INPUT_LEVEL,
+        if (audio::sendInputLevels()) break;
+        audio::post(audio::POLL_AMPLIFIED_INPUT_LEVEL,
             osWaitForever);
-        osMessagePut(audioInputQueueHandle, audio::DEMODULATOR,
+        audio::post(audio::DEMODULATOR,
             osWaitForever);
         break;
     case hardware::STREAM_INPUT_LEVEL:
       DEBUG("STREAM_INPUT_VOLUME");
-      osMessagePut(audioInputQueueHandle, audio::STREAM_AMPLIFIED_INPUT_LEVEL,
+      audio::post(audio::STREAM_AMPLIFIED_INPUT_LEVEL,
           osWaitForever);
         break;
     case hardware::GET_BATTERY_LEVEL:
       DEBUG("GET_BATTERY_LEVEL");
-      osMessagePut(audioInputQueueHandle, audio::POLL_BATTERY_LEVEL,
+      if (audio::sendBatteryLevel()) break;
+      audio::post(audio::POLL_BATTERY_LEVEL,
           osWaitForever);
-      osMessagePut(audioInputQueueHandle, audio::DEMODULATOR,
+      audio::post(audio::DEMODULATOR,
           osWaitForever);
         break;
     case hardware::SEND_MARK:
         DEBUG("SEND_MARK");
-        osMessagePut(audioInputQueueHandle, audio::IDLE,
+        audio::post(audio::IDLE,
             osWaitForever);
         getAFSKTestTone().mark();
         break;
     case hardware::SEND_SPACE:
         DEBUG("SEND_SPACE");
-        osMessagePut(audioInputQueueHandle, audio::IDLE,
+        audio::post(audio::IDLE,
             osWaitForever);
         getAFSKTestTone().space();
         break;
     case hardware::SEND_BOTH:
         DEBUG("SEND_BOTH");
-        osMessagePut(audioInputQueueHandle, audio::IDLE,
+        audio::post(audio::IDLE,
             osWaitForever);
         getAFSKTestTone().both();
         break;
     case hardware::STOP_TX:
         DEBUG("STOP_TX");
         getAFSKTestTone().stop();
-        osMessagePut(audioInputQueueHandle, audio::IDLE,
+        audio::post(audio::IDLE,
             osWaitForever);
         break;
     case hardware::RESET:
         DEBUG("RESET");
-        osMessagePut(audioInputQueueHandle, audio::DEMODULATOR,
+        audio::post(audio::DEMODULATOR,
             osWaitForever);
         break;
 
@@ -272,29 +742,30 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
 
     case hardware::POLL_INPUT_TWIST:
       DEBUG("POLL_INPUT_TWIST");
-      osMessagePut(audioInputQueueHandle, audio::POLL_TWIST_LEVEL,
+      if (audio::sendInputTwist()) break;
+      audio::post(audio::POLL_TWIST_LEVEL,
           osWaitForever);
-      osMessagePut(audioInputQueueHandle, audio::DEMODULATOR,
+      audio::post(audio::DEMODULATOR,
           osWaitForever);
         break;
 
     case hardware::STREAM_AVG_INPUT_TWIST:
       DEBUG("STREAM_AVG_INPUT_TWIST");
-      osMessagePut(audioInputQueueHandle, audio::STREAM_AVERAGE_TWIST_LEVEL,
+      audio::post(audio::STREAM_AVERAGE_TWIST_LEVEL,
           osWaitForever);
         break;
 
     case hardware::STREAM_INPUT_TWIST:
       DEBUG("STREAM_INPUT_TWIST");
-      osMessagePut(audioInputQueueHandle, audio::STREAM_INSTANT_TWIST_LEVEL,
+      audio::post(audio::STREAM_INSTANT_TWIST_LEVEL,
           osWaitForever);
         break;
 
     case hardware::ADJUST_INPUT_LEVELS:
       DEBUG("ADJUST_INPUT_LEVELS");
-      osMessagePut(audioInputQueueHandle, audio::AUTO_ADJUST_INPUT_LEVEL,
+      audio::post(audio::AUTO_ADJUST_INPUT_LEVEL,
           osWaitForever);
-      osMessagePut(audioInputQueueHandle, audio::STREAM_AMPLIFIED_INPUT_LEVEL,
+      audio::post(audio::STREAM_AMPLIFIED_INPUT_LEVEL,
           osWaitForever);
         break;
 
@@ -325,9 +796,9 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
         input_gain += *it;
         DEBUG("SET_INPUT_GAIN = %d", input_gain);
         update_crc();
-        osMessagePut(audioInputQueueHandle, audio::UPDATE_SETTINGS,
+        audio::post(audio::UPDATE_SETTINGS,
             osWaitForever);
-        osMessagePut(audioInputQueueHandle, audio::STREAM_AMPLIFIED_INPUT_LEVEL,
+        audio::post(audio::STREAM_AMPLIFIED_INPUT_LEVEL,
             osWaitForever);
         [[fallthrough]];
     case hardware::GET_INPUT_GAIN:
@@ -339,9 +810,9 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
         DEBUG("SET_INPUT_TWIST");
         rx_twist = *it;
         update_crc();
-        osMessagePut(audioInputQueueHandle, audio::UPDATE_SETTINGS,
+        audio::post(audio::UPDATE_SETTINGS,
             osWaitForever);
-        osMessagePut(audioInputQueueHandle, audio::STREAM_AMPLIFIED_INPUT_LEVEL,
+        audio::post(audio::STREAM_AMPLIFIED_INPUT_LEVEL,
             osWaitForever);
         [[fallthrough]];
     case hardware::GET_INPUT_TWIST:
@@ -364,7 +835,7 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
 
     case hardware::STREAM_AMPLIFIED_INPUT:
         DEBUG("STREAM_AMPLIFIED_INPUT");
-        osMessagePut(audioInputQueueHandle, audio::STREAM_AMPLIFIED_INPUT_LEVEL,
+        audio::post(audio::STREAM_AMPLIFIED_INPUT_LEVEL,
             osWaitForever);
         break;
 
@@ -485,17 +956,23 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
         DEBUG("GET_CAPABILITIES");
         reply16(hardware::GET_CAPABILITIES,
             hardware::CAP_EEPROM_SAVE|hardware::CAP_BATTERY_LEVEL|
-            hardware::CAP_ADJUST_INPUT|hardware::CAP_DFU_FIRMWARE);
+            hardware::CAP_ADJUST_INPUT|hardware::CAP_DFU_FIRMWARE|
+            hardware::CAP_ACKMODE);
         break;
 
     case hardware::GET_ALL_VALUES:
         DEBUG("GET_ALL_VALUES");
         // GET_API_VERSION must always come first.
         reply16(hardware::GET_API_VERSION, hardware::KISS_API_VERSION);
-        osMessagePut(audioInputQueueHandle, audio::POLL_BATTERY_LEVEL,
-            osWaitForever);
-        osMessagePut(audioInputQueueHandle, audio::IDLE,
-            osWaitForever);
+        if (audio::battery_level()) {
+            reply16(hardware::GET_BATTERY_LEVEL, audio::battery_level());
+        } else {
+            // No cached level yet; measure once and keep demodulating.
+            audio::post(audio::POLL_BATTERY_LEVEL,
+                osWaitForever);
+            audio::post(audio::DEMODULATOR,
+                osWaitForever);
+        }
         reply(hardware::GET_FIRMWARE_VERSION, (uint8_t*) FIRMWARE_VERSION,
           sizeof(FIRMWARE_VERSION) - 1);
         reply(hardware::GET_HARDWARE_VERSION, (uint8_t*) HARDWARE_VERSION,
@@ -518,7 +995,8 @@ void Hardware::handle_request(hdlc::IoFrame* frame) {
         reply8(hardware::GET_PASSALL, options & KISS_OPTION_PASSALL ? 1 : 0);
         reply16(hardware::GET_CAPABILITIES,
             hardware::CAP_EEPROM_SAVE|hardware::CAP_BATTERY_LEVEL|
-            hardware::CAP_ADJUST_INPUT|hardware::CAP_DFU_FIRMWARE);
+            hardware::CAP_ADJUST_INPUT|hardware::CAP_DFU_FIRMWARE|
+            hardware::CAP_ACKMODE);
         reply16(hardware::GET_MIN_INPUT_GAIN, 0);   // Constants for this FW
         reply16(hardware::GET_MAX_INPUT_GAIN, 4);   // Constants for this FW
         reply8(hardware::GET_MIN_INPUT_TWIST, -3);  // Constants for this FW
@@ -558,16 +1036,19 @@ void Hardware::handle_ext_request(hdlc::IoFrame* frame) {
         if ((*it == hardware::MODEM_TYPE_1200)
             or (*it == hardware::MODEM_TYPE_9600))
         {
-            modem_type = *it;
-            DEBUG(modem_type_lookup[modem_type]);
-            update_crc();
+            if (*it != modem_type)
+            {
+                modem_type = *it;
+                DEBUG(modem_type_lookup[modem_type]);
+                update_crc();
+                audio::post(audio::SWITCH_MODEM, osWaitForever);
+                audio::post(audio::DEMODULATOR, osWaitForever);
+            }
         }
         else
         {
             ERROR("Unsupported modem type");
         }
-        osMessagePut(audioInputQueueHandle, audio::UPDATE_SETTINGS,
-            osWaitForever);
         [[fallthrough]];
     case hardware::EXT_GET_MODEM_TYPE[1]:
         DEBUG("EXT_GET_MODEM_TYPE");
@@ -577,6 +1058,123 @@ void Hardware::handle_ext_request(hdlc::IoFrame* frame) {
         DEBUG("EXT_GET_MODEM_TYPES");
         ext_reply(hardware::EXT_GET_MODEM_TYPES, supported_modem_types);
         break;
+    case hardware::EXT_SET_LOOPBACK[1]:
+        DEBUG("EXT_SET_LOOPBACK");
+        set_loopback(frame);
+        [[fallthrough]];
+    case hardware::EXT_GET_LOOPBACK[1]:
+        DEBUG("EXT_GET_LOOPBACK");
+        get_loopback();
+        break;
+    case hardware::EXT_GET_LOOPBACK_STATS[1]:
+        DEBUG("EXT_GET_LOOPBACK_STATS");
+        get_loopback_stats();
+        break;
+    case hardware::EXT_RESET_COUNTERS[1]:
+        DEBUG("EXT_RESET_COUNTERS");
+        stats::counters().reset();
+        [[fallthrough]];
+    case hardware::EXT_GET_COUNTERS[1]:
+        DEBUG("EXT_GET_COUNTERS");
+        get_counters();
+        break;
+    case hardware::EXT_SET_COUNTERS_PUSH[1]:
+        DEBUG("EXT_SET_COUNTERS_PUSH");
+        if (frame->size() >= 4) {
+            uint16_t seconds = *it++ << 8;
+            seconds |= *it;
+            stats::set_push_interval(seconds);
+        }
+        [[fallthrough]];
+    case hardware::EXT_GET_COUNTERS_PUSH[1]:
+        DEBUG("EXT_GET_COUNTERS_PUSH");
+        {
+            uint16_t seconds = stats::push_interval();
+            std::array<uint8_t, 2> result = {
+                uint8_t(seconds >> 8), uint8_t(seconds & 0xFF)};
+            ext_reply(hardware::EXT_GET_COUNTERS_PUSH, result);
+        }
+        break;
+    case hardware::EXT_GET_TASK_STATS[1]:
+        DEBUG("EXT_GET_TASK_STATS");
+        get_task_stats();
+        break;
+    case hardware::EXT_GET_ALL_VALUES[1]:
+        DEBUG("EXT_GET_ALL_VALUES");
+        get_all_values();
+        break;
+    case hardware::EXT_SET_VALUES[1]:
+        DEBUG("EXT_SET_VALUES");
+        set_values(frame);
+        break;
+    case hardware::EXT_SET_INPUT_AGC[1]:
+        DEBUG("EXT_SET_INPUT_AGC");
+        if (*it) {
+            options |= KISS_OPTION_INPUT_AGC;
+        } else {
+            options &= ~KISS_OPTION_INPUT_AGC;
+        }
+        update_crc();
+        // Back to the configured gain.
+        audio::post(audio::UPDATE_SETTINGS, osWaitForever);
+        audio::post(audio::DEMODULATOR, osWaitForever);
+        [[fallthrough]];
+    case hardware::EXT_GET_INPUT_AGC[1]:
+        DEBUG("EXT_GET_INPUT_AGC");
+        ext_reply(hardware::EXT_GET_INPUT_AGC,
+            uint8_t(options & KISS_OPTION_INPUT_AGC ? 1 : 0));
+        break;
+    case hardware::EXT_GET_ALIASES[1]:
+        DEBUG("EXT_GET_ALIASES");
+        get_aliases();
+        break;
+    case hardware::EXT_GET_ALIAS[1]:
+        DEBUG("EXT_GET_ALIAS");
+        if (frame->size() > 2) get_alias(*it);
+        break;
+    case hardware::EXT_SET_ALIAS[1]:
+        DEBUG("EXT_SET_ALIAS");
+        set_alias(frame);
+        break;
+    case hardware::EXT_GET_BEACON_SLOTS[1]:
+        DEBUG("EXT_GET_BEACON_SLOTS");
+        ext_reply(hardware::EXT_GET_BEACON_SLOTS, uint8_t(NUMBER_OF_BEACONS));
+        break;
+    case hardware::EXT_GET_BEACON[1]:
+        DEBUG("EXT_GET_BEACON");
+        if (frame->size() > 2) get_beacon(*it);
+        break;
+    case hardware::EXT_SET_BEACON[1]:
+        DEBUG("EXT_SET_BEACON");
+        set_beacon(frame);
+        break;
+    case hardware::EXT_SET_VISCOUS_DIGI[1]:
+        DEBUG("EXT_SET_VISCOUS_DIGI");
+        if (*it) {
+            options |= KISS_OPTION_VISCOUS_DIGI;
+        } else {
+            options &= ~KISS_OPTION_VISCOUS_DIGI;
+        }
+        update_crc();
+        digipeater().configure(*this);
+        [[fallthrough]];
+    case hardware::EXT_GET_VISCOUS_DIGI[1]:
+        DEBUG("EXT_GET_VISCOUS_DIGI");
+        ext_reply(hardware::EXT_GET_VISCOUS_DIGI,
+            uint8_t(options & KISS_OPTION_VISCOUS_DIGI ? 1 : 0));
+        break;
+    case hardware::EXT_SET_MYCALL[1]:
+        DEBUG("EXT_SET_MYCALL");
+        set_mycall(frame);
+        [[fallthrough]];
+    case hardware::EXT_GET_MYCALL[1]:
+    {
+        DEBUG("EXT_GET_MYCALL");
+        std::array<uint8_t, CALLSIGN_LEN> call;
+        std::copy_n(mycall, CALLSIGN_LEN, call.begin());
+        ext_reply(hardware::EXT_GET_MYCALL, call);
+        break;
+    }
     default:
         ERROR("Unknown extended hardware request");
     }
@@ -586,20 +1184,17 @@ bool Hardware::load()
 {
     INFO("Loading settings from EEPROM");
 
-    auto tmp = std::make_unique<Hardware>();
-
-    if (!tmp) return false;
-
-    memset(tmp.get(), 0, sizeof(Hardware));
+    // Read into the writer's shadow copy rather than a temporary.
+    auto eeprom = settingsWriter().load();
 
-    if (!I2C_Storage::load(*tmp)) {
+    if (!eeprom) {
         ERROR("Load from EEPROM failed.");
         return false;
     }
 
-    if (tmp->crc_ok())
+    if (eeprom->crc_ok())
     {
-        memcpy(this, tmp.get(), sizeof(Hardware));
+        memcpy(this, eeprom, sizeof(Hardware));
         DEBUG("Load from EEPROM succeeded.");
         return true;
     }
@@ -612,12 +1207,7 @@ bool Hardware::store() const
 {
     INFO("Saving settings to EEPROM");
 
-    if (!I2C_Storage::store(*this)) {
-        ERROR("Store to EEPROM failed.");
-        return false;
-    }
-
-    INFO("EEPROM saved checksum is: %04x (crc = %04x)", checksum, crc());
+    settingsWriter().request();
 
     return crc_ok();
 }
@@ -640,44 +1230,6 @@ bool I2C_Storage::load(void* ptr, size_t len)
     return true;
 }
 
-bool I2C_Storage::store(const void* ptr, size_t len)
-{
-    if (HAL_I2C_Init(&hi2c1) != HAL_OK) CxxErrorHandler();
-
-    auto tmp = const_cast<uint8_t*>(static_cast<const uint8_t*>(ptr));
-
-    uint32_t index = 0;
-    size_t remaining = len;
-    while (remaining > page_size)
-    {
-        auto result = HAL_I2C_Mem_Write(&hi2c1, i2c_address, index, I2C_MEMADD_SIZE_16BIT, tmp + index, page_size, 20);
-        if (result != HAL_OK) {
-            ERROR("EEPROM write block error = %lu.", hi2c1.ErrorCode);
-            if (HAL_I2C_DeInit(&hi2c1) != HAL_OK) CxxErrorHandler();
-            return false;
-        }
-        osDelay(write_time);
-        index += page_size;
-        remaining -= page_size;
-    }
-
-    while (remaining) {
-        auto result = HAL_I2C_Mem_Write(&hi2c1, i2c_address, index, I2C_MEMADD_SIZE_16BIT, tmp + index, remaining, 20);
-        if (result != HAL_OK) {
-            ERROR("EEPROM write remainder error = %lu.", hi2c1.ErrorCode);
-            if (HAL_I2C_DeInit(&hi2c1) != HAL_OK) CxxErrorHandler();
-            return false;
-        }
-        osDelay(write_time);
-        index += remaining;
-        remaining = 0;
-    }
-
-    if (HAL_I2C_DeInit(&hi2c1) != HAL_OK) CxxErrorHandler();
-
-    return true;
-}
-
 
 }}} // mobilinkd::tnc::kiss
 
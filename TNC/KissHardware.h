@@ -11,6 +11,9 @@ extern "C" {
 int powerOnViaUSB(void);
 int powerOffViaUSB(void);
 
+void startSettingsWriterTask(void const* argument);
+void flushSettings(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,7 +34,7 @@ namespace hardware {
  * The major version should be updated whenever non-backwards compatible
  * changes to the API are made.
  */
-constexpr const uint16_t KISS_API_VERSION = 0x0201;
+constexpr const uint16_t KISS_API_VERSION = 0x0202;
 
 constexpr const uint16_t CAP_DCD = 0x0100;
 constexpr const uint16_t CAP_SQUELCH = 0x0200;
@@ -48,6 +48,7 @@ constexpr const uint16_t CAP_VERBOSE_ERROR = 0x0001;
 constexpr const uint16_t CAP_EEPROM_SAVE = 0x0002;
 constexpr const uint16_t CAP_ADJUST_INPUT = 0x0004; // Auto-adjust input levels.
 constexpr const uint16_t CAP_DFU_FIRMWARE = 0x0008; // DFU firmware style.
+constexpr const uint16_t CAP_ACKMODE = 0x0010; // KISS ACKMODE (0x0C) frames.
 
 constexpr const uint8_t SAVE = 0; // Save settings to EEPROM.
 constexpr const uint8_t SET_OUTPUT_GAIN = 1;
@@ -164,12 +165,34 @@ constexpr std::array<uint8_t, 2> EXT_GET_MODEM_TYPES = {0xC1, 0x83};    ///< Ret
 
 constexpr std::array<uint8_t, 2> EXT_GET_ALIASES = {0xC1, 0x88};        ///< Number of aliases supported
 constexpr std::array<uint8_t, 2> EXT_GET_ALIAS = {0xC1, 0x89};          ///< Alias number (uint8_t), 8 characters, 5 bytes (set, use, insert_id, preempt, hops)
-constexpr std::array<uint8_t, 2> EXT_SET_ALIAS = {0xC1, 0x0A};          ///< Alias number (uint8_t), 8 characters, 5 bytes (set, use, insert_id, preempt, hops)
+constexpr std::array<uint8_t, 2> EXT_SET_ALIAS = {0xC1, 0x8A};          ///< Alias number (uint8_t), 8 characters, 5 bytes (set, use, insert_id, preempt, hops)
 
 constexpr std::array<uint8_t, 2> EXT_GET_BEACON_SLOTS = {0xC1, 0x8C};   ///< Number of beacons supported
 constexpr std::array<uint8_t, 2> EXT_GET_BEACON = {0xC1, 0x8D};         ///< Beacon number (uint8_t), uint16_t interval in seconds, 3 NUL terminated strings (callsign, path, text)
 constexpr std::array<uint8_t, 2> EXT_SET_BEACON = {0xC1, 0x8E};         ///< Beacon number (uint8_t), uint16_t interval in seconds, 3 NUL terminated strings (callsign, path, text)
 
+constexpr std::array<uint8_t, 2> EXT_GET_LOOPBACK = {0xC1, 0x90};       ///< Enabled (uint8_t), noise (uint16_t, LSBs), twist (int8_t)
+constexpr std::array<uint8_t, 2> EXT_SET_LOOPBACK = {0xC1, 0x91};       ///< Enabled (uint8_t), optional noise (uint16_t, LSBs), optional twist (int8_t)
+constexpr std::array<uint8_t, 2> EXT_GET_LOOPBACK_STATS = {0xC1, 0x92}; ///< 7 uint32_t: TX, RX, elapsed ms, latency min/avg/max ms, frames/s * 100
+
+constexpr std::array<uint8_t, 2> EXT_GET_COUNTERS = {0xC1, 0x94};       ///< Version (uint8_t), count (uint8_t), count * uint32_t (see stats::Counters)
+constexpr std::array<uint8_t, 2> EXT_RESET_COUNTERS = {0xC1, 0x95};     ///< Reset all counters; replies with EXT_GET_COUNTERS
+constexpr std::array<uint8_t, 2> EXT_GET_COUNTERS_PUSH = {0xC1, 0x96};  ///< uint16_t push interval in seconds (0 = off)
+constexpr std::array<uint8_t, 2> EXT_SET_COUNTERS_PUSH = {0xC1, 0x97};  ///< uint16_t push interval in seconds (0 = off)
+constexpr std::array<uint8_t, 2> EXT_GET_TASK_STATS = {0xC1, 0x98};     ///< Per-task CPU/stack and heap usage (see stats::TaskStats)
+constexpr std::array<uint8_t, 2> EXT_SETTINGS_COMMITTED = {0xC1, 0x99}; ///< Sent after an EEPROM commit: status (uint8_t, 0 = OK), pages written (uint8_t)
+constexpr std::array<uint8_t, 2> EXT_GET_ALL_VALUES = {0xC1, 0x9A};     ///< Version (uint8_t), then TLV records (see Hardware::get_all_values())
+constexpr std::array<uint8_t, 2> EXT_SET_VALUES = {0xC1, 0x9B};         ///< Flags (uint8_t), then TLV records; replies status, tag, count (see Hardware::set_values())
+constexpr std::array<uint8_t, 2> EXT_GET_INPUT_AGC = {0xC1, 0x9C};      ///< Enabled (uint8_t)
+constexpr std::array<uint8_t, 2> EXT_SET_INPUT_AGC = {0xC1, 0x9D};      ///< Enabled (uint8_t)
+constexpr std::array<uint8_t, 2> EXT_GET_MYCALL = {0xC1, 0x9E};         ///< Callsign, 8 characters (NUL padded)
+constexpr std::array<uint8_t, 2> EXT_SET_MYCALL = {0xC1, 0x9F};         ///< Callsign, up to 8 characters
+constexpr std::array<uint8_t, 2> EXT_GET_VISCOUS_DIGI = {0xC1, 0xA0};   ///< Enabled (uint8_t)
+constexpr std::array<uint8_t, 2> EXT_SET_VISCOUS_DIGI = {0xC1, 0xA1};   ///< Enabled (uint8_t)
+
+constexpr uint8_t ALL_VALUES_VERSION = 1;
+constexpr uint8_t SET_VALUES_SAVE = 0x01;   ///< EXT_SET_VALUES flag: store in EEPROM.
+
 
 /*
  * Modem type values 0x00 - 0x7F are single-byte types.  Modem type values
@@ -190,6 +213,8 @@ constexpr uint8_t MODEM_TYPE_MFSK16 = 6;
 #define KISS_OPTION_VIN_POWER_OFF   0x08  // Power off when unplugged from USB
 #define KISS_OPTION_PTT_SIMPLEX     0x10  // Simplex PTT (the default)
 #define KISS_OPTION_PASSALL         0x20  // Ignore invalid CRC.
+#define KISS_OPTION_INPUT_AGC       0x40  // Adjust input gain between packets.
+#define KISS_OPTION_VISCOUS_DIGI    0x80  // Hold digipeated frames (fill-in digi).
 
 const char TOCALL[] = "APML30"; // Update for every feature change.
 
@@ -357,6 +382,12 @@ struct Hardware
     }
 
     bool load();
+
+    /**
+     * Schedule a background write of the changed settings to EEPROM
+     * (see SettingsWriter).  Call update_crc() first.  This must only be
+     * called on settings().
+     */
     bool store() const;
 
     void set_txdelay(uint8_t value);
@@ -370,7 +401,45 @@ struct Hardware
 
     void get_aliases();
     void get_alias(uint8_t alias);
-    void set_alias(const hdlc::IoFrame* frame);
+    void set_alias(hdlc::IoFrame* frame);
+    void set_mycall(hdlc::IoFrame* frame);
+    void get_beacon(uint8_t index);
+    void set_beacon(hdlc::IoFrame* frame);
+
+    void set_loopback(hdlc::IoFrame* frame);
+    void get_loopback();
+    void get_loopback_stats();
+
+    void get_counters();
+    void get_task_stats();
+    void settings_committed();
+
+    /**
+     * Send everything GET_ALL_VALUES does in one EXT_GET_ALL_VALUES frame,
+     * without changing the audio input state.  After the version byte,
+     * each value is a TLV record: tag (uint8_t), length (uint8_t) and the
+     * value, formatted as in the individual reply.  The tag is the GET
+     * command (< 0x80) or the second byte of the extended GET command.
+     * The battery level is the most recent reading (0 if none).
+     */
+    void get_all_values();
+
+    /**
+     * Apply the TLV records in an EXT_SET_VALUES frame as one transaction.
+     * The tag is the SET command (or, for the KISS parameters, which have
+     * no SET command, the GET command) and the value is formatted as in
+     * that command.  EXT_SET_MODEM_TYPE uses the second byte as the tag.
+     *
+     * All records are validated first.  If any is unknown or invalid,
+     * nothing is changed.  Otherwise the CRC is updated once, the audio
+     * and modulator paths are reconfigured once, and the settings are
+     * stored once if SET_VALUES_SAVE is set.
+     *
+     * The reply is status (0 = OK, 1 = error), the tag of the record that
+     * failed (0 if none) and the number of records applied.  Frames longer
+     * than 332 bytes are rejected.
+     */
+    void set_values(hdlc::IoFrame* frame);
 
     void announce_input_settings();
 
@@ -391,13 +460,6 @@ struct I2C_Storage
     static bool load(T& t) {
         return load(&t, sizeof(T));
     }
-
-    static bool store(const void* ptr, size_t len);
-
-    template <typename T>
-    static bool store(const T& t) {
-        return store(&t, sizeof(T));
-    }
 };
 
 void reply8(uint8_t cmd, uint8_t result) __attribute__((noinline));
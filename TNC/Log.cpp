@@ -2,18 +2,32 @@
 // All rights reserved.
 
 #include <Log.h>
+#include "Trace.h"
+
 #include <cstdarg>
 #include <cstdio>
 
 void log_(int level, const char* fmt, ...)
 {
 
-  if (level < mobilinkd::tnc::log().level_) return;
   va_list args;
+  if (level >= 2) {
+    va_start(args, fmt);
+    event_log_v(level, fmt, args);
+    va_end(args);
+  }
+
+  if (level < mobilinkd::tnc::log().level_) return;
   va_start(args, fmt);
+#ifdef KISS_LOG_TRACE
+  trace_log(level, fmt, args);
+#else
   vprintf(fmt, args);
+#endif
   va_end(args);
+#ifndef KISS_LOG_TRACE
   printf("\r\n");
+#endif
 }
 
 namespace mobilinkd { namespace tnc {
@@ -51,9 +65,15 @@ void Log::log(Level level, const char* fmt, ...) {
     if (level < level_) return;
     va_list args;
     va_start(args, fmt);
+#ifdef KISS_LOG_TRACE
+    trace_log(level, fmt, args);
+#else
     vprintf(fmt, args);
+#endif
     va_end(args);
+#ifndef KISS_LOG_TRACE
     printf("\r\n");
+#endif
 }
 #endif
 
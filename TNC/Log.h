@@ -20,6 +20,10 @@ extern "C" {
 
 void log_(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 
+/// Record a warning or error in the on-device event log (EventLog.hpp).
+void event_log_(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void event_log_v(int level, const char *fmt, va_list args);
+
 #ifndef KISS_LOG_LEVEL
 #define KISS_LOG_LEVEL 1
 #endif
@@ -36,9 +40,9 @@ void log_(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)))
 #else
 #define DEBUG(...)
 #define INFO(...)
-#define WARN(...)
-#define ERROR(...)
-#define SEVERE(...)
+#define WARN(...)     event_log_(2, __VA_ARGS__);
+#define ERROR(...)    event_log_(3, __VA_ARGS__);
+#define SEVERE(...)   event_log_(4, __VA_ARGS__);
 #endif
 
 #ifdef __cplusplus
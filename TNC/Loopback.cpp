@@ -0,0 +1,117 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "Loopback.hpp"
+
+#include <algorithm>
+
+namespace mobilinkd { namespace tnc { namespace loopback {
+
+Loopback& loopback()
+{
+    static Loopback instance;
+    return instance;
+}
+
+void Loopback::reset()
+{
+    head_ = 0;
+    tail_ = 0;
+    streaming_ = false;
+    last_in_ = 0;
+    last_out_ = 0;
+    for (auto& p : pending_) p.valid = false;
+    pending_index_ = 0;
+    first_tick_ = 0;
+    stats_ = Stats{0, 0, 0, UINT32_MAX, 0, 0};
+}
+
+/**
+ * Apply the twist (a first-order tilt) to a centred sample.  Positive
+ * twist is pre-emphasis, which favours the higher tone.  Negative twist
+ * is de-emphasis, which favours the lower tone.
+ */
+int32_t Loopback::impair(int32_t sample)
+{
+    int32_t result = sample;
+
+    if (twist_ > 0) {
+        result = sample - ((last_in_ * twist_) >> 7);
+    } else if (twist_ < 0) {
+        result = last_out_ + (((sample - last_out_) * (128 + twist_)) >> 7);
+    }
+
+    last_in_ = sample;
+    last_out_ = result;
+    return result;
+}
+
+void Loopback::read(uint16_t* samples, size_t len, uint16_t vgnd)
+{
+    // Wait until enough samples are buffered to cover a whole ADC block
+    // before playing them out. This absorbs the DAC/ADC DMA phase jitter.
+    if (!streaming_ and available() >= PREFILL) streaming_ = true;
+
+    int32_t limit = int32_t(vgnd) * 2;
+    size_t tail = tail_;
+
+    for (size_t i = 0; i != len; ++i)
+    {
+        int32_t sample = 0;
+        if (streaming_) {
+            if (tail != head_) {
+                sample = int32_t(buffer_[tail]) - 2048;
+                tail = (tail + 1) & (BUFFER_SIZE - 1);
+            } else {
+                streaming_ = false;     // Modulator has stopped.
+            }
+        }
+
+        // The DAC is 12 bits; scale to half of the ADC range.
+        sample = (impair(sample) * vgnd) >> 12;
+
+        if (noise_) {
+            // Sum of four uniform values; standard deviation is 37837.
+            uint32_t r1 = next_random();
+            uint32_t r2 = next_random();
+            int32_t n = int32_t(r1 & 0xFFFF) + int32_t(r1 >> 16)
+                + int32_t(r2 & 0xFFFF) + int32_t(r2 >> 16) - 131070;
+            sample += (n * noise_) / 37837;
+        }
+
+        samples[i] = std::clamp<int32_t>(sample + vgnd, 0, limit);
+    }
+
+    tail_ = tail;
+}
+
+void Loopback::transmitted(uint16_t fcs, uint32_t now)
+{
+    if (stats_.transmitted == 0) first_tick_ = now;
+    ++stats_.transmitted;
+
+    auto& p = pending_[pending_index_];
+    p.tick = now;
+    p.fcs = fcs;
+    p.valid = true;
+    pending_index_ = (pending_index_ + 1) & (PENDING_SIZE - 1);
+}
+
+void Loopback::received(uint16_t fcs, uint32_t now)
+{
+    auto it = std::find_if(pending_.begin(), pending_.end(),
+        [fcs](const Pending& p){ return p.valid and p.fcs == fcs; });
+
+    if (it == pending_.end()) return;
+
+    it->valid = false;
+    uint32_t latency = now - it->tick;
+
+    ++stats_.received;
+    stats_.elapsed = now - first_tick_;
+    stats_.latency_sum += latency;
+    stats_.latency_min = std::min(stats_.latency_min, latency);
+    stats_.latency_max = std::max(stats_.latency_max, latency);
+}
+
+}}} // mobilinkd::tnc::loopback
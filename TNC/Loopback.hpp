@@ -0,0 +1,161 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc { namespace loopback {
+
+/**
+ * Software RF loopback.  When enabled, the samples the modulator writes
+ * to the DAC are also written to a ring buffer.  The ADC DMA callbacks
+ * replace the captured audio with samples from this ring, so that the
+ * active demodulator decodes our own transmissions.  The DAC and ADC
+ * timers run at the same rate for each modem, so the ring stays balanced.
+ * PTT is not keyed while loopback is enabled.
+ *
+ * An optional impairment can be applied: approximately Gaussian noise
+ * and a first-order spectral tilt (twist).
+ *
+ * Frames are matched by FCS between the encoder and the demodulator to
+ * measure latency (from the start of transmission, after CSMA, to the
+ * decoded frame) and throughput.
+ *
+ * This has no HAL dependencies so that it can be built on a host.
+ */
+struct Loopback
+{
+    static constexpr size_t BUFFER_SIZE = 1024;     // Must be a power of 2.
+    static constexpr size_t PREFILL = 448;          // >= ADC block size + 1 bit.
+    static constexpr size_t PENDING_SIZE = 8;
+
+    struct Pending
+    {
+        uint32_t tick;
+        uint16_t fcs;
+        bool valid;
+    };
+
+    /// Statistics returned via EXT_GET_LOOPBACK_STATS.
+    struct Stats
+    {
+        uint32_t transmitted;   ///< Frames sent by the encoder.
+        uint32_t received;      ///< Frames decoded and matched by FCS.
+        uint32_t elapsed;       ///< ms from first frame sent to last received.
+        uint32_t latency_min;   ///< ms
+        uint32_t latency_max;   ///< ms
+        uint32_t latency_sum;   ///< ms
+    };
+
+    std::array<uint16_t, BUFFER_SIZE> buffer_;
+    volatile size_t head_{0};               // Written by the modulator.
+    volatile size_t tail_{0};               // Read by the ADC callback.
+    bool streaming_{false};
+
+    volatile bool enabled_{false};
+    uint16_t noise_{0};                     // Noise std. deviation in LSBs.
+    int8_t twist_{0};                       // Spectral tilt, -127..127.
+    int32_t last_in_{0};
+    int32_t last_out_{0};
+    uint32_t rng_{2463534242};
+
+    std::array<Pending, PENDING_SIZE> pending_;
+    size_t pending_index_{0};
+    uint32_t first_tick_{0};
+    Stats stats_;
+
+    Loopback()
+    {
+        reset();
+    }
+
+    bool enabled() const { return enabled_; }
+
+    void enable(uint16_t noise, int8_t twist)
+    {
+        noise_ = std::min<uint16_t>(noise, 4095);
+        twist_ = twist;
+        reset();
+        enabled_ = true;
+    }
+
+    void disable()
+    {
+        enabled_ = false;
+    }
+
+    void reset();
+
+    uint16_t noise() const { return noise_; }
+    int8_t twist() const { return twist_; }
+
+    const Stats& stats() const { return stats_; }
+
+    size_t available() const
+    {
+        return (head_ - tail_) & (BUFFER_SIZE - 1);
+    }
+
+    /**
+     * Called by the modulator whenever it fills part of the DAC buffer.
+     * Samples which do not fit are dropped.
+     *
+     * @note This may be called from an interrupt context.
+     */
+    void write(const uint16_t* samples, size_t len)
+    {
+        if (!enabled_) return;
+
+        size_t head = head_;
+        for (size_t i = 0; i != len; ++i)
+        {
+            size_t next = (head + 1) & (BUFFER_SIZE - 1);
+            if (next == tail_) break;
+            buffer_[head] = samples[i];
+            head = next;
+        }
+        head_ = head;
+    }
+
+    /**
+     * Called by the ADC DMA callbacks in place of copying the captured
+     * audio.  DAC samples are re-centred on the virtual ground level and
+     * impaired.  When the modulator is idle, the "channel" is quiet.
+     *
+     * @note This is called from an interrupt context.
+     *
+     * @param samples is the ADC block to fill.
+     * @param len is the number of samples in the block.
+     * @param vgnd is the current virtual ground (ADC zero) level.
+     */
+    void read(uint16_t* samples, size_t len, uint16_t vgnd);
+
+    /// Called by the encoder when it starts to send a frame, after CSMA.
+    void transmitted(uint16_t fcs, uint32_t now);
+
+    /// Called by the demodulator for each frame decoded.
+    void received(uint16_t fcs, uint32_t now);
+
+private:
+
+    int32_t impair(int32_t sample);
+
+    uint32_t next_random()
+    {
+        // xorshift32
+        uint32_t x = rng_;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        rng_ = x;
+        return x;
+    }
+};
+
+Loopback& loopback();
+
+}}} // mobilinkd::tnc::loopback
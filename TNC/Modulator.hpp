@@ -5,6 +5,7 @@
 
 #include "PTT.hpp"
 #include "KissHardware.hpp"
+#include "Loopback.hpp"
 
 #include "stm32l4xx_hal.h"
 #include "cmsis_os.h"
@@ -35,6 +36,13 @@ struct Modulator
      */
     virtual void init(const kiss::Hardware& hw) = 0;
 
+    /**
+     * Make this the active modulator when switching modems.  The DAC has
+     * already been configured by init(), so only the modulator state,
+     * system clock and DAC timer need to be set.  The default is init().
+     */
+    virtual void activate(const kiss::Hardware& hw) { init(hw); }
+
     /**
      * Implement all functionality required to deactivate the hardware and
      * the modulator.  For example, disabling the timer used by the DAC
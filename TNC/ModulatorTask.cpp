@@ -7,10 +7,13 @@
 #include "Fsk9600Modulator.hpp"
 #include "AFSKModulator.hpp"
 #include "KissHardware.hpp"
+#include "Loopback.hpp"
+#include "Statistics.hpp"
 #include "main.h"
 
 mobilinkd::tnc::SimplexPTT simplexPtt;
 mobilinkd::tnc::MultiplexPTT multiplexPtt;
+mobilinkd::tnc::LoopbackPTT loopbackPtt;
 
 mobilinkd::tnc::Modulator* modulator;
 mobilinkd::tnc::hdlc::Encoder* encoder;
@@ -35,6 +38,7 @@ extern "C" void HAL_DAC_ConvCpltCallbackCh1(DAC_HandleTypeDef*) {
 }
 
 extern "C" void HAL_DAC_DMAUnderrunCallbackCh1(DAC_HandleTypeDef*) {
+    mobilinkd::tnc::stats::count(mobilinkd::tnc::stats::counters().dac_underruns);
     modulator->abort();
 }
 
@@ -77,7 +81,9 @@ void updatePtt()
 {
     using namespace mobilinkd::tnc::kiss;
 
-    if (settings().options & KISS_OPTION_PTT_SIMPLEX)
+    if (mobilinkd::tnc::loopback::loopback().enabled())
+        getModulator().set_ptt(&loopbackPtt);
+    else if (settings().options & KISS_OPTION_PTT_SIMPLEX)
         getModulator().set_ptt(&simplexPtt);
     else
         getModulator().set_ptt(&multiplexPtt);
@@ -93,6 +99,16 @@ void updateModulator()
     encoder->updateModulator();
 }
 
+void switchModulator()
+{
+    using namespace mobilinkd::tnc::kiss;
+
+    modulator = &getModulator();
+    modulator->activate(settings());
+    updatePtt();
+    encoder->updateModulator();
+}
+
 void startModulatorTask(void const*) {
 
     using namespace mobilinkd::tnc::kiss;
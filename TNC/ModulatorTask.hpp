@@ -35,6 +35,9 @@ void setPtt(PTT ptt);
 void updatePtt(void);
 void updateModulator(void);
 
+/// Change to the modulator for the current modem type, keeping the DAC set up.
+void switchModulator(void);
+
 #ifdef __cplusplus
 }
 #endif
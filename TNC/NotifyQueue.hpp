@@ -0,0 +1,131 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "cmsis_os.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace mobilinkd { namespace tnc {
+
+/**
+ * A lock-free single-producer, single-consumer ring of pointers that wakes
+ * the consumer task with a direct-to-task notification bit.  This replaces
+ * a FreeRTOS queue for hand-offs from an interrupt handler to a task on
+ * hot paths.  It does not need a critical section or a scheduler call
+ * other than the notification.
+ *
+ * The ring is the source of truth.  The notification only wakes the
+ * consumer, so the consumer must always check the ring before waiting.
+ * Other notification bits can be used for other events, such as a mode
+ * change, and are returned by wait().
+ *
+ * @tparam T is the (pointer) type passed.
+ * @tparam N is the ring size; it must be a power of 2.
+ */
+template <typename T, size_t N>
+class NotifyQueue
+{
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+    std::array<T, N> buffer_;
+    std::atomic<uint32_t> head_{0};     // Free-running; written by producer.
+    std::atomic<uint32_t> tail_{0};     // Free-running; written by consumer.
+    osThreadId task_{0};
+    const uint32_t bit_;
+
+public:
+
+    explicit NotifyQueue(uint32_t bit)
+    : bit_(bit)
+    {}
+
+    /// Set the consumer task.  Must be called by the consumer task.
+    void attach()
+    {
+        task_ = xTaskGetCurrentTaskHandle();
+    }
+
+    /// True if called by the consumer task.  Only it may wait().
+    bool is_consumer() const
+    {
+        return task_ != 0 and task_ == xTaskGetCurrentTaskHandle();
+    }
+
+    size_t size() const
+    {
+        return head_.load(std::memory_order_relaxed)
+            - tail_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Add a value and notify the consumer.  This must only be called from
+     * a single interrupt priority level.
+     *
+     * @return false if the ring is full.
+     */
+    bool put_from_isr(T value)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N) return false;
+
+        buffer_[head & (N - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+
+        if (task_) {
+            BaseType_t woken = pdFALSE;
+            xTaskNotifyFromISR(task_, bit_, eSetBits, &woken);
+            portYIELD_FROM_ISR(woken);
+        }
+        return true;
+    }
+
+    /// Set other notification bits on the consumer from an interrupt.
+    void notify_from_isr(uint32_t bits)
+    {
+        if (!task_) return;
+        BaseType_t woken = pdFALSE;
+        xTaskNotifyFromISR(task_, bits, eSetBits, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+
+    /// Remove a value without waiting.  Returns false if empty.
+    bool get(T& value)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail) return false;
+
+        value = buffer_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Wait for a notification.  Only this queue's bit is cleared.  Other
+     * bits remain set until the consumer clears them.
+     *
+     * @return the notification bits, or 0 on timeout.
+     */
+    uint32_t wait(uint32_t timeout)
+    {
+        uint32_t events = 0;
+        if (xTaskNotifyWait(0, bit_, &events, timeout) != pdTRUE) return 0;
+        return events;
+    }
+};
+
+/**
+ * Clear notification bits for the current task.  The bits are cleared on
+ * exit as well as on entry because FreeRTOS skips the entry clear when a
+ * notification is already pending.
+ */
+inline void clear_notification(uint32_t bits)
+{
+    xTaskNotifyWait(bits, bits, nullptr, 0);
+}
+
+}} // mobilinkd::tnc
@@ -38,6 +38,18 @@ struct MultiplexPTT : PTT {
     }
 };
 
+/**
+ * Used in loopback mode.  Only the TX LED is lit; the radio is not keyed.
+ */
+struct LoopbackPTT : PTT {
+    void on() {
+        tx_on();                    // LED
+    }
+    void off() {
+        tx_off();                   // LED
+    }
+};
+
 }} // mobilinkd::tnc
 
 
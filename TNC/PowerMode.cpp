@@ -5,11 +5,86 @@
 #include "PowerMode.h"
 #include "stm32l4xx_hal.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include <stdint.h>
 
+extern TIM_HandleTypeDef htim2;
+
 volatile PowerMode power_mode{PowerMode::RUN};
 PowerMode previous_mode{PowerMode::RUN};        // Always start in RUN mode.
 
+namespace {
+
+/*
+ * LPTIM1, clocked from the LSE, keeps time while the tick is suppressed.
+ * It keeps counting in STOP2, when SysTick and the HAL time base (TIM2)
+ * do not, and its compare match wakes the processor.  It does not depend
+ * on the system clock, which the clock governor changes at run time.
+ */
+constexpr uint32_t LPTIM_HZ = 32768;
+constexpr uint32_t MAX_IDLE_MS = 1900;      // Below the 16-bit counter wrap.
+
+bool lptim_initialized = false;
+bool stopped = false;
+
+void lptim_init()
+{
+    __HAL_RCC_LPTIM1_CONFIG(RCC_LPTIM1CLKSOURCE_LSE);
+    __HAL_RCC_LPTIM1_CLK_ENABLE();
+
+    LPTIM1->CFGR = 0;
+    LPTIM1->IER = LPTIM_IER_CMPMIE;         // Only writable while disabled.
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+    LPTIM1->ARR = 0xFFFF;
+    while (!(LPTIM1->ISR & LPTIM_ISR_ARROK));
+    LPTIM1->CMP = 0xFFFF;
+    while (!(LPTIM1->ISR & LPTIM_ISR_CMPOK));
+    LPTIM1->CR |= LPTIM_CR_CNTSTRT;
+
+    EXTI->IMR2 |= EXTI_IMR2_IM32;           // LPTIM1 wakeup from STOP.
+    HAL_NVIC_SetPriority(LPTIM1_IRQn, 15, 0);
+    HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+
+    lptim_initialized = true;
+}
+
+// The counter is clocked asynchronously; read it until two reads agree.
+uint32_t lptim_count()
+{
+    uint32_t count = LPTIM1->CNT;
+    uint32_t check;
+    while ((check = LPTIM1->CNT) != count) count = check;
+    return count;
+}
+
+void lptim_wake_at(uint32_t count)
+{
+    while (!(LPTIM1->ISR & LPTIM_ISR_CMPOK));
+    LPTIM1->ICR = LPTIM_ICR_CMPOKCF | LPTIM_ICR_CMPMCF;
+    LPTIM1->CMP = count & 0xFFFF;
+}
+
+/*
+ * STOP2 is only possible with the system clock on MSI (the wakeup clock),
+ * with no USB, and with the ADC and DAC timers stopped.
+ */
+bool stop_allowed()
+{
+    return __HAL_RCC_GET_SYSCLK_SOURCE() == RCC_SYSCLKSOURCE_STATUS_MSI
+        and HAL_GPIO_ReadPin(USB_POWER_GPIO_Port, USB_POWER_Pin) == GPIO_PIN_RESET
+        and !(TIM6->CR1 & TIM_CR1_CEN)
+        and !(TIM7->CR1 & TIM_CR1_CEN);
+}
+
+} // namespace
+
+extern "C" void LPTIM1_IRQHandler(void)
+{
+    LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+}
+
 /**
  * Handle state transitions here.  Valid transitions are from RUN to any mode,
  * LPRUN to any mode, SLEEP to LPRUN or STOP, and STOP to LPRUN or SLEEP.
@@ -17,16 +92,26 @@ PowerMode previous_mode{PowerMode::RUN};        // Always start in RUN mode.
  * If moving from RUN to any SLEEP or STOP, we assume the upper layers have
  * already disconnected the connection, either bu
  *
+ * In RUN, the processor sleeps (WFI) between interrupts; the ADC and DAC
+ * DMA keep running and the block interrupts wake it.  In LPRUN nothing
+ * is connected and the audio input is idle, so STOP2 is entered instead.
+ * Setting *ulExpectedIdleTime to 0 tells the caller not to WFI again.
+ *
  * @param ulExpectedIdleTime
  */
 extern "C" void PreSleepProcessing(uint32_t *ulExpectedIdleTime)
 {
-    UNUSED(ulExpectedIdleTime);
     switch (power_mode)
     {
     case PowerMode::RUN:
         break;
     case PowerMode::LPRUN:
+        if (stop_allowed())
+        {
+            HAL_PWREx_EnterSTOP2Mode(PWR_STOPENTRY_WFI);
+            stopped = true;
+            *ulExpectedIdleTime = 0;
+        }
         break;
     case PowerMode::SLEEP:
         break;
@@ -35,6 +120,10 @@ extern "C" void PreSleepProcessing(uint32_t *ulExpectedIdleTime)
     }
 }
 
+/**
+ * After STOP2 the system clock is MSI, as before, but HSI16 (USART3, I2C1)
+ * and PLLSAI1 (USB, RNG) have been turned off by the hardware.
+ */
 extern "C" void PostSleepProcessing(uint32_t *ulExpectedIdleTime)
 {
     UNUSED(ulExpectedIdleTime);
@@ -43,6 +132,14 @@ extern "C" void PostSleepProcessing(uint32_t *ulExpectedIdleTime)
     case PowerMode::RUN:
         break;
     case PowerMode::LPRUN:
+        if (stopped)
+        {
+            stopped = false;
+            __HAL_RCC_HSI_ENABLE();
+            while (!__HAL_RCC_GET_FLAG(RCC_FLAG_HSIRDY));
+            __HAL_RCC_PLLSAI1_ENABLE();
+            while (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLLSAI1RDY));
+        }
         break;
     case PowerMode::SLEEP:
         break;
@@ -51,3 +148,83 @@ extern "C" void PostSleepProcessing(uint32_t *ulExpectedIdleTime)
     }
 }
 
+/**
+ * Tickless idle.  This replaces the port's SysTick based implementation,
+ * which calculates its tick counts once when the scheduler starts.  The
+ * system clock changes with the modem and the clock governor, after which
+ * the port would restore a SysTick reload value for the wrong clock.  It
+ * also cannot account for time spent in STOP2, when SysTick is stopped.
+ *
+ * SysTick and the HAL tick are stopped, LPTIM1 is set to wake the processor
+ * when the next task is due, and both tick counts are stepped forward by
+ * the time measured with LPTIM1.  As in the port, the part of the current
+ * tick that had elapsed when SysTick was stopped is counted, and the part
+ * of a tick left over on wake is loaded into SysTick, so no time is lost.
+ * Times are kept in ms * LPTIM_HZ.
+ */
+extern "C" void vPortSuppressTicksAndSleep(TickType_t xExpectedIdleTime)
+{
+    if (!lptim_initialized) lptim_init();
+
+    if (xExpectedIdleTime > MAX_IDLE_MS) xExpectedIdleTime = MAX_IDLE_MS;
+
+    // Not taskENTER_CRITICAL(), which would stop interrupts waking us.
+    __disable_irq();
+    __DSB();
+    __ISB();
+
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep)
+    {
+        __enable_irq();
+        return;
+    }
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    HAL_SuspendTick();
+
+    // The part of the current tick already counted down, at the old clock.
+    uint32_t reload = SysTick->LOAD + 1;
+    uint32_t total = (uint64_t(reload - 1 - SysTick->VAL) * LPTIM_HZ) / reload;
+
+    uint32_t start = lptim_count();
+    // Wake one tick early; the SysTick completes the last tick.
+    lptim_wake_at(start + ((xExpectedIdleTime - 1) * LPTIM_HZ) / 1000);
+
+    uint32_t xModifiableIdleTime = xExpectedIdleTime;
+    configPRE_SLEEP_PROCESSING(&xModifiableIdleTime);
+    if (xModifiableIdleTime > 0)
+    {
+        __DSB();
+        __WFI();
+        __ISB();
+    }
+    configPOST_SLEEP_PROCESSING(&xExpectedIdleTime);
+
+    uint32_t counts = (lptim_count() - start) & 0xFFFF;
+    total += counts * 1000;
+    uint32_t elapsed = total / LPTIM_HZ;
+    uint32_t fraction = total - elapsed * LPTIM_HZ;
+
+    if (elapsed > xExpectedIdleTime - 1)
+    {
+        // The last tick is overdue; let SysTick end it right away.
+        elapsed = xExpectedIdleTime - 1;
+        fraction = LPTIM_HZ - 1;
+    }
+
+    uwTick += elapsed;
+    vTaskStepTick(elapsed);
+
+    // Count down what is left of the current tick at the current system
+    // clock, then whole ticks from the reload value.
+    reload = SystemCoreClock / configTICK_RATE_HZ;
+    uint32_t remaining = reload - (uint64_t(fraction) * reload) / LPTIM_HZ;
+    SysTick->LOAD = (remaining > 2 ? remaining : 2) - 1;  // LOAD 0 stops it.
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    SysTick->LOAD = reload - 1;
+    __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+    HAL_ResumeTick();
+
+    __enable_irq();
+}
@@ -8,7 +8,9 @@
 
 #include <boost/iterator/iterator_facade.hpp>
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 
 namespace mobilinkd { namespace tnc { namespace buffer {
 
@@ -30,6 +32,13 @@ struct Pool {
         }
     }
 
+    /// Add chunks allocated elsewhere (in another RAM bank) to the pool.
+    void add(chunk_type* chunks, uint16_t count) {
+        for(uint16_t i = 0; i != count; ++i) {
+            free_list.push_back(chunks[i]);
+        }
+    }
+
     bool allocate(chunk_list& list) {
         bool result = false;
         auto x = taskENTER_CRITICAL_FROM_ISR();
@@ -94,12 +103,76 @@ struct SegmentedBuffer {
         return true;
     }
 
+    /**
+     * The first segment, which holds the first POOL::chunk_type::size()
+     * bytes, or nullptr if the buffer is empty.
+     */
+    pointer data() {
+        return size_ ? segments_.front().buffer : nullptr;
+    }
+
+    /// Shorten the buffer to size bytes, releasing unused segments.
+    void truncate(uint16_t size) {
+        if (size >= size_) return;
+        if (size == 0) {
+            clear();
+            return;
+        }
+
+        uint16_t used = (size_ + 0xFF) >> 8;
+        uint16_t needed = (size + 0xFF) >> 8;
+        for (; used != needed; --used) {
+            typename POOL::chunk_list tail;
+            auto last = segments_.end();
+            --last;
+            tail.splice(tail.end(), segments_, last);
+            allocator->deallocate(tail);
+        }
+
+        size_ = size;
+        current_ = segments_.end();
+        --current_;
+    }
+
+    /**
+     * Open a gap of len bytes at pos, moving the bytes after it up.  The
+     * contents of the gap are unspecified.  This copies everything after
+     * pos, so it is only meant for small changes near the start.
+     *
+     * @return false, with the buffer unchanged, if no segment was free.
+     */
+    bool insert(uint16_t pos, uint16_t len) {
+        uint16_t old_size = size_;
+        if (pos > old_size) return false;
+
+        for (uint16_t i = 0; i != len; ++i) {
+            if (!push_back(0)) {
+                truncate(old_size);
+                return false;
+            }
+        }
+
+        auto first = begin();
+        std::advance(first, pos);
+        auto last = begin();
+        std::advance(last, old_size);
+        std::copy_backward(first, last, back());
+        return true;
+    }
+
     iterator begin() __attribute__((noinline)) {
         return iterator(segments_.begin(), 0);
     }
     iterator end()  __attribute__((noinline)) {
         return iterator(segments_.end(), size_);
     }
+
+private:
+    /// An end iterator which can be decremented.
+    iterator back() {
+        return (size_ & 0xFF) ? iterator(current_, size_)
+            : iterator(segments_.end(), size_);
+    }
 };
 
 template <typename POOL, POOL* allocator>
@@ -9,6 +9,8 @@
 #include "PortInterface.h"
 #include "HdlcFrame.hpp"
 #include "Kiss.hpp"
+#include "Statistics.hpp"
+#include "NotifyQueue.hpp"
 #include "main.h"
 
 #include "stm32l4xx_hal.h"
@@ -33,9 +35,44 @@ std::atomic<uint32_t> uart_error{HAL_UART_ERROR_NONE};
 
 std::atomic<bool> txDoneFlag{true};
 
-uint8_t tmpBuffer[mobilinkd::tnc::TX_BUFFER_SIZE];
 uint8_t tmpBuffer2[mobilinkd::tnc::TX_BUFFER_SIZE];
 
+// Transmit double buffer.  Frames are SLIP-encoded into the fill buffer
+// while the other buffer is sent by DMA.  When the DMA completes, any
+// bytes that have accumulated are sent.  Frames written while the link is
+// busy are batched into a single write of up to one BLE MTU, which the
+// BM78 can send as a single notification.
+constexpr const size_t SERIAL_TX_BUFFER_SIZE = 244;  // LE data length extension.
+constexpr const uint32_t TX_STALL_TIMEOUT = 10000;   // ms without DMA progress.
+
+uint8_t txBuffer[2][SERIAL_TX_BUFFER_SIZE];
+volatile size_t txFill{0};          // Bytes in the fill buffer.
+volatile uint8_t txIndex{0};        // Index of the fill buffer.
+volatile bool txFilling{false};     // Task is encoding into the fill buffer.
+bool txSplit{false};                // Part of the frame being filled was sent.
+uint32_t txProgressCount{0};
+uint32_t txProgressTick{0};
+
+/*
+ * Start a DMA transfer of the fill buffer and swap buffers.  This must be
+ * called with interrupts masked or from the UART interrupt, and only when
+ * the previous DMA transfer has completed.
+ */
+void start_tx()
+{
+    if (txFill == 0) return;
+
+    txDoneFlag = false;
+    if (HAL_UART_Transmit_DMA(&huart_serial, txBuffer[txIndex], txFill) != HAL_OK)
+    {
+        txDoneFlag = true;
+        return;
+    }
+    txIndex ^= 1;
+    txFill = 0;
+    txProgressCount = UINT32_MAX;
+}
+
 constexpr const int RX_BUFFER_SIZE = 127;
 unsigned char rxBuffer[RX_BUFFER_SIZE * 2];
 
@@ -44,6 +81,12 @@ typedef mobilinkd::tnc::memory::Pool<
     3, RX_BUFFER_SIZE + 1> serial_pool_type;
 serial_pool_type serialPool;
 
+// Blocks passed from the UART callbacks to the serial task.  All of the
+// UART and DMA interrupts run at the same priority.
+constexpr uint32_t SERIAL_RX_READY = 1;
+constexpr uint32_t SERIAL_RX_ERROR = 2;
+mobilinkd::tnc::NotifyQueue<serial_pool_type::chunk_type*, 4> serialBlocks(SERIAL_RX_READY);
+
 #ifndef NUCLEOTNC
 void log_frame(mobilinkd::tnc::hdlc::IoFrame* frame)
 {
@@ -109,12 +152,10 @@ HAL_StatusTypeDef UART_DMAResumeReceive(UART_HandleTypeDef *huart)
 
 extern "C" void startSerialTask(void const* arg) __attribute__((optimize("-O1")));
 
-void startSerialTask(void const* arg)
+void startSerialTask(void const*)
 {
     using namespace mobilinkd::tnc;
 
-    auto serialPort = static_cast<const SerialPort*>(arg);
-
     const uint8_t FEND = 0xC0;
     const uint8_t FESC = 0xDB;
     const uint8_t TFEND = 0xDC;
@@ -126,19 +167,20 @@ void startSerialTask(void const* arg)
 
     hdlc::IoFrame* frame = hdlc::acquire_wait();
 
+    serialBlocks.attach();
+
     HAL_UART_Receive_DMA(&huart_serial, rxBuffer, RX_BUFFER_SIZE * 2);
     __HAL_UART_ENABLE_IT(&huart_serial, UART_IT_IDLE);
 
     while (true) {
-        osEvent evt = osMessageGet(serialPort->queue(), osWaitForever);
-
-        if (evt.status != osEventMessage) {
-            continue;
-        }
-
-        if (evt.value.v < FLASH_BASE) // Assumes FLASH_BASE < SRAM_BASE.
+        serial_pool_type::chunk_type* block;
+        if (!serialBlocks.get(block))
         {
+            auto events = serialBlocks.wait(osWaitForever);
+            if (!(events & SERIAL_RX_ERROR)) continue;
+
             // Error received.
+            clear_notification(SERIAL_RX_ERROR);
             hdlc::release(frame);
 #ifndef NUCLEOTNC
             ERROR("UART Error: %08lx", uart_error.load());
@@ -149,8 +191,9 @@ void startSerialTask(void const* arg)
             __HAL_UART_ENABLE_IT(&huart_serial, UART_IT_IDLE);
             continue;
         }
+        stats::high_water(stats::counters().serial_input_hwm,
+            uint32_t(serialBlocks.size() + 1));
 
-        auto block = (serial_pool_type::chunk_type*) evt.value.p;
         auto data = static_cast<unsigned char*>(block->buffer);
 
         uint8_t end = data[0] + 1;
@@ -162,7 +205,7 @@ void startSerialTask(void const* arg)
                 break;
             case WAIT_FRAME_TYPE:
                 if (c == FEND) break;   // Still waiting for FRAME_TYPE.
-                if (c < 8 or c == 0xFF) {
+                if (c < 8 or c == kiss::FRAME_ACKMODE or c == 0xFF) {
                     frame->type(c);
                     state = WAIT_FEND;
                 } else {
@@ -239,6 +282,8 @@ void startSerialTask(void const* arg)
 extern "C" void HAL_UART_TxCpltCallback(UART_HandleTypeDef*)
 {
     txDoneFlag = true;
+    // Send anything batched while this transfer was in progress.
+    if (!txFilling) start_tx();
 }
 
 extern "C" void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
@@ -253,8 +298,7 @@ extern "C" void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
     if (!block) return;
     memmove(block->buffer + 1, rxBuffer, len);
     block->buffer[0] = len;
-    auto status = osMessagePut(mobilinkd::tnc::getSerialPort()->queue(), (uint32_t) block, 0);
-    if (status != osOK) serialPool.deallocate(block);
+    if (!serialBlocks.put_from_isr(block)) serialPool.deallocate(block);
 }
 
 extern "C" void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
@@ -272,8 +316,7 @@ extern "C" void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
     if (!block) return;
     memmove(block->buffer + 1, rxBuffer + RX_BUFFER_SIZE, len);
     block->buffer[0] = len;
-    auto status = osMessagePut(mobilinkd::tnc::getSerialPort()->queue(), (uint32_t) block, 0);
-    if (status != osOK) serialPool.deallocate(block);
+    if (!serialBlocks.put_from_isr(block)) serialPool.deallocate(block);
 }
 
 extern "C" void idleInterruptCallback(UART_HandleTypeDef* huart)
@@ -300,32 +343,34 @@ extern "C" void idleInterruptCallback(UART_HandleTypeDef* huart)
 
     HAL_UART_Receive_DMA(huart, rxBuffer, RX_BUFFER_SIZE * 2);
 
-    auto status = osMessagePut(mobilinkd::tnc::getSerialPort()->queue(), (uint32_t) block, 0);
-    if (status != osOK) serialPool.deallocate(block);
+    if (!serialBlocks.put_from_isr(block)) serialPool.deallocate(block);
 
 }
 
 extern "C" void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
 {
-    osMessagePut(mobilinkd::tnc::getSerialPort()->queue(), huart->ErrorCode, 0);
+    mobilinkd::tnc::stats::count(mobilinkd::tnc::stats::counters().uart_errors);
     uart_error.store((huart->gState<<16) | huart->ErrorCode);
+    serialBlocks.notify_from_isr(SERIAL_RX_ERROR);
     huart->ErrorCode = HAL_UART_ERROR_NONE;
     huart->gState = HAL_UART_STATE_READY;
 }
 
 namespace mobilinkd { namespace tnc {
 
+uint32_t serialTaskBuffer[ 128 ];
+osStaticThreadDef_t serialTaskControlBlock;
+osStaticMutexDef_t uartMutexControlBlock;
+
 void SerialPort::init()
 {
     if (serialTaskHandle_) return;
 
-    osMessageQDef(uartQueue, 32, void*);
-    queue_ = osMessageCreate(osMessageQ(uartQueue), 0);
-
-    osMutexDef(uartMutex);
+    osMutexStaticDef(uartMutex, &uartMutexControlBlock);
     mutex_ = osMutexCreate(osMutex(uartMutex));
 
-    osThreadDef(serialTask, startSerialTask, osPriorityAboveNormal, 0, 128);
+    osThreadStaticDef(serialTask, startSerialTask, osPriorityAboveNormal, 0, 128,
+        serialTaskBuffer, &serialTaskControlBlock);
     serialTaskHandle_ = osThreadCreate(osThread(serialTask), this);
 #ifndef NUCLEOTNC
     DEBUG("serialTaskHandle_ = %p", serialTaskHandle_);
@@ -345,68 +390,129 @@ void SerialPort::close()
     open_ = false;
 }
 
-bool SerialPort::write(const uint8_t* data, uint32_t size, uint8_t type, uint32_t timeout)
+/*
+ * Wait for the DMA transfer in progress to complete.  This is where
+ * backpressure is applied.  The BM78 deasserts CTS when it cannot keep up
+ * and the DMA transfer stalls.  Only when no progress has been made for
+ * TX_STALL_TIMEOUT is the module assumed to be hung and reset.
+ *
+ * @return true when the DMA is idle, false on timeout.
+ */
+bool SerialPort::wait_tx(uint32_t start, uint32_t timeout)
 {
-    if (!open_) return false;
-
-    uint32_t start = osKernelSysTick();
-
-    if (osMutexWait(mutex_, timeout) != osOK)
-        return false;
-
-    using ::mobilinkd::tnc::kiss::slip_encoder;
+    while (!txDoneFlag)
+    {
+        if (!open_) return false;
+
+        uint32_t now = osKernelSysTick();
+        uint32_t remaining = __HAL_DMA_GET_COUNTER(huart_serial.hdmatx);
+        if (remaining != txProgressCount) {
+            txProgressCount = remaining;
+            txProgressTick = now;
+        } else if (now - txProgressTick > TX_STALL_TIMEOUT) {
+            abort_tx();
+            return false;
+        }
 
-    auto slip_iter = slip_encoder((const char*)data, size);
-    auto slip_end = slip_encoder();
+        if (now - start > timeout) return false;
+        osDelay(1);
+    }
+    return true;
+}
 
-    size_t pos = 0;
-    memset(tmpBuffer, 0, TX_BUFFER_SIZE);
+/*
+ * Append a byte to the fill buffer.  When the fill buffer is full, wait
+ * for the DMA to complete and start sending it.
+ */
+inline bool SerialPort::put(uint8_t c, size_t& mark, uint32_t start, uint32_t timeout)
+{
+    if (txFill == SERIAL_TX_BUFFER_SIZE)
+    {
+        if (!wait_tx(start, timeout)) return false;
+        taskENTER_CRITICAL();
+        start_tx();
+        taskEXIT_CRITICAL();
+        mark = 0;
+        txSplit = true;
+    }
+    txBuffer[txIndex][txFill] = c;
+    txFill = txFill + 1;
+    return true;
+}
 
-    tmpBuffer[pos++] = 0xC0;   // FEND
-    tmpBuffer[pos++] = type;   // KISS Data Frame
+/// Send what has been filled if the DMA is idle.
+void SerialPort::end_fill()
+{
+    taskENTER_CRITICAL();
+    txFilling = false;
+    if (txDoneFlag) start_tx();
+    taskEXIT_CRITICAL();
+}
 
-    while (slip_iter != slip_end) {
-        tmpBuffer[pos++] = *slip_iter++;
-        if (pos == TX_BUFFER_SIZE) {
+/*
+ * SLIP-encode a KISS frame into the transmit buffers.  The frame is sent
+ * immediately if the DMA is idle, otherwise it is sent, along with any
+ * other frames written in the meantime, when the current transfer ends.
+ *
+ * If the timeout expires, the unsent part of the frame is dropped.  The
+ * module is not reset.  If the start of the frame has already been sent,
+ * the frame is ended with an invalid escape (FESC FEND) so that the host
+ * discards it.  The fill buffer held only this frame's bytes, which are
+ * dropped, so there is room for the two bytes.
+ */
+template <typename Iterator>
+bool SerialPort::send(Iterator first, Iterator last, uint8_t type,
+    uint32_t start, uint32_t timeout)
+{
+    txFilling = true;
+    txSplit = false;
+    size_t mark = txFill;   // Start of this frame in the fill buffer.
 
-            while (!txDoneFlag) osThreadYield();
-            memcpy(TxBuffer, tmpBuffer, TX_BUFFER_SIZE);
-            txDoneFlag = false;
+    bool result = put(0xC0, mark, start, timeout)  // FEND
+        and put(type, mark, start, timeout);        // KISS frame type
 
-            while (open_ and HAL_UART_Transmit_DMA(&huart_serial, TxBuffer, TX_BUFFER_SIZE) == HAL_BUSY)
-            {
-                if (osKernelSysTick() - start > timeout) {
-                    osMutexRelease(mutex_);
-                    txDoneFlag = true;
-                    return false;
-                }
-                osThreadYield();
-            }
-            pos = 0;
-            memset(TxBuffer, 0, TX_BUFFER_SIZE);
-        }
+    while (result and first != last) {
+        result = put(*first++, mark, start, timeout);
     }
 
-    // Buffer has room for at least one more byte.
-    tmpBuffer[pos++] = 0xC0;
-    while (!txDoneFlag) osThreadYield();
-    memcpy(TxBuffer, tmpBuffer, pos);
-    txDoneFlag = false;
-    while (open_ and HAL_UART_Transmit_DMA(&huart_serial, TxBuffer, pos) == HAL_BUSY)
-    {
-        if (osKernelSysTick() - start > timeout) {
-            osMutexRelease(mutex_);
-            txDoneFlag = true;
-            return false;
+    if (result) result = put(0xC0, mark, start, timeout);
+    if (!result) {
+        txFill = mark;
+        if (txSplit) {
+            txBuffer[txIndex][txFill] = 0xDB;       // FESC
+            txBuffer[txIndex][txFill + 1] = 0xC0;   // FEND
+            txFill = txFill + 2;
         }
-        osThreadYield();
     }
 
+    end_fill();
+    return result;
+}
+
+bool SerialPort::write(const uint8_t* data, uint32_t size, uint8_t type, uint32_t timeout)
+{
+    if (!open_) return false;
+
+    uint32_t start = osKernelSysTick();
+
+    if (osMutexWait(mutex_, timeout) != osOK)
+        return false;
+
+    using ::mobilinkd::tnc::kiss::slip_encoder;
+
+    auto result = send(slip_encoder((const char*)data, size), slip_encoder(),
+        type, start, timeout);
+
     osMutexRelease(mutex_);
 
-    return true;
+    return result;
 }
 
+/*
+ * Write unframed data, such as log text, followed by CR LF.  This goes
+ * through the transmit buffers so that it is not mixed into a batched
+ * transfer.
+ */
 bool SerialPort::write(const uint8_t* data, uint32_t size, uint32_t timeout)
 {
     if (!open_) return false;
@@ -416,75 +522,52 @@ bool SerialPort::write(const uint8_t* data, uint32_t size, uint32_t timeout)
     if (osMutexWait(mutex_, timeout) != osOK)
         return false;
 
-    size_t pos = 0;
-    memset(TxBuffer, 0, TX_BUFFER_SIZE);
-
-    auto first = data;
-    auto last = data + size;
+    txFilling = true;
+    txSplit = false;
+    size_t mark = txFill;
 
-    while (first != last) {
-        TxBuffer[pos++] = *first++;
-        if (pos == TX_BUFFER_SIZE) {
-            while (open_ and HAL_UART_Transmit(&huart_serial, TxBuffer, TX_BUFFER_SIZE, timeout) == HAL_BUSY)
-            {
-                if (osKernelSysTick() - start > timeout) {
-                    osMutexRelease(mutex_);
-                    return false;
-                }
-                osThreadYield();
-            }
-            pos = 0;
-            memset(TxBuffer, 0, TX_BUFFER_SIZE);
-        }
+    bool result = true;
+    for (auto first = data, last = data + size; result and first != last;) {
+        result = put(*first++, mark, start, timeout);
     }
-
-    while (open_ and HAL_UART_Transmit(&huart_serial, TxBuffer, TX_BUFFER_SIZE, timeout) == HAL_BUSY)
-    {
-        if (osKernelSysTick() - start > timeout) {
-            osMutexRelease(mutex_);
-            return false;
-        }
-        osThreadYield();
+    if (result) {
+        result = put('\r', mark, start, timeout)
+            and put('\n', mark, start, timeout);
     }
+    if (!result) txFill = mark;
 
-    while (open_ and HAL_UART_Transmit(&huart_serial, (uint8_t*)"\r\n", 2, timeout) == HAL_BUSY)
-    {
-        if (osKernelSysTick() - start > timeout) {
-            osMutexRelease(mutex_);
-            return false;
-        }
-        osThreadYield();
-    }
+    end_fill();
 
     osMutexRelease(mutex_);
 
-    return true;
+    return result;
 }
 
 /*
- * Abort the DMA transmission. Release the mutex and the frame.  Set the
+ * Abort the DMA transmission and discard anything batched.  Set the
  * txDoneFlag so other writes may be attempted.
  *
  * This really sucks. The BM78 seems to just give up the ghost in BLE mode
  * when connected for long periods of time (and long is relative, but
  * typically more than an hour).  To deal with this, we reset the device
  * and the client needs to attempt to reconnect when disconnection is
- * detected.
+ * detected.  This is only done when the module has accepted no data for
+ * TX_STALL_TIMEOUT.  A slow link is handled by flow control.
  */
-bool SerialPort::abort_tx(hdlc::IoFrame* frame)
+void SerialPort::abort_tx()
 {
     HAL_UART_AbortTransmit(&huart_serial);
-    hdlc::release(frame);
 #ifndef NUCLEOTNC
-    WARN("SerialPort::write timed out -- DMA aborted.");
+    WARN("SerialPort::write stalled -- DMA aborted.");
     HAL_GPIO_WritePin(BT_RESET_GPIO_Port, BT_RESET_Pin, GPIO_PIN_RESET);
     osDelay(1);
     HAL_GPIO_WritePin(BT_RESET_GPIO_Port, BT_RESET_Pin, GPIO_PIN_SET);
     bm78_wait_until_ready();
 #endif
+    taskENTER_CRITICAL();
+    txFill = 0;
     txDoneFlag = true;
-    osMutexRelease(mutex_);
-    return false;
+    taskEXIT_CRITICAL();
 }
 
 bool SerialPort::write(hdlc::IoFrame* frame, uint32_t timeout)
@@ -507,70 +590,15 @@ bool SerialPort::write(hdlc::IoFrame* frame, uint32_t timeout)
     hdlc::IoFrame::iterator end = frame->begin();
     std::advance(end, frame->size() - 2);           // Drop FCS
 
-    slip_encoder2 slip_iter{begin};
-    slip_encoder2 slip_end{end};
-
-    size_t pos = 0;
-
-    tmpBuffer[pos++] = 0xC0;   // FEND
-    tmpBuffer[pos++] = static_cast<int>(frame->type());   // KISS Data Frame
-
-    while (slip_iter != slip_end)
-    {
-        tmpBuffer[pos++] = *slip_iter++;
-        if (pos == TX_BUFFER_SIZE) {
-            while (!txDoneFlag) {
-                // txDoneFlag set in HAL_UART_TxCpltCallback() above when DMA completes.
-                if (osKernelSysTick() - start > timeout) {
-                    return abort_tx(frame); // Abort DMA xfer on timeout.
-                } else {
-                    osThreadYield();
-                }
-            }
-            memcpy(TxBuffer, tmpBuffer, TX_BUFFER_SIZE);
-            txDoneFlag = false;
-            while (open_ and HAL_UART_Transmit_DMA(&huart_serial, TxBuffer, TX_BUFFER_SIZE) == HAL_BUSY)
-            {
-                // This should not happen.  HAL_BUSY should not occur when txDoneFlag set.
-                if (osKernelSysTick() - start > timeout) {
-                    return abort_tx(frame); // Abort DMA xfer on timeout.
-                } else {
-                    osThreadYield();
-                }
-            }
-            pos = 0;
-        }
-    }
-
-    // Buffer has room for at least one more byte.
-    tmpBuffer[pos++] = 0xC0;
-
-    while (!txDoneFlag) {
-        // txDoneFlag set in HAL_UART_TxCpltCallback() above when DMA completes.
-        if (osKernelSysTick() - start > timeout) {
-            return abort_tx(frame); // Abort DMA xfer on timeout.
-        } else {
-            osThreadYield();
-        }
-    }
-
-    memcpy(TxBuffer, tmpBuffer, TX_BUFFER_SIZE);
-    txDoneFlag = false;
-    while (open_ and HAL_UART_Transmit_DMA(&huart_serial, TxBuffer, pos) == HAL_BUSY) {
-        // This should not happen.  HAL_BUSY should not occur when txDoneFlag set.
-        if (osKernelSysTick() - start > timeout) {
-            return abort_tx(frame); // Abort DMA xfer on timeout.
-        } else {
-            osThreadYield();
-        }
-    }
+    auto result = send(slip_encoder2{begin}, slip_encoder2{end},
+        static_cast<int>(frame->type()), start, timeout);
 
     osMutexRelease(mutex_);
     hdlc::release(frame);
 
-    DEBUG("SerialPort::write COMPLETE");
+    if (result) DEBUG("SerialPort::write COMPLETE");
 
-    return true;
+    return result;
 }
 
 
@@ -18,7 +18,8 @@ struct SerialPort : PortInterface
     virtual bool open();
     virtual bool isOpen() const { return open_; }
     virtual void close();
-    virtual osMessageQId queue() const { return queue_; }
+    // Received data is passed directly to the serial task.
+    virtual osMessageQId queue() const { return 0; }
     virtual bool write(const uint8_t* data, uint32_t size, uint8_t type,
         uint32_t timeout);
     virtual bool write(const uint8_t* data, uint32_t size, uint32_t timeout);
@@ -29,10 +30,16 @@ struct SerialPort : PortInterface
 private:
     bool open_{false};                  // opened/closed
     osMutexId mutex_{0};                // TX Mutex
-    osMessageQId queue_{0};             // ISR read queue
     osThreadId serialTaskHandle_{0};
 
-    bool abort_tx(hdlc::IoFrame* frame);
+    void abort_tx();
+    bool wait_tx(uint32_t start, uint32_t timeout);
+    bool put(uint8_t c, size_t& mark, uint32_t start, uint32_t timeout);
+    void end_fill();
+
+    template <typename Iterator>
+    bool send(Iterator first, Iterator last, uint8_t type, uint32_t start,
+        uint32_t timeout);
 };
 
 SerialPort* getSerialPort();
@@ -0,0 +1,163 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "SettingsWriter.hpp"
+#include "IOEventTask.h"
+#include "Log.h"
+#include "main.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern I2C_HandleTypeDef hi2c1;
+
+extern "C" void startSettingsWriterTask(void const*)
+{
+    mobilinkd::tnc::kiss::settingsWriter().run();
+}
+
+extern "C" void flushSettings(void)
+{
+    mobilinkd::tnc::kiss::settingsWriter().flush(1000);
+}
+
+namespace mobilinkd { namespace tnc { namespace kiss {
+
+namespace {
+
+// Too large for the writer task's stack.
+std::array<uint8_t, SettingsWriter::SIZE> snapshot;
+
+}
+
+SettingsWriter& settingsWriter()
+{
+    static SettingsWriter instance;
+    return instance;
+}
+
+const Hardware* SettingsWriter::load()
+{
+    if (!I2C_Storage::load(shadow_.data(), SIZE)) return nullptr;
+    shadow_valid_ = true;
+    return reinterpret_cast<const Hardware*>(shadow_.data());
+}
+
+void SettingsWriter::request()
+{
+    requested_.fetch_add(1);
+    if (settingsWriterTaskHandle) {
+        xTaskNotify(settingsWriterTaskHandle, COMMIT, eSetBits);
+    }
+}
+
+bool SettingsWriter::flush(uint32_t timeout)
+{
+    uint32_t target = requested_.load();
+    if (committed_.load() == target) return true;
+
+    xTaskNotify(settingsWriterTaskHandle, FLUSH, eSetBits);
+
+    uint32_t start = osKernelSysTick();
+    while (int32_t(attempted_.load() - target) < 0)
+    {
+        if (osKernelSysTick() - start > timeout) {
+            ERROR("EEPROM flush timed out");
+            return false;
+        }
+        osDelay(I2C_Storage::write_time);
+    }
+    return int32_t(committed_.load() - target) >= 0;
+}
+
+void SettingsWriter::run()
+{
+    bool retry = false;
+
+    while (true)
+    {
+        uint32_t events = 0;
+        bool retrying = false;
+        if (xTaskNotifyWait(0, COMMIT | FLUSH, &events,
+            retry ? RETRY : portMAX_DELAY) != pdTRUE)
+        {
+            events = COMMIT;    // Retry after a write error.
+            retrying = true;
+        }
+
+        // Wait for the host to finish sending changes.
+        uint32_t start = osKernelSysTick();
+        while (!(events & FLUSH) and osKernelSysTick() - start < MAX_DELAY)
+        {
+            if (xTaskNotifyWait(0, COMMIT | FLUSH, &events, COALESCE) != pdTRUE) break;
+        }
+
+        uint32_t generation = commit();
+        retry = result_.status != OK;
+        if (!retry) committed_.store(generation);
+        attempted_.store(generation);
+        // Failed retries have already been reported.
+        if (!retrying or !retry) {
+            osMessagePut(ioEventQueueHandle, CMD_SETTINGS_COMMITTED, 100);
+        }
+    }
+}
+
+/**
+ * Write the pages of settings() that differ from the shadow.
+ *
+ * @return the request count covered by this commit.
+ */
+uint32_t SettingsWriter::commit()
+{
+    // Settings are only changed by tasks.  Take a consistent copy.
+    vTaskSuspendAll();
+    uint32_t generation = requested_.load();
+    memcpy(snapshot.data(), &settings(), SIZE);
+    xTaskResumeAll();
+
+    result_ = Result{OK, 0};
+
+    if (HAL_I2C_Init(&hi2c1) != HAL_OK) CxxErrorHandler();
+
+    for (size_t page = 0; page != PAGES; ++page)
+    {
+        size_t offset = page * I2C_Storage::page_size;
+        size_t len = std::min<size_t>(I2C_Storage::page_size, SIZE - offset);
+
+        if (shadow_valid_ and
+            memcmp(snapshot.data() + offset, shadow_.data() + offset, len) == 0)
+        {
+            continue;
+        }
+
+        auto status = HAL_I2C_Mem_Write(&hi2c1, I2C_Storage::i2c_address,
+            offset, I2C_MEMADD_SIZE_16BIT, snapshot.data() + offset, len, 20);
+        osDelay(I2C_Storage::write_time);
+
+        if (status != HAL_OK) {
+            ERROR("EEPROM write page %u error = %lu.", unsigned(page), hi2c1.ErrorCode);
+            result_.status = WRITE_ERROR;
+            continue;   // Retried after RETRY ms.
+        }
+
+        // A page is only marked clean once written, so a partial commit
+        // leaves the shadow accurate.
+        memcpy(shadow_.data() + offset, snapshot.data() + offset, len);
+        ++result_.pages;
+    }
+
+    if (HAL_I2C_DeInit(&hi2c1) != HAL_OK) CxxErrorHandler();
+
+    // Pages not written above still differ from the shadow.
+    if (result_.status == OK) shadow_valid_ = true;
+
+    INFO("EEPROM commit: %d pages written", int(result_.pages));
+
+    return generation;
+}
+
+}}} // mobilinkd::tnc::kiss
@@ -0,0 +1,90 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "KissHardware.hpp"
+
+#include "cmsis_os.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+extern "C" osThreadId settingsWriterTaskHandle;
+
+namespace mobilinkd { namespace tnc { namespace kiss {
+
+/**
+ * Writes the settings to EEPROM from a low-priority background task.
+ *
+ * A shadow copy of the EEPROM contents is kept.  A commit compares a
+ * snapshot of settings() with the shadow one EEPROM page at a time and
+ * writes only the pages that differ.  Requests made within COALESCE ms of
+ * each other (a config app sending a burst of SET commands, each followed
+ * by SAVE) are combined into one commit, delayed by at most MAX_DELAY.
+ *
+ * When a commit completes, the IO event task is sent CMD_SETTINGS_COMMITTED
+ * and reports the result to the host with EXT_SETTINGS_COMMITTED.  A
+ * commit with write errors is retried after RETRY ms until it succeeds.
+ */
+struct SettingsWriter
+{
+    static constexpr size_t SIZE = sizeof(Hardware);
+    static constexpr size_t PAGES =
+        (SIZE + I2C_Storage::page_size - 1) / I2C_Storage::page_size;
+    static constexpr uint32_t COALESCE = 250;       // ms.
+    static constexpr uint32_t MAX_DELAY = 2000;     // ms.
+    static constexpr uint32_t RETRY = 1000;         // ms.
+
+    // Task notification bits.
+    static constexpr uint32_t COMMIT = 1;
+    static constexpr uint32_t FLUSH = 2;            // Commit without delay.
+
+    enum Status : uint8_t { OK = 0, WRITE_ERROR = 1 };
+
+    struct Result
+    {
+        Status status;
+        uint8_t pages;          ///< Pages written.
+    };
+
+    alignas(4) std::array<uint8_t, SIZE> shadow_;
+    bool shadow_valid_{false};
+    std::atomic<uint32_t> requested_{0};
+    std::atomic<uint32_t> committed_{0};   ///< Requests written.
+    std::atomic<uint32_t> attempted_{0};   ///< Requests tried.
+    Result result_{OK, 0};
+
+    /**
+     * Read the EEPROM into the shadow copy.
+     *
+     * @return the settings as stored, which may fail the CRC check, or
+     *  nullptr if the EEPROM could not be read.
+     */
+    const Hardware* load();
+
+    /// Schedule a commit of settings().
+    void request();
+
+    /**
+     * Commit any pending changes now and wait for the write to finish.
+     * Used before a reset.
+     *
+     * @return false on timeout or if the write failed.
+     */
+    bool flush(uint32_t timeout);
+
+    /// Wait for requests and commit them.  Runs in the writer task.
+    [[noreturn]] void run();
+
+    Result result() const { return result_; }
+
+private:
+
+    uint32_t commit();
+};
+
+SettingsWriter& settingsWriter();
+
+}}} // mobilinkd::tnc::kiss
@@ -0,0 +1,213 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "Statistics.hpp"
+#include "HdlcFrame.hpp"
+#include "IOEventTask.h"
+#include "Log.h"
+#include "main.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" char _Heap_Begin;    // Defined by the linker.
+extern "C" char _Heap_Limit;    // Defined by the linker.
+extern "C" caddr_t _sbrk_heap_end(void);
+extern "C" caddr_t _sbrk_high_water(void);
+
+extern "C" void pushCounters(void const*)
+{
+    // Runs in the timer task.  The IO event task owns the port.
+    osMessagePut(ioEventQueueHandle, CMD_PUSH_COUNTERS, 0);
+}
+
+namespace mobilinkd { namespace tnc { namespace stats {
+
+namespace {
+uint16_t push_interval_{0};
+}
+
+Counters::Counters()
+{
+    reset();
+}
+
+void Counters::reset()
+{
+    rx_frames = 0;
+    for (auto& c : decoded) c = 0;
+    crc_errors = 0;
+    passall_frames = 0;
+    adc_drops = 0;
+    uart_errors = 0;
+    usb_drops = 0;
+    tx_frames = 0;
+    csma_drops = 0;
+    dac_underruns = 0;
+    io_event_hwm = 0;
+    adc_input_hwm = 0;
+    hdlc_output_hwm = 0;
+    serial_input_hwm = 0;
+    frame_pool_lwm = hdlc::IoFramePool::capacity();
+    squelch_wakes = 0;
+    wake_latency_max = 0;
+    modem_switch_latency = 0;
+    digi_frames = 0;
+    digi_dupes = 0;
+    digi_cancelled = 0;
+    ack_drops = 0;
+    digi_drops = 0;
+}
+
+Counters::record_type Counters::record() const
+{
+    const uint32_t values[FIELDS] = {
+        osKernelSysTick(),
+        rx_frames, decoded[0], decoded[1], decoded[2],
+        crc_errors, passall_frames, adc_drops, uart_errors, usb_drops,
+        tx_frames, csma_drops, dac_underruns,
+        io_event_hwm, adc_input_hwm, hdlc_output_hwm, serial_input_hwm,
+        frame_pool_lwm, squelch_wakes, wake_latency_max,
+        modem_switch_latency, first_decode, digi_frames, digi_dupes,
+        digi_cancelled, ack_drops, digi_drops
+    };
+
+    record_type result;
+    auto out = result.begin();
+    *out++ = VERSION;
+    *out++ = FIELDS;
+    for (auto value : values) {
+        *out++ = (value >> 24) & 0xFF;
+        *out++ = (value >> 16) & 0xFF;
+        *out++ = (value >> 8) & 0xFF;
+        *out++ = value & 0xFF;
+    }
+    return result;
+}
+
+Counters& counters()
+{
+    static Counters instance;
+    return instance;
+}
+
+void frame_pool_low_water()
+{
+    auto& lwm = counters().frame_pool_lwm;
+    uint32_t available = hdlc::ioFramePool().size();
+    if (available < lwm.load(std::memory_order_relaxed)) lwm.store(available);
+}
+
+void set_push_interval(uint16_t seconds)
+{
+    push_interval_ = seconds;
+    if (seconds) {
+        osTimerStart(countersTimerHandle, seconds * 1000);
+    } else {
+        osTimerStop(countersTimerHandle);
+    }
+}
+
+uint16_t push_interval()
+{
+    return push_interval_;
+}
+
+namespace {
+
+uint8_t* put32(uint8_t* out, uint32_t value)
+{
+    *out++ = (value >> 24) & 0xFF;
+    *out++ = (value >> 16) & 0xFF;
+    *out++ = (value >> 8) & 0xFF;
+    *out++ = value & 0xFF;
+    return out;
+}
+
+uint8_t* put16(uint8_t* out, uint16_t value)
+{
+    *out++ = (value >> 8) & 0xFF;
+    *out++ = value & 0xFF;
+    return out;
+}
+
+}
+
+TaskStats& task_stats()
+{
+    static TaskStats instance;
+    return instance;
+}
+
+size_t TaskStats::record(uint8_t* buffer)
+{
+    // Too large for the stack of the IO event task.
+    static TaskStatus_t status[MAX_TASKS];
+
+    uint32_t total = 0;
+    auto running = uxTaskGetNumberOfTasks();
+    // This returns 0, and leaves total 0, when status is too small.
+    auto count = uxTaskGetSystemState(status, MAX_TASKS, &total);
+    if (count == 0) {
+        WARN("%lu tasks; only %u fit", running, unsigned(MAX_TASKS));
+        total = portGET_RUN_TIME_COUNTER_VALUE();
+    }
+    uint32_t elapsed = total - last_total_;
+    last_total_ = total;
+
+    // The heap (heap_3) is newlib's malloc.  Free memory is what has been
+    // returned to malloc plus what has not yet been taken with sbrk().
+    // The lowest free is a lower bound since it ignores fragmentation.
+    auto info = mallinfo();
+    uint32_t heap_size = &_Heap_Limit - &_Heap_Begin;
+    uint32_t heap_free = (&_Heap_Limit - _sbrk_heap_end()) + info.fordblks;
+    uint32_t heap_min = &_Heap_Limit - _sbrk_high_water();
+
+    auto out = buffer;
+    *out++ = VERSION;
+    *out++ = count;
+    *out++ = std::min<UBaseType_t>(running, 0xFF);
+    out = put32(out, elapsed);
+    out = put32(out, heap_size);
+    out = put32(out, heap_free);
+    out = put32(out, heap_min);
+
+    std::array<Previous, MAX_TASKS> current;
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        auto& task = status[i];
+
+        // Tasks that started since the last request count from zero.
+        uint32_t last = 0;
+        auto it = std::find_if(previous_.begin(), previous_.end(),
+            [&task](const Previous& p) { return p.number == task.xTaskNumber; });
+        if (it != previous_.end()) last = it->counter;
+
+        uint32_t used = task.ulRunTimeCounter - last;
+        uint32_t load = elapsed ? uint64_t(used) * 1000 / elapsed : 0;
+
+        current[i] = Previous{task.xTaskNumber, task.ulRunTimeCounter};
+
+        std::memset(out, 0, NAME_LEN);
+        std::strncpy(reinterpret_cast<char*>(out), task.pcTaskName, NAME_LEN);
+        out += NAME_LEN;
+        out = put16(out, std::min<uint32_t>(load, 1000));
+        out = put16(out, task.usStackHighWaterMark);
+        *out++ = task.uxCurrentPriority;
+        *out++ = task.eCurrentState;
+    }
+
+    // Task numbers start at 1.
+    std::fill(current.begin() + count, current.end(), Previous{0, 0});
+    previous_ = current;
+
+    return out - buffer;
+}
+
+}}} // mobilinkd::tnc::stats
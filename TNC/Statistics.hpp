@@ -0,0 +1,146 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#include "cmsis_os.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+extern "C" void pushCounters(void const* argument);
+
+extern osTimerId countersTimerHandle;
+
+namespace mobilinkd { namespace tnc { namespace stats {
+
+/**
+ * Runtime counters.  These are always compiled in, unlike the logging
+ * macros, and are returned to the host as a binary record by the
+ * EXT_GET_COUNTERS command.  They are cheap enough to be updated from
+ * interrupt handlers.
+ */
+struct Counters
+{
+    using counter_type = std::atomic<uint32_t>;
+
+    static constexpr uint8_t VERSION = 1;
+    static constexpr size_t DECODERS = 3;
+
+    counter_type rx_frames{0};          ///< Frames passed up from the demodulator.
+    std::array<counter_type, DECODERS> decoded{};  ///< Frames from each HDLC decoder.
+    counter_type crc_errors{0};
+    counter_type passall_frames{0};     ///< Frames with CRC errors passed up.
+    counter_type adc_drops{0};          ///< ADC blocks lost (pool/queue full).
+    counter_type uart_errors{0};
+    counter_type usb_drops{0};
+    counter_type tx_frames{0};
+    counter_type csma_drops{0};
+    counter_type dac_underruns{0};
+    counter_type io_event_hwm{0};       ///< Queue high-water marks.
+    counter_type adc_input_hwm{0};
+    counter_type hdlc_output_hwm{0};
+    counter_type serial_input_hwm{0};
+    counter_type frame_pool_lwm{0};     ///< Fewest free frames seen.
+    counter_type squelch_wakes{0};      ///< Restarts after a silent channel.
+    counter_type wake_latency_max{0};   ///< Worst-case restart latency, us.
+    counter_type modem_switch_latency{0};   ///< Latest modem switch, us.
+    counter_type first_decode{0};       ///< ms from boot to the first frame; not reset.
+    counter_type digi_frames{0};        ///< Frames digipeated.
+    counter_type digi_dupes{0};         ///< Duplicates not digipeated.
+    counter_type digi_cancelled{0};     ///< Held frames heard repeated by another digi.
+    counter_type ack_drops{0};          ///< ACKMODE replies lost (IO queue full).
+    counter_type digi_drops{0};         ///< Digipeated frames lost (TX queue full).
+
+    static constexpr size_t FIELDS = 27;    // Including uptime.
+    using record_type = std::array<uint8_t, FIELDS * 4 + 2>;
+
+    Counters();
+
+    void reset();
+
+    /**
+     * Return the record sent to the host: version (uint8_t), the number
+     * of fields (uint8_t), then each field as a big-endian uint32_t.  The
+     * first field is the uptime in ms.  New fields are only ever appended.
+     */
+    record_type record() const;
+};
+
+Counters& counters();
+
+inline void count(Counters::counter_type& counter)
+{
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// Record a queue depth.
+inline void high_water(Counters::counter_type& hwm, uint32_t depth)
+{
+    if (depth > hwm.load(std::memory_order_relaxed)) hwm.store(depth);
+}
+
+/// Record the current depth of a queue, including a message just removed.
+inline void high_water(Counters::counter_type& hwm, osMessageQId queue,
+    uint32_t removed = 1)
+{
+    high_water(hwm, uint32_t(osMessageWaiting(queue) + removed));
+}
+
+/// Record the number of frames remaining in the frame pool.
+void frame_pool_low_water();
+
+/// Start (seconds > 0) or stop (0) periodic push of the counters record.
+void set_push_interval(uint16_t seconds);
+uint16_t push_interval();
+
+/**
+ * Per-task CPU load and stack high-water marks, and heap usage, returned
+ * to the host by the EXT_GET_TASK_STATS command.
+ *
+ * CPU load is measured over the interval since the previous request (or
+ * since boot for the first), using the FreeRTOS run time counters, which
+ * count microseconds.  The idle task is included, so its load is the
+ * time the processor was free.
+ *
+ * The record is: version (uint8_t), number of tasks reported (uint8_t),
+ * number of tasks running (uint8_t), then the interval in us, the heap
+ * size, free heap and the lowest free heap seen (all big-endian uint32_t),
+ * then for each task: name (NAME_LEN bytes, NUL padded), CPU load in
+ * tenths of a percent (uint16_t), minimum free stack in words (uint16_t),
+ * priority (uint8_t) and state (uint8_t, eTaskState).
+ *
+ * MAX_TASKS leaves room for tasks to be added.  If there are more tasks
+ * than that, none are reported; the host sees more running than reported.
+ */
+struct TaskStats
+{
+    static constexpr uint8_t VERSION = 2;
+    static constexpr size_t MAX_TASKS = 16;
+    static constexpr size_t NAME_LEN = 8;
+    static constexpr size_t HEADER_SIZE = 3 + 4 * 4;
+    static constexpr size_t TASK_SIZE = NAME_LEN + 6;
+    static constexpr size_t RECORD_SIZE = HEADER_SIZE + MAX_TASKS * TASK_SIZE;
+
+    struct Previous
+    {
+        uint32_t number;        ///< FreeRTOS task number.
+        uint32_t counter;       ///< Run time counter at the last request.
+    };
+
+    std::array<Previous, MAX_TASKS> previous_{};
+    uint32_t last_total_{0};
+
+    /**
+     * Write the record to the buffer, which must hold RECORD_SIZE bytes.
+     * Returns the number of bytes written.
+     *
+     * @note This may only be called from one task at a time.
+     */
+    size_t record(uint8_t* buffer);
+};
+
+TaskStats& task_stats();
+
+}}} // mobilinkd::tnc::stats
@@ -0,0 +1,162 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#include "Trace.h"
+
+#ifdef KISS_LOG_TRACE
+
+#include "stm32l4xx_hal.h"
+#include "cmsis_os.h"
+
+#include <array>
+#include <cstring>
+
+namespace mobilinkd { namespace tnc { namespace trace {
+
+constexpr uint32_t MAGIC = 0xA5000000;
+constexpr size_t MAX_ARGS = 8;                  // Words.
+constexpr size_t RING_SIZE = 512;               // Words.  Must be a power of 2.
+constexpr uint32_t TRACE_PORT = 1;              // ITM stimulus port.
+
+std::array<uint32_t, RING_SIZE> ring;
+volatile size_t head{0};
+volatile size_t tail{0};
+uint8_t sequence{0};
+
+/**
+ * Scan the format string and copy the arguments into args.  This only
+ * needs to skip over flags, width and precision, and understand length
+ * modifiers well enough to size each argument.
+ *
+ * @return the number of words written to args.
+ */
+size_t capture(const char* fmt, va_list ap, uint32_t* args)
+{
+    size_t count = 0;
+
+    while (*fmt and count != MAX_ARGS)
+    {
+        if (*fmt++ != '%') continue;
+        if (*fmt == '%') { ++fmt; continue; }
+
+        // Flags, width and precision.
+        while (*fmt and strchr("-+ #0123456789.*", *fmt)) {
+            if (*fmt == '*') args[count++] = va_arg(ap, int);
+            ++fmt;
+            if (count == MAX_ARGS) return count;
+        }
+
+        int longs = 0;
+        while (*fmt and strchr("hlLzjt", *fmt)) {
+            if (*fmt == 'l') ++longs;
+            ++fmt;
+        }
+
+        switch (*fmt) {
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        case 'a': case 'A':
+            if (count + 2 > MAX_ARGS) return count;
+            {
+                double d = va_arg(ap, double);
+                memcpy(args + count, &d, sizeof(d));
+                count += 2;
+            }
+            break;
+        case 0:
+            return count;
+        default:
+            if (longs == 2) {
+                if (count + 2 > MAX_ARGS) return count;
+                uint64_t ll = va_arg(ap, unsigned long long);
+                memcpy(args + count, &ll, sizeof(ll));
+                count += 2;
+            } else {
+                args[count++] = va_arg(ap, uint32_t);
+            }
+        }
+        ++fmt;
+    }
+
+    return count;
+}
+
+void write(int level, const char* fmt, va_list ap)
+{
+    uint32_t args[MAX_ARGS];
+    size_t count = capture(fmt, ap, args);
+    uint32_t timestamp = osKernelSysTick();
+
+    // May be called from interrupt handlers.
+    auto x = taskENTER_CRITICAL_FROM_ISR();
+    size_t h = head;
+    size_t used = (h - tail) & (RING_SIZE - 1);
+    if (RING_SIZE - 1 - used >= count + 3)
+    {
+        ring[h] = MAGIC | (sequence << 16) | ((level & 0xFF) << 8) | count;
+        h = (h + 1) & (RING_SIZE - 1);
+        ring[h] = reinterpret_cast<uint32_t>(fmt);
+        h = (h + 1) & (RING_SIZE - 1);
+        ring[h] = timestamp;
+        h = (h + 1) & (RING_SIZE - 1);
+        for (size_t i = 0; i != count; ++i) {
+            ring[h] = args[i];
+            h = (h + 1) & (RING_SIZE - 1);
+        }
+        head = h;
+    }
+    ++sequence;     // Incremented for dropped records too.
+    taskEXIT_CRITICAL_FROM_ISR(x);
+}
+
+inline void send(uint32_t word)
+{
+    while (ITM->PORT[TRACE_PORT].u32 == 0) continue;
+    ITM->PORT[TRACE_PORT].u32 = word;
+}
+
+}}} // mobilinkd::tnc::trace
+
+extern "C" void startTraceTask(void const*)
+{
+    using namespace mobilinkd::tnc::trace;
+
+    for (;;)
+    {
+        if (head == tail) {
+            osDelay(10);
+            continue;
+        }
+
+        size_t t = tail;
+        bool enabled = (ITM->TCR & ITM_TCR_ITMENA_Msk)
+            and (ITM->TER & (1UL << TRACE_PORT));
+
+        while (t != head) {
+            if (enabled) send(ring[t]);
+            t = (t + 1) & (RING_SIZE - 1);
+        }
+        tail = t;
+    }
+}
+
+void trace_log(int level, const char* fmt, va_list args)
+{
+    mobilinkd::tnc::trace::write(level, fmt, args);
+}
+
+uint32_t traceTaskBuffer[ 128 ];
+osStaticThreadDef_t traceTaskControlBlock;
+
+void initTrace()
+{
+    osThreadStaticDef(traceTask, startTraceTask, osPriorityIdle, 0, 128,
+        traceTaskBuffer, &traceTaskControlBlock);
+    osThreadCreate(osThread(traceTask), 0);
+}
+
+#else
+
+void trace_log(int, const char*, va_list) {}
+void initTrace() {}
+
+#endif // KISS_LOG_TRACE
@@ -0,0 +1,48 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdarg>
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdarg.h>
+#include <stdint.h>
+#endif
+
+/**
+ * Deferred binary trace logging.  Enabled by defining KISS_LOG_TRACE
+ * along with KISS_LOGGING.
+ *
+ * Rather than formatting the message with vprintf() and writing it to the
+ * ITM synchronously, log_() writes a binary record to a RAM ring.  The
+ * format string is not copied; its address is recorded and the text is
+ * rebuilt on the host from the ELF file by trace_decode.py.  The ring is
+ * drained to ITM stimulus port 1 by an idle-priority task.
+ *
+ * A record is a sequence of 32-bit words:
+ *
+ *  - header: 0xA5 (8 bits), sequence (8 bits), level (8 bits),
+ *    number of argument words (8 bits)
+ *  - format string address
+ *  - timestamp (ms)
+ *  - argument words
+ *
+ * Arguments are captured according to the format string.  Doubles and
+ * long long values take two words.  Strings (%s) are recorded as a
+ * pointer, which the decoder can only resolve for strings in flash.
+ *
+ * Records which do not fit in the ring are dropped.  The host detects
+ * this from gaps in the sequence numbers.
+ */
+void trace_log(int level, const char* fmt, va_list args);
+
+/// Start the trace drain task.
+void initTrace(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
@@ -5,6 +5,7 @@
 #include "HdlcFrame.hpp"
 #include "Kiss.hpp"
 #include "Log.h"
+#include "Statistics.hpp"
 
 #include "usbd_cdc_if.h"
 #include "usb_device.h"
@@ -32,6 +33,7 @@ extern "C" void cdc_receive(const uint8_t* buf, uint32_t len)
             return;
         }
     }
+    stats::count(stats::counters().usb_drops);
     ERROR("USB packet dropped");
     USBD_CDC_ReceivePacket(&hUsbDeviceFS); // re-enable receive.
 }
@@ -135,17 +137,24 @@ void UsbPort::run()
     }
 }
 
+uint32_t cdcTaskBuffer[ 128 ];
+osStaticThreadDef_t cdcTaskControlBlock;
+uint8_t cdcQueueBuffer[ 4 * sizeof( void* ) ];
+osStaticMessageQDef_t cdcQueueControlBlock;
+osStaticMutexDef_t usbMutexControlBlock;
+
 void UsbPort::init()
 {
     if (cdcTaskHandle_) return;
 
-    osMessageQDef(cdcQueue, 4, void*);
+    osMessageQStaticDef(cdcQueue, 4, void*, cdcQueueBuffer, &cdcQueueControlBlock);
     queue_ = osMessageCreate(osMessageQ(cdcQueue), 0);
 
-    osMutexDef(usbMutex);
+    osMutexStaticDef(usbMutex, &usbMutexControlBlock);
     mutex_ = osMutexCreate(osMutex(usbMutex));
 
-    osThreadDef(cdcTask, startCDCTask, osPriorityNormal, 0, 128);
+    osThreadStaticDef(cdcTask, startCDCTask, osPriorityNormal, 0, 128,
+        cdcTaskBuffer, &cdcTaskControlBlock);
     cdcTaskHandle_ = osThreadCreate(osThread(cdcTask), this);
 }
 
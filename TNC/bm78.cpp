@@ -35,7 +35,8 @@ namespace mobilinkd { namespace tnc { namespace bm78 {
  *
  * We program the module for the following features:
  *
- *  - The module is set for 115200 baud with hardware flow control.
+ *  - The module is set for BM78_UART_BAUD (115200) baud with hardware flow
+ *    control.
  *  - The name is changed to TNC3.
  *  - The BT3.0 pairing PIN is set to 1234
  *  - The BLE5.0 pairing PIN is set to "123456".
@@ -102,6 +103,25 @@ bool read_mac_address()
     return true;
 }
 
+/**
+ * Set the MCU UART to BM78_UART_BAUD with RTS/CTS flow control.  The
+ * BM78 deasserts CTS when its BLE TX buffer is full, which is what
+ * provides backpressure to SerialPort::write().
+ *
+ * @return true on success, otherwise false.
+ */
+bool set_uart()
+{
+  huart3.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
+  huart3.Init.BaudRate = BM78_UART_BAUD;
+  if (HAL_UART_Init(&huart3) != HAL_OK)
+  {
+      CxxErrorHandler();
+  }
+
+  return true;
+}
+
 /**
  * Exit BM78 EEPROM programming mode and return to pass-through mode.
  *
@@ -117,12 +137,7 @@ void exit_program_mode()
     HAL_Delay(1);       // Spec says minimum 63ns.
     gpio::BT_RESET::on();
 
-    huart3.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
-    huart3.Init.BaudRate = 115200;
-    if (HAL_UART_Init(&huart3) != HAL_OK)
-    {
-        CxxErrorHandler();
-    }
+    set_uart();
 
     bm78_wait_until_ready();
 }
@@ -302,6 +317,38 @@ bool set_misc()
     return parse_write_result(__PRETTY_FUNCTION__);
 }
 
+/**
+ * Program the module UART baud rate used in transparent data mode.
+ *
+ * The UART baud rate index is at 0x0008.  The configuration UI writes
+ * 0x03 (115200) there in eeprom_data, so nothing is written for the
+ * default rate.  The 460800 index (0x01) is assumed from the table used
+ * by the other ISSC/Microchip modules and has not been checked against
+ * the BM78 UI tool; it is only used when BM78_UART_BAUD is overridden.
+ * Hardware flow control is already enabled in the system options.
+ *
+ * @pre This must be written after write_eeprom().
+ */
+bool set_uart_baud()
+{
+#if BM78_UART_BAUD == 115200
+    return true;
+#else
+    static_assert(BM78_UART_BAUD == 460800, "Update the baud rate index");
+
+    // 0x0008: 01
+    uint8_t cmd[] = {0x01, 0x27, 0xfc, 0x04, 0x00, 0x08, 0x01, 0x01};
+
+    if (HAL_UART_Transmit(&huart3, cmd, sizeof(cmd), 10) != HAL_OK)
+    {
+        ERROR("%s transmit failed", __PRETTY_FUNCTION__);
+        return false;
+    }
+
+    return parse_write_result(__PRETTY_FUNCTION__);
+#endif
+}
+
 bool set_le_service_name()
 {
     // LE Service Name.
@@ -435,24 +482,6 @@ bool configure_le_service()
     return result;
 }
 
-/**
- * Set the baud rate to 115200, turn on RTS/CTS flow control and then
- * reset the BLE module.
- *
- * @return true on success, otherwise false.
- */
-bool set_uart()
-{
-  huart3.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
-  huart3.Init.BaudRate = 115200;
-  if (HAL_UART_Init(&huart3) != HAL_OK)
-  {
-      CxxErrorHandler();
-  }
-
-  return true;
-}
-
 bool set_work()
 {
     return true;
@@ -505,7 +534,15 @@ uint32_t eeprom_crc()
 
     uint32_t size = data - eeprom_data;
 
+#if BM78_UART_BAUD == 115200
     return HAL_CRC_Calculate(&hcrc, (uint32_t*)eeprom_data, size);
+#else
+    // Include the baud rate so that modules programmed for a different
+    // rate are re-initialized.
+    uint32_t baud = BM78_UART_BAUD;
+    HAL_CRC_Calculate(&hcrc, (uint32_t*)eeprom_data, size);
+    return HAL_CRC_Accumulate(&hcrc, &baud, sizeof(baud));
+#endif
 }
 
 int bm78_initialized()
@@ -518,6 +555,11 @@ int bm78_initialized()
     return HAL_RTCEx_BKUPRead(&hrtc, RTC_BKP_DR1) == crc;
 }
 
+void bm78_configure_uart()
+{
+    mobilinkd::tnc::bm78::set_uart();
+}
+
 void bm78_initialize_mac_address()
 {
     using namespace mobilinkd::tnc::bm78;
@@ -538,6 +580,7 @@ int bm78_initialize()
     if (!write_eeprom()) result = 1;
     else if (!write_serial()) result = 2;
     else if (!read_mac_address()) result = 3;
+    else if (!set_uart_baud()) result = 4;
     exit_program_mode();
 
 #if 1
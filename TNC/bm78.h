@@ -14,6 +14,16 @@ extern "C" {
 #include <stdint.h>
 #endif
 
+/**
+ * UART baud rate used in transparent data mode.  115200 is the rate the
+ * BM78 UI tool programs in eeprom_data.  460800 is not yet verified on
+ * hardware: a wrong rate leaves the module unreachable until it is
+ * reflashed, so it must be selected explicitly by defining this.
+ */
+#ifndef BM78_UART_BAUD
+#define BM78_UART_BAUD 115200
+#endif
+
 /**
  * The BM78 module says that the module is ready about 475ms after start,
  * but that the proper thing to do is wait until P1_5 (BT_STATE2) is high
@@ -27,6 +37,13 @@ extern "C" {
  *  and state indication for EEPROM programming mode is not specified.
  */
 void bm78_wait_until_ready(void);
+
+/**
+ * Configure the MCU UART for transparent data mode with the BM78 at
+ * BM78_UART_BAUD with RTS/CTS hardware flow control.  This must match
+ * the baud rate programmed into the module EEPROM by bm78_initialize().
+ */
+void bm78_configure_uart(void);
 void bm78_state_change(void);
 int bm78_disable(void);
 int bm78_enable(void);
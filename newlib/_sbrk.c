@@ -13,6 +13,20 @@
 caddr_t
 _sbrk(int incr);
 
+caddr_t
+_sbrk_heap_end(void);
+
+caddr_t
+_sbrk_high_water(void);
+
+#ifdef KISS_NO_HEAP
+void
+_Error_Handler(char *, int) __attribute__ ((noreturn));
+#endif
+
+static char* current_heap_end = 0;
+static char* max_heap_end = 0;
+
 // ----------------------------------------------------------------------------
 
 // The definitions used here should be kept in sync with the
@@ -24,9 +38,14 @@ _sbrk(int incr)
   extern char _Heap_Begin; // Defined by the linker.
   extern char _Heap_Limit; // Defined by the linker.
 
-  static char* current_heap_end = 0;
   char* current_block_address;
 
+#ifdef KISS_NO_HEAP
+  // Everything is statically allocated in this build.  The first use of
+  // malloc() or operator new (including the RTOS heap) ends up here.
+  _Error_Handler(__FILE__, __LINE__);
+#endif
+
   if (current_heap_end == 0)
     {
       current_heap_end = &_Heap_Begin;
@@ -57,9 +76,31 @@ _sbrk(int incr)
     }
 
   current_heap_end += incr;
+  if (current_heap_end > max_heap_end)
+    {
+      max_heap_end = current_heap_end;
+    }
 
   return (caddr_t) current_block_address;
 }
 
+// Current end of the heap; memory above this (to _Heap_Limit) is unused.
+caddr_t
+_sbrk_heap_end(void)
+{
+  extern char _Heap_Begin; // Defined by the linker.
+
+  return current_heap_end ? current_heap_end : &_Heap_Begin;
+}
+
+// Highest end of the heap seen since reset.
+caddr_t
+_sbrk_high_water(void)
+{
+  extern char _Heap_Begin; // Defined by the linker.
+
+  return max_heap_end ? max_heap_end : &_Heap_Begin;
+}
+
 // ----------------------------------------------------------------------------
 
@@ -0,0 +1,127 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+// Host benchmark for the digipeater's header parsing and rewriting:
+// ax25::Ax25View construction and wide_hop() over many frames.  Host
+// times are only useful to compare changes to the code.
+
+#include "Ax25View.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace mobilinkd::tnc;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t ITERATIONS = 20000;
+
+std::vector<uint8_t> address(const char* text, bool last = false)
+{
+    std::vector<uint8_t> result(ax25::ADDRESS_LEN, ' ' << 1);
+    const char* dash = strchr(text, '-');
+    size_t len = dash ? dash - text : strlen(text);
+    for (size_t i = 0; i != len; ++i) result[i] = text[i] << 1;
+    uint8_t ssid = dash ? atoi(dash + 1) : 0;
+    result[6] = ax25::RESERVED_BITS | (ssid << 1)
+        | (last ? ax25::EXTENSION_BIT : 0);
+    return result;
+}
+
+/// APRS UI frame to APRS via WIDE1-1,WIDE2-2 with a dummy FCS.
+std::vector<uint8_t> ui_frame(size_t info_size)
+{
+    std::vector<uint8_t> result;
+    for (auto& a : {address("APRS"), address("N0CALL-1"), address("WIDE1-1"),
+        address("WIDE2-2", true)})
+    {
+        result.insert(result.end(), a.begin(), a.end());
+    }
+    result.push_back(ax25::UI);
+    result.push_back(0xF0);
+    for (size_t i = 0; i != info_size; ++i) result.push_back('a' + i % 26);
+    result.push_back(0x12);
+    result.push_back(0x34);
+    return result;
+}
+
+struct Result
+{
+    Clock::duration parse{};
+    Clock::duration hop{};
+    size_t frames{0};
+};
+
+/**
+ * Time the parse and the hop of batch frames at a time, the way the
+ * digipeater handles them: the FCS is removed, the frame parsed, and
+ * MYCALL inserted ahead of WIDE1-1.
+ */
+Result run(const std::vector<uint8_t>& data, size_t batch)
+{
+    ax25::Callsign mycall;
+    auto a = address("DIGI");
+    std::copy(a.begin(), a.begin() + 6, mycall.begin());
+
+    std::vector<hdlc::IoFrame*> frames(batch);
+    std::vector<ax25::Ax25View> views;
+    views.reserve(batch);
+    Result result;
+
+    for (size_t n = 0; n != ITERATIONS; ++n)
+    {
+        for (auto& frame : frames) {
+            frame = hdlc::acquire();
+            for (auto c : data) frame->push_back(c);
+            frame->truncate(frame->size() - 2);
+        }
+
+        views.clear();
+        auto start = Clock::now();
+        for (auto frame : frames) views.emplace_back(frame);
+        auto parsed = Clock::now();
+        for (auto& view : views) view.wide_hop(2, &mycall, 0);
+        auto hopped = Clock::now();
+
+        result.parse += parsed - start;
+        result.hop += hopped - parsed;
+        result.frames += batch;
+
+        for (auto& view : views) {
+            if (!view.valid() or view.addresses() != 5) {
+                printf("Rewrite failed\n");
+                exit(1);
+            }
+        }
+        for (auto frame : frames) hdlc::release(frame);
+    }
+
+    return result;
+}
+
+void report(const char* name, const Result& result)
+{
+    using std::chrono::nanoseconds;
+    auto ns = [&result](Clock::duration d) {
+        return double(std::chrono::duration_cast<nanoseconds>(d).count())
+            / result.frames;
+    };
+    printf("%-28s %8zu frames  parse %7.1f ns  wide_hop %7.1f ns\n",
+        name, result.frames, ns(result.parse), ns(result.hop));
+}
+
+} // namespace
+
+int main()
+{
+    // Short frames fit in one segment; with a 250 byte info field the
+    // bytes moved by the insert cross into a second segment.
+    report("32 byte info", run(ui_frame(32), 16));
+    report("250 byte info", run(ui_frame(250), 8));
+    return 0;
+}
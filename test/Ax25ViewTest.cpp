@@ -0,0 +1,264 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+// Host tests for ax25::Ax25View and the SegmentedBuffer operations it
+// uses to rewrite frames in place.
+
+#include "Ax25View.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace mobilinkd::tnc;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+    if (ok) return;
+    printf("FAIL line %d: %s\n", line, what);
+    ++failures;
+}
+
+/// Encode "CALL-N" as an address, with the H and extension bits given.
+std::vector<uint8_t> address(const char* text, bool repeated = false,
+    bool last = false)
+{
+    std::vector<uint8_t> result(ax25::ADDRESS_LEN, ' ' << 1);
+    const char* dash = strchr(text, '-');
+    size_t len = dash ? dash - text : strlen(text);
+    for (size_t i = 0; i != len; ++i) result[i] = text[i] << 1;
+    uint8_t ssid = dash ? atoi(dash + 1) : 0;
+    result[6] = ax25::RESERVED_BITS | (ssid << 1)
+        | (repeated ? ax25::H_BIT : 0) | (last ? ax25::EXTENSION_BIT : 0);
+    return result;
+}
+
+/// An AX.25 UI frame with the given vias and info size, and a dummy FCS.
+std::vector<uint8_t> ui_frame(const std::vector<const char*>& vias,
+    size_t info_size)
+{
+    std::vector<uint8_t> result;
+    auto append = [&](const std::vector<uint8_t>& a) {
+        result.insert(result.end(), a.begin(), a.end());
+    };
+    append(address("APRS"));
+    append(address("N0CALL-1", false, vias.empty()));
+    for (size_t i = 0; i != vias.size(); ++i) {
+        append(address(vias[i], false, i + 1 == vias.size()));
+    }
+    result.push_back(ax25::UI);
+    result.push_back(0xF0);
+    for (size_t i = 0; i != info_size; ++i) result.push_back('a' + i % 26);
+    result.push_back(0x12);     // FCS.
+    result.push_back(0x34);
+    return result;
+}
+
+hdlc::IoFrame* make_frame(const std::vector<uint8_t>& data)
+{
+    auto frame = hdlc::ioFramePool().acquire();
+    for (auto c : data) frame->push_back(c);
+    return frame;
+}
+
+std::vector<uint8_t> contents(hdlc::IoFrame* frame)
+{
+    return std::vector<uint8_t>(frame->begin(), frame->end());
+}
+
+bool same_address(const uint8_t* a, const std::vector<uint8_t>& b)
+{
+    return std::equal(b.begin(), b.end(), a);
+}
+
+void test_parse()
+{
+    auto data = ui_frame({"WIDE1-1", "WIDE2-2"}, 5);
+    auto frame = make_frame(data);
+    ax25::Ax25View view(frame, 2);
+
+    CHECK(view.valid());
+    CHECK(view.addresses() == 4);
+    CHECK(same_address(view.destination(), address("APRS")));
+    CHECK(same_address(view.source(), address("N0CALL-1")));
+    CHECK(view.ssid(1) == 1);
+    CHECK(view.ssid(3) == 2);
+    CHECK(!view.repeated(2));
+    CHECK(view.control() == ax25::UI);
+    CHECK(view.pid() == 0xF0);
+    CHECK(view.header_size() == 4 * ax25::ADDRESS_LEN + 2);
+    CHECK(view.info_size() == 5);
+    CHECK(std::equal(data.end() - 7, data.end() - 2, view.info()));
+
+    hdlc::release(frame);
+}
+
+void test_parse_invalid()
+{
+    // The extension bit is never set.
+    auto data = ui_frame({"WIDE1-1"}, 0);
+    data[3 * ax25::ADDRESS_LEN - 1] &= ~ax25::EXTENSION_BIT;
+    auto frame = make_frame(data);
+    CHECK(!ax25::Ax25View(frame, 2).valid());
+    hdlc::release(frame);
+
+    // Too short for two addresses, control and PID.
+    frame = make_frame(std::vector<uint8_t>(data.begin(), data.begin() + 15));
+    CHECK(!ax25::Ax25View(frame).valid());
+    hdlc::release(frame);
+
+    // The last address is the source; there is no control byte.
+    data = ui_frame({}, 0);
+    data.resize(2 * ax25::ADDRESS_LEN + 1);
+    frame = make_frame(data);
+    CHECK(!ax25::Ax25View(frame).valid());
+    hdlc::release(frame);
+}
+
+void test_insert_across_segments()
+{
+    auto segments = hdlc::frameSegmentPool.free_list.size();
+
+    // Both the moved bytes and the new bytes cross a segment boundary,
+    // and for 256 the last segment is full so a new one is allocated.
+    for (size_t size : {20, 250, 253, 256, 300, 512}) {
+        for (uint16_t pos : {0, 14, 249}) {
+            if (pos > size) continue;
+
+            std::vector<uint8_t> data;
+            for (size_t i = 0; i != size; ++i) data.push_back(i * 7 + 1);
+            auto frame = make_frame(data);
+
+            CHECK(frame->insert(pos, 7));
+            std::vector<uint8_t> expected(data);
+            expected.insert(expected.begin() + pos, 7, 0);
+            auto result = contents(frame);
+            CHECK(result.size() == size + 7);
+            // The gap is unspecified.
+            std::copy(result.begin() + pos, result.begin() + pos + 7,
+                expected.begin() + pos);
+            CHECK(result == expected);
+
+            hdlc::release(frame);
+        }
+    }
+
+    CHECK(hdlc::frameSegmentPool.free_list.size() == segments);
+}
+
+void test_truncate()
+{
+    auto segments = hdlc::frameSegmentPool.free_list.size();
+
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i != 600; ++i) data.push_back(i);
+    auto frame = make_frame(data);
+    CHECK(hdlc::frameSegmentPool.free_list.size() == segments - 3);
+
+    frame->truncate(700);      // Longer; no change.
+    CHECK(frame->size() == 600);
+
+    frame->truncate(256);
+    CHECK(frame->size() == 256);
+    CHECK(hdlc::frameSegmentPool.free_list.size() == segments - 1);
+    CHECK(contents(frame) == std::vector<uint8_t>(data.begin(), data.begin() + 256));
+
+    // The buffer can grow again from the truncated end.
+    CHECK(frame->push_back(0xAA));
+    CHECK(frame->size() == 257);
+    CHECK(*std::next(frame->begin(), 256) == 0xAA);
+
+    frame->truncate(0);
+    CHECK(frame->size() == 0);
+    CHECK(frame->data() == nullptr);
+    CHECK(hdlc::frameSegmentPool.free_list.size() == segments);
+
+    hdlc::release(frame);
+}
+
+void test_wide_hop()
+{
+    ax25::Callsign mycall;
+    auto a = address("DIGI");
+    std::copy(a.begin(), a.begin() + 6, mycall.begin());
+
+    // The info field crosses the segment boundary, so it is moved across it.
+    auto data = ui_frame({"WIDE1-1", "WIDE2-2"}, 250);
+    auto frame = make_frame(data);
+    frame->truncate(frame->size() - 2);     // The FCS, as the digipeater does.
+
+    ax25::Ax25View view(frame);
+    CHECK(view.valid());
+    auto info_size = view.info_size();
+
+    // WIDE1-1 with MYCALL inserted: DIGI-3*,WIDE1*,WIDE2-2
+    view.wide_hop(2, &mycall, 3);
+    CHECK(view.addresses() == 5);
+    CHECK(same_address(view.address(2), address("DIGI-3", true)));
+    CHECK(same_address(view.address(3), address("WIDE1", true)));
+    CHECK(same_address(view.address(4), address("WIDE2-2", false, true)));
+    CHECK(view.control() == ax25::UI);
+    CHECK(view.pid() == 0xF0);
+    CHECK(view.info_size() == info_size);
+    CHECK(std::equal(data.end() - 2 - info_size, data.end() - 2, view.info()));
+    CHECK(frame->size() == data.size() - 2 + ax25::ADDRESS_LEN);
+
+    // The new header parses the same way.
+    ax25::Ax25View reparsed(frame);
+    CHECK(reparsed.valid());
+    CHECK(reparsed.addresses() == 5);
+
+    // WIDE2-2 without MYCALL: WIDE2-1, not yet repeated.
+    view.wide_hop(4, nullptr, 0);
+    CHECK(view.addresses() == 5);
+    CHECK(same_address(view.address(4), address("WIDE2-1", false, true)));
+
+    hdlc::release(frame);
+}
+
+void test_wide_hop_full()
+{
+    ax25::Callsign mycall;
+    auto a = address("DIGI");
+    std::copy(a.begin(), a.begin() + 6, mycall.begin());
+
+    // Eight vias; there is no room for MYCALL.
+    auto frame = make_frame(ui_frame({"A", "B", "C", "D", "E", "F", "G",
+        "WIDE2-1"}, 10));
+    ax25::Ax25View view(frame, 2);
+    CHECK(view.addresses() == ax25::MAX_ADDRESSES);
+
+    view.wide_hop(9, &mycall, 0);
+    CHECK(view.addresses() == ax25::MAX_ADDRESSES);
+    CHECK(same_address(view.address(9), address("WIDE2", true, true)));
+
+    hdlc::release(frame);
+}
+
+} // namespace
+
+int main()
+{
+    test_parse();
+    test_parse_invalid();
+    test_insert_across_segments();
+    test_truncate();
+    test_wide_hop();
+    test_wide_hop_full();
+
+    CHECK(hdlc::ioFramePool().size() == hdlc::ioFramePool().capacity());
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("Ax25ViewTest passed\n");
+    return 0;
+}
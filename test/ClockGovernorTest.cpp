@@ -0,0 +1,162 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+// Host tests for the clock governor policy and the timer rescaling.
+
+#include "ClockGovernor.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace mobilinkd::tnc::clock;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+    if (ok) return;
+    printf("FAIL line %d: %s\n", line, what);
+    ++failures;
+}
+
+/// Feed one WINDOW of blocks with the given load (per mille).
+Speed window(Policy& policy, uint32_t load)
+{
+    Speed result = policy.current_;
+    for (uint32_t i = 0; i != Policy::WINDOW; ++i) {
+        result = policy.block(load, 1000, 0, false);
+    }
+    return result;
+}
+
+/// Sample rate error, in ppm, of ticks at hz against the reference rate.
+int32_t rate_error(uint32_t ticks, uint32_t hz, uint32_t ref_ticks, uint32_t ref_hz)
+{
+    double rate = double(hz) / ticks;
+    double ref = double(ref_hz) / ref_ticks;
+    return int32_t((rate - ref) / ref * 1e6);
+}
+
+void test_step_down()
+{
+    Policy policy;
+    policy.reset(Speed::MHZ80, Speed::MHZ80);
+    CHECK(policy.floor_ == Speed::MHZ16);
+
+    // Nothing changes until a full window has been seen.
+    for (uint32_t i = 0; i != Policy::WINDOW - 1; ++i) {
+        CHECK(policy.block(100, 1000, 0, false) == Speed::MHZ80);
+    }
+    CHECK(policy.block(100, 1000, 0, false) == Speed::MHZ48);
+
+    // One step per window, and never below the floor.
+    CHECK(window(policy, 100) == Speed::MHZ16);
+    CHECK(window(policy, 100) == Speed::MHZ16);
+}
+
+void test_scaled_load()
+{
+    Policy policy;
+    policy.reset(Speed::MHZ80, Speed::MHZ80);
+
+    // 400 at 80MHz is 667 at 48MHz, above DOWN.
+    CHECK(window(policy, 400) == Speed::MHZ80);
+
+    // 350 at 80MHz is 583 at 48MHz.
+    CHECK(window(policy, 350) == Speed::MHZ48);
+
+    // The peak of the window counts, not the average.
+    policy.reset(Speed::MHZ80, Speed::MHZ80);
+    for (uint32_t i = 0; i != Policy::WINDOW - 1; ++i) {
+        policy.block(100, 1000, 0, false);
+    }
+    CHECK(policy.block(400, 1000, 0, false) == Speed::MHZ80);
+}
+
+void test_step_up()
+{
+    Policy policy;
+
+    // Over UP: straight back to nominal.
+    policy.reset(Speed::MHZ80, Speed::MHZ16);
+    CHECK(policy.block(Policy::UP, 1000, 0, false) == Speed::MHZ16);
+    CHECK(policy.block(Policy::UP + 1, 1000, 0, false) == Speed::MHZ80);
+
+    // A backlog, a hold, or an unknown period.
+    policy.reset(Speed::MHZ80, Speed::MHZ16);
+    CHECK(policy.block(0, 1000, 1, false) == Speed::MHZ80);
+    policy.reset(Speed::MHZ80, Speed::MHZ16);
+    CHECK(policy.block(0, 1000, 0, true) == Speed::MHZ80);
+    policy.reset(Speed::MHZ80, Speed::MHZ16);
+    CHECK(policy.block(0, 0, 0, false) == Speed::MHZ80);
+
+    // Stepping up restarts the window.
+    policy.reset(Speed::MHZ80, Speed::MHZ80);
+    for (uint32_t i = 0; i != Policy::WINDOW - 1; ++i) {
+        policy.block(100, 1000, 0, false);
+    }
+    policy.block(0, 1000, 0, true);
+    CHECK(policy.block(100, 1000, 0, false) == Speed::MHZ80);
+}
+
+void test_nominal_floor()
+{
+    Policy policy;
+
+    // The floor is never above the nominal speed.
+    policy.reset(Speed::MHZ4, Speed::MHZ4);
+    CHECK(policy.floor_ == Speed::MHZ4);
+    CHECK(window(policy, 0) == Speed::MHZ4);
+
+    policy.reset(Speed::MHZ48, Speed::MHZ48);
+    CHECK(window(policy, 0) == Speed::MHZ16);
+}
+
+void test_scaled_ticks()
+{
+    // AFSK 1200: TIM6 ARR 1817 at 48MHz (26.4ksps) divides exactly.
+    CHECK(scaled_ticks(1818, 48000000, 16000000) == 606);
+    CHECK(scaled_ticks(1818, 48000000, 80000000) == 3030);
+
+    // 9600: TIM6 ARR 416 at 80MHz.  250.2 and 83.4 round down; at 16MHz
+    // the sample rate is then 0.5% fast.
+    CHECK(scaled_ticks(417, 80000000, 48000000) == 250);
+    CHECK(scaled_ticks(417, 80000000, 16000000) == 83);
+    CHECK(std::abs(rate_error(83, 16000000, 417, 80000000)) < 5000);
+
+    // Rounds to nearest.
+    CHECK(scaled_ticks(5, 16000000, 4000000) == 1);     // 1.25
+    CHECK(scaled_ticks(7, 16000000, 4000000) == 2);     // 1.75
+    CHECK(scaled_ticks(6, 16000000, 4000000) == 2);     // 1.5
+
+    // Limited to the 16-bit timer range.
+    CHECK(scaled_ticks(1, 80000000, 4000000) == 1);
+    CHECK(scaled_ticks(0x10000, 4000000, 80000000) == 0x10000);
+
+    // Scaling the scaled value back loses the remainder, which is why the
+    // governor always scales from the modem's reference value.
+    CHECK(scaled_ticks(83, 16000000, 80000000) == 415);
+    CHECK(scaled_ticks(417, 80000000, 80000000) == 417);
+}
+
+} // namespace
+
+int main()
+{
+    test_step_down();
+    test_scaled_load();
+    test_step_up();
+    test_nominal_floor();
+    test_scaled_ticks();
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ClockGovernorTest passed\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+// Host tests for the software RF loopback: the DAC to ADC sample ring,
+// the impairments and the frame statistics.
+
+#include "Loopback.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace mobilinkd::tnc::loopback;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+void check(bool ok, const char* what, int line)
+{
+    if (ok) return;
+    printf("FAIL line %d: %s\n", line, what);
+    ++failures;
+}
+
+constexpr uint16_t VGND = 2048;
+
+std::vector<uint16_t> read(Loopback& loopback, size_t len)
+{
+    std::vector<uint16_t> result(len);
+    loopback.read(result.data(), len, VGND);
+    return result;
+}
+
+void test_disabled()
+{
+    Loopback loopback;
+    std::vector<uint16_t> samples(100, 4095);
+    loopback.write(samples.data(), samples.size());
+    CHECK(loopback.available() == 0);
+}
+
+void test_prefill()
+{
+    Loopback loopback;
+    loopback.enable(0, 0);
+
+    // Quiet until PREFILL samples are buffered.
+    std::vector<uint16_t> samples(Loopback::PREFILL - 1, 4095);
+    loopback.write(samples.data(), samples.size());
+    for (auto s : read(loopback, 16)) CHECK(s == VGND);
+    CHECK(loopback.available() == Loopback::PREFILL - 1);
+
+    // Then the DAC samples are centred on VGND at half the ADC range.
+    samples.assign(1, 0);
+    loopback.write(samples.data(), 1);
+    auto result = read(loopback, Loopback::PREFILL);
+    CHECK(result.front() == VGND + 1023);
+    CHECK(result.back() == VGND - 1024);
+    CHECK(loopback.available() == 0);
+
+    // Once drained, it is quiet again and waits for another prefill.
+    for (auto s : read(loopback, 16)) CHECK(s == VGND);
+    samples.assign(16, 4095);
+    loopback.write(samples.data(), samples.size());
+    for (auto s : read(loopback, 16)) CHECK(s == VGND);
+}
+
+void test_overflow()
+{
+    Loopback loopback;
+    loopback.enable(0, 0);
+
+    // One slot is kept empty to tell full from empty.
+    std::vector<uint16_t> samples(Loopback::BUFFER_SIZE + 10, 3000);
+    loopback.write(samples.data(), samples.size());
+    CHECK(loopback.available() == Loopback::BUFFER_SIZE - 1);
+
+    read(loopback, 100);
+    CHECK(loopback.available() == Loopback::BUFFER_SIZE - 101);
+}
+
+void test_noise()
+{
+    Loopback loopback;
+    loopback.enable(100, 0);
+
+    // The channel is quiet, so this is only the noise.
+    auto result = read(loopback, 4096);
+    double sum = 0, sum2 = 0;
+    for (auto s : result) {
+        double x = double(s) - VGND;
+        sum += x;
+        sum2 += x * x;
+    }
+    double mean = sum / result.size();
+    double sd = std::sqrt(sum2 / result.size() - mean * mean);
+    CHECK(std::fabs(mean) < 10);
+    CHECK(sd > 90 and sd < 110);
+}
+
+void test_twist()
+{
+    // A step input; pre-emphasis passes only the edge at full level and
+    // de-emphasis rises slowly.
+    for (int8_t twist : {64, -64}) {
+        Loopback loopback;
+        loopback.enable(0, twist);
+        std::vector<uint16_t> samples(Loopback::PREFILL, 4095);
+        loopback.write(samples.data(), samples.size());
+        auto result = read(loopback, 4);
+        if (twist > 0) {
+            CHECK(result[0] == VGND + 1023);
+            CHECK(result[1] < result[0]);
+            CHECK(result[2] == result[1]);
+        } else {
+            CHECK(result[0] < VGND + 1023);
+            CHECK(result[1] > result[0]);
+            CHECK(result[2] > result[1]);
+        }
+    }
+}
+
+void test_stats()
+{
+    Loopback loopback;
+    loopback.enable(0, 0);
+
+    loopback.transmitted(0x1234, 1000);
+    loopback.transmitted(0x5678, 1100);
+    loopback.received(0x9999, 1200);       // Not ours.
+    loopback.received(0x1234, 1300);
+    loopback.received(0x1234, 1350);       // Already matched.
+    loopback.received(0x5678, 1500);
+
+    auto stats = loopback.stats();
+    CHECK(stats.transmitted == 2);
+    CHECK(stats.received == 2);
+    CHECK(stats.elapsed == 500);
+    CHECK(stats.latency_min == 300);
+    CHECK(stats.latency_max == 400);
+    CHECK(stats.latency_sum == 700);
+
+    // Only the last PENDING_SIZE frames can be matched.
+    for (uint16_t i = 0; i != Loopback::PENDING_SIZE + 1; ++i) {
+        loopback.transmitted(i, 2000 + i);
+    }
+    loopback.received(0, 3000);
+    loopback.received(Loopback::PENDING_SIZE, 3000);
+    CHECK(loopback.stats().received == 3);
+
+    // Enabling again starts over.
+    loopback.enable(0, 0);
+    CHECK(loopback.stats().transmitted == 0);
+    CHECK(loopback.stats().latency_min == UINT32_MAX);
+}
+
+} // namespace
+
+int main()
+{
+    test_disabled();
+    test_prefill();
+    test_overflow();
+    test_noise();
+    test_twist();
+    test_stats();
+
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("LoopbackTest passed\n");
+    return 0;
+}
@@ -0,0 +1,16 @@
+// Copyright 2020 Rob Riggs <rob@mobilinkd.com>
+// All rights reserved.
+
+// Host stand-ins for the few RTOS calls made by the code under test.  The
+// tests are single threaded, so the critical sections are empty.
+
+#pragma once
+
+#include <cstdlib>
+
+#define taskENTER_CRITICAL_FROM_ISR() 0
+#define taskEXIT_CRITICAL_FROM_ISR(x) (void)(x)
+
+#define CxxErrorHandler() abort()
+
+inline void osThreadYield() {}
@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+"""
+Decode the binary trace log written by the firmware when built with
+KISS_LOG_TRACE.
+
+The input is the raw little-endian data captured from ITM stimulus port 1
+(for example with orbuculum or OpenOCD's "tpiu config ... itm port 1").
+The format strings are read from the ELF file the firmware was built from.
+
+usage: trace_decode.py firmware.elf trace.bin
+"""
+
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+MAGIC = 0xA5
+LEVELS = ["DEBUG", "INFO", "WARN", "ERROR", "SEVERE"]
+
+conversion = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|L|z|j|t)?([diouxXcspfFeEgGaA%])")
+
+
+class Image(object):
+    def __init__(self, path):
+        self.segments = []
+        with open(path, "rb") as f:
+            elf = ELFFile(f)
+            for section in elf.iter_sections():
+                addr = section["sh_addr"]
+                if addr and section["sh_type"] == "SHT_PROGBITS":
+                    self.segments.append((addr, section.data()))
+
+    def string(self, addr):
+        for base, data in self.segments:
+            if base <= addr < base + len(data):
+                end = data.index(b"\0", addr - base)
+                return data[addr - base:end].decode("latin-1")
+        return None
+
+
+def format_message(image, fmt, words):
+    """Rebuild the message, consuming argument words as the firmware did."""
+    args = list(words)
+
+    def take():
+        return args.pop(0) if args else 0
+
+    def replace(m):
+        flags, width, precision, length, conv = m.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = str(struct.unpack("<i", struct.pack("<I", take()))[0])
+        if precision == "*":
+            precision = str(struct.unpack("<i", struct.pack("<I", take()))[0])
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+
+        if conv in "fFeEgGaA":
+            lo, hi = take(), take()
+            value = struct.unpack("<d", struct.pack("<II", lo, hi))[0]
+            return (spec + ("e" if conv in "aA" else conv)) % value
+        if length == "ll":
+            lo, hi = take(), take()
+            value = lo | (hi << 32)
+            if conv in "di" and value & (1 << 63):
+                value -= 1 << 64
+            return (spec + ("d" if conv in "diu" else conv)) % value
+
+        value = take()
+        if conv in "di":
+            value = struct.unpack("<i", struct.pack("<I", value))[0]
+            return (spec + "d") % value
+        if conv == "u":
+            return (spec + "d") % value
+        if conv == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conv == "p":
+            return (spec + "s") % ("0x%08x" % value)
+        if conv == "s":
+            s = image.string(value)
+            return (spec + "s") % (s if s is not None else "<0x%08x>" % value)
+        return (spec + conv) % value
+
+    return conversion.sub(replace, fmt)
+
+
+def words(data):
+    for i in range(0, len(data) - 3, 4):
+        yield struct.unpack_from("<I", data, i)[0]
+
+
+def decode(image, data):
+    stream = words(data)
+    expected = None
+    for header in stream:
+        if header >> 24 != MAGIC:
+            continue    # Resynchronize.
+        sequence = (header >> 16) & 0xFF
+        level = (header >> 8) & 0xFF
+        count = header & 0xFF
+        try:
+            fmt_addr = next(stream)
+            timestamp = next(stream)
+            args = [next(stream) for _ in range(count)]
+        except StopIteration:
+            break
+
+        if expected is not None and sequence != expected:
+            print("*** %d record(s) dropped" % ((sequence - expected) & 0xFF))
+        expected = (sequence + 1) & 0xFF
+
+        fmt = image.string(fmt_addr)
+        if fmt is None:
+            text = "<unknown format 0x%08x> %s" % (fmt_addr, " ".join("%08x" % a for a in args))
+        else:
+            text = format_message(image, fmt, args)
+
+        name = LEVELS[level] if level < len(LEVELS) else str(level)
+        print("%10.3f %-6s %s" % (timestamp / 1000.0, name, text))
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip())
+        sys.exit(1)
+
+    image = Image(sys.argv[1])
+    with open(sys.argv[2], "rb") as f:
+        decode(image, f.read())
+
+
+if __name__ == "__main__":
+    main()